@@ -0,0 +1,19 @@
+// Decodes the quantized vertices of the projected grid (GRID_LAYOUT_QUANTIZED): x and z are
+//	16-bit integers counting quanta from the origin, y is a half float above it.
+//	The fragments are left to the fixed function.
+#version 120
+
+attribute vec2 quantized_xz;	// bound to 0
+attribute float half_y;			// bound to 1
+
+uniform vec3 origin;
+uniform float quantum;			// world units per step of x and z
+
+vec4 decodeGridVertex(vec2 xz, float y) {
+	return vec4(origin + vec3(xz.x * quantum, y, xz.y * quantum), 1.0);
+}
+
+void main() {
+	gl_Position = gl_ModelViewProjectionMatrix * decodeGridVertex(quantized_xz, half_y);
+	gl_FrontColor = gl_Color;
+}
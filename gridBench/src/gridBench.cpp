@@ -0,0 +1,677 @@
+#include "projectHM_PCH.h"
+
+#include <chrono>
+#include <thread>
+
+#include "Shape.h"
+#include "Camera.h"
+#include "OceanFFT.h"
+#include "PerlinNoise.h"
+#include "ProjectedGrid.h"
+#include "GridPipeline.h"
+#include "GridTrace.h"
+#include "../../hxlib/include/Profiler.h"
+
+/*
+	Headless benchmark of the projected grid.
+	Replays a camera path through ProjectedGrid::getRangeMatrix and ProjectedGrid::generateGeometry,
+	no window nor GL context is needed.
+
+	Usage: gridBench [options] [camera_path.cfg]
+		-sides N		resolution of the grid (256)
+		-rows N			rows of the grid when it isn't square, 0 for as many as sides (0)
+		-budget MS		steer the resolution toward MS milliseconds of generation per frame,
+						sides and rows being the maximum, 0 for a fixed resolution (0)
+		-threads N		threads generating the rows, 0 for all hardware threads (1)
+		-kernel K		scalar | sse2 | avx2 | auto (auto)
+		-loops N		times the camera path is replayed (10)
+		-frames N		frames of the built-in orbit when no camera path is given (600)
+		-layout L		grid | xyz | xz | soa | half | quantized, where the vertices go (grid: the
+						grid's own buffer; half and quantized: 6 bytes around the camera)
+		-ocean N		resolution of the FFT ocean displacing the grid, 0 for a flat grid (0)
+		-noise N		resolution of the Perlin noise displacing the grid instead (0)
+		-tilt DEG		tilt the water plane by DEG degrees around the x axis, which takes the
+						row kernels of general planes (0)
+		-warp			space the rows evenly on the screen (ProjectedGridOptions::warp_rows)
+		-cull			only generate the columns of each row inside the view (cull_rows)
+		-temporal		reuse the undisplaced grid while the range matrix barely moves, the
+						height field displacing it again every frame (temporal)
+		-views N		cameras per frame, the path camera turned by k * 360 / N degrees around
+						the y axis, batched through ProjectedGrid::getRangeMatrices (1)
+		-stats FILE		record the grid's GridStats and write every measured frame into FILE
+						as CSV
+		-draw US		sleep US microseconds per frame the water is in view, standing for the
+						draw and the glFinish of the demo (0)
+		-pipeline		build the grid one frame ahead on a GridPipeline worker while the
+						previous frame is "drawn", and report where the time of each stage went
+		-attributes A	fused | separate, also write the normals and the texcoords, interleaved
+						with the positions (8 floats per vertex): in the grid's fused pass, or
+						in a pass of their own each after the positions, as a reference
+		-record FILE	write the frames of the first pass over the path as a GridTrace
+		-replay FILE	replay a GridTrace instead of a camera path: its cameras, times, water
+						heights, grid options and height field, the other grid options and
+						-ocean and -noise being ignored. The first pass checks that every frame
+						gets the recorded range matrix.
+		-profile FILE	time the measured passes in Profiler zones and write them into FILE as
+						Chrome trace JSON (only the last frames of a long run are kept)
+
+	The camera path is a sequence of the records written by Camera::writeParas, one per
+	frame, which is what the demo records when pressing 'R'. The demo records a GridTrace of
+	the frames it draws when pressing 'X', and a profile of them when pressing 'Z'.
+*/
+
+typedef std::chrono::high_resolution_clock BenchClock;
+
+struct BenchOptions {
+	int sides;
+	int rows;
+	float budget;
+	int threads;
+	int loops;
+	int frames;
+	int ocean;
+	int noise;
+	int views;
+	float draw_us;
+	float tilt;
+	bool pipeline;
+	bool warp;
+	bool cull;
+	bool temporal;
+	GridKernelType kernel;
+	const char *layout;
+	const char *attributes;
+	const char *path_file;
+	const char *stats_file;
+	const char *record_file;
+	const char *replay_file;
+	const char *profile_file;
+public:
+	BenchOptions()
+		: sides(256), rows(0), budget(0.f), threads(1), loops(10), frames(600), ocean(0), noise(0), views(1), draw_us(0.f), tilt(0.f), pipeline(false), warp(false), cull(false), temporal(false), kernel(GRID_KERNEL_AUTO), layout("grid"), attributes(NULL), path_file(NULL),
+		stats_file(NULL), record_file(NULL), replay_file(NULL), profile_file(NULL) {}
+};
+
+struct StageTimes {
+	const char *name;
+	std::vector<double> samples;	// microseconds
+public:
+	StageTimes(const char *_name) : name(_name) {}
+
+	inline void add(const BenchClock::time_point &t0, const BenchClock::time_point &t1) {
+		samples.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+	}
+	double total() const {
+		double sum = 0.0;
+		for (size_t i = 0; i < samples.size(); ++i) {
+			sum += samples[i];
+		}
+		return sum;
+	}
+	// Nearest-rank percentile, `sorted' must be sorted
+	static double percentile(const std::vector<double> &sorted, double p) {
+		if (sorted.empty()) {
+			return 0.0;
+		}
+		size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+	}
+	void report() const {
+		std::vector<double> sorted(samples);
+		std::sort(sorted.begin(), sorted.end());
+		printf("%-16s %10.1f %10.1f %10.1f %10.1f %10.1f %8d\n", name,
+			sorted.empty() ? 0.0 : total() / sorted.size(),
+			percentile(sorted, 50.0), percentile(sorted, 90.0), percentile(sorted, 99.0),
+			sorted.empty() ? 0.0 : sorted.back(), (int)sorted.size());
+	}
+};
+
+static GridKernelType parseKernel(const char *name) {
+	for (int k = GRID_KERNEL_SCALAR; k <= GRID_KERNEL_AUTO; ++k) {
+		if (!strcmp(name, getGridKernelName((GridKernelType)k))) {
+			return (GridKernelType)k;
+		}
+	}
+	fprintf(stderr, "Unknown kernel '%s', using auto\n", name);
+	return GRID_KERNEL_AUTO;
+}
+
+static bool parseArguments(int argc, char *argv[], BenchOptions &options) {
+	for (int i = 1; i < argc; ++i) {
+		bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "-sides") && has_value) {
+			options.sides = std::max(2, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-rows") && has_value) {
+			options.rows = std::max(0, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-budget") && has_value) {
+			options.budget = std::max(0.f, (float)atof(argv[++i]));
+		} else if (!strcmp(argv[i], "-threads") && has_value) {
+			options.threads = std::max(0, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-kernel") && has_value) {
+			options.kernel = parseKernel(argv[++i]);
+		} else if (!strcmp(argv[i], "-loops") && has_value) {
+			options.loops = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-frames") && has_value) {
+			options.frames = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-ocean") && has_value) {
+			options.ocean = std::max(0, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-noise") && has_value) {
+			options.noise = std::max(0, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-tilt") && has_value) {
+			options.tilt = (float)atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-warp")) {
+			options.warp = true;
+		} else if (!strcmp(argv[i], "-cull")) {
+			options.cull = true;
+		} else if (!strcmp(argv[i], "-temporal")) {
+			options.temporal = true;
+		} else if (!strcmp(argv[i], "-views") && has_value) {
+			options.views = std::max(1, atoi(argv[++i]));
+		} else if (!strcmp(argv[i], "-layout") && has_value) {
+			options.layout = argv[++i];
+		} else if (!strcmp(argv[i], "-stats") && has_value) {
+			options.stats_file = argv[++i];
+		} else if (!strcmp(argv[i], "-draw") && has_value) {
+			options.draw_us = std::max(0.f, (float)atof(argv[++i]));
+		} else if (!strcmp(argv[i], "-attributes") && has_value) {
+			options.attributes = argv[++i];
+		} else if (!strcmp(argv[i], "-record") && has_value) {
+			options.record_file = argv[++i];
+		} else if (!strcmp(argv[i], "-replay") && has_value) {
+			options.replay_file = argv[++i];
+		} else if (!strcmp(argv[i], "-profile") && has_value) {
+			options.profile_file = argv[++i];
+		} else if (!strcmp(argv[i], "-pipeline")) {
+			options.pipeline = true;
+		} else if (argv[i][0] != '-' && options.path_file == NULL) {
+			options.path_file = argv[i];
+		} else {
+			fprintf(stderr, "Usage: %s [-sides N] [-rows N] [-budget MS] [-threads N] [-kernel scalar|sse2|avx2|auto] [-loops N] [-frames N] [-layout grid|xyz|xz|soa|half|quantized] [-ocean N | -noise N] [-tilt DEG] [-warp] [-cull] [-temporal] [-views N] [-stats FILE] [-draw US] [-pipeline] [-attributes fused|separate] [-record FILE] [-replay FILE] [-profile FILE] [camera_path.cfg]\n", argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+// A camera path is stored as the cameras of each frame
+static bool loadCameraPath(const char *filename, const Camera &base_camera, std::vector<Camera> &path) {
+	FILE *reader = fopen(filename, "r");
+	if (reader == NULL) {
+		fprintf(stderr, "Cannot read camera path from file '%s'\n", filename);
+		return false;
+	}
+	Camera camera(base_camera);
+	while (camera.readParas(reader)) {
+		path.push_back(camera);
+	}
+	fclose(reader);
+	if (path.empty()) {
+		fprintf(stderr, "No camera in camera path '%s'\n", filename);
+		return false;
+	}
+	return true;
+}
+
+// The cameras of the frames of a trace
+static bool loadTracePath(const GridTraceReader &trace, const Camera &base_camera, std::vector<Camera> &path) {
+	Camera camera(base_camera);
+	for (int f = 0; f < trace.getFrameCount(); ++f) {
+		GridTraceReader::applyCamera(trace.getFrame(f), camera);
+		path.push_back(camera);
+	}
+	if (path.empty()) {
+		fprintf(stderr, "No frame in grid trace\n");
+		return false;
+	}
+	return true;
+}
+
+// Orbit around the origin, with the pitch sweeping from the horizon to the sky so that some
+//	frames don't see the water at all
+static void buildOrbitPath(int frames, const Camera &base_camera, std::vector<Camera> &path) {
+	Camera camera(base_camera);
+	for (int f = 0; f < frames; ++f) {
+		float t = (float)f / (float)frames;
+		float angle = 2.f * PI * t;
+		camera.setPotision(6.f * sin(angle), 2.f + 1.5f * sin(3.f * angle), 6.f * cos(angle));
+		camera.setRotation(angle + PI, -0.15f + 1.05f * sin(2.f * angle));
+		path.push_back(camera);
+	}
+}
+
+// `camera' turned by `angle' around the y axis through the origin
+static void turnCamera(const Camera &camera, float angle, Camera &turned) {
+	const float c = cos(angle), s = sin(angle);
+	glm::vec3 p = camera.getPosition(), d = camera.getDirection();
+	turned = camera;
+	turned.setPosition(glm::vec3(c * p.x + s * p.z, p.y, -s * p.x + c * p.z));
+	turned.setDirection(glm::vec3(c * d.x + s * d.z, d.y, -s * d.x + c * d.z));
+}
+
+// The normals and the texcoords of the grid last generated into the interleaved `vertices',
+//	one pass over the generated spans for each, as they would be without the fused pass:
+//	the same central differences, v taken as even
+static void computeAttributes(const ProjectedGrid &proj_grid, float *vertices) {
+	const int columns = proj_grid.getColumns(), rows = proj_grid.getRows();
+	for (int iv = 0; iv < rows; ++iv) {
+		int begin, end;
+		proj_grid.getRowSpan(iv, begin, end);
+		for (int c = begin; c < end; ++c) {
+			const int i = iv * columns + c;
+			const int left = c > begin ? i - 1 : i, right = c + 1 < end ? i + 1 : i;
+			const int previous = iv > 0 ? i - columns : i, next = iv + 1 < rows ? i + columns : i;
+			const glm::vec3 along_u = glm::make_vec3(&vertices[right * 8]) - glm::make_vec3(&vertices[left * 8]);
+			const glm::vec3 along_v = glm::make_vec3(&vertices[next * 8]) - glm::make_vec3(&vertices[previous * 8]);
+			glm::vec3 n = glm::cross(along_v, along_u);
+			const float length2 = glm::dot(n, n);
+			n = length2 > 0.f ? n * (n.y < 0.f ? -1.f : 1.f) / sqrtf(length2) : glm::vec3(0.f, 1.f, 0.f);
+			vertices[i * 8 + 3] = n.x;
+			vertices[i * 8 + 4] = n.y;
+			vertices[i * 8 + 5] = n.z;
+		}
+	}
+	const float du = 1.f / (float)(columns - 1), dv = 1.f / (float)(rows - 1);
+	for (int iv = 0; iv < rows; ++iv) {
+		int begin, end;
+		proj_grid.getRowSpan(iv, begin, end);
+		for (int c = begin; c < end; ++c) {
+			vertices[(iv * columns + c) * 8 + 6] = c * du;
+			vertices[(iv * columns + c) * 8 + 7] = iv * dv;
+		}
+	}
+}
+
+// Sleep `us' microseconds, standing for a frame drawn and waited for with glFinish: the
+//	CPU is free for the pipeline's worker meanwhile
+static void waitDraw(float us) {
+	if (us > 0.f) {
+		std::this_thread::sleep_for(std::chrono::duration<double, std::micro>(us));
+	}
+}
+
+// The zones of the measured passes only, the first one warms up the caches
+static void startProfile(const BenchOptions &options, int loop) {
+	if (options.profile_file && loop == 1) {
+		Profiler::reset();
+		Profiler::setEnabled(true);
+	}
+}
+
+// Once no thread writes zones anymore
+static void saveProfile(const BenchOptions &options) {
+	if (options.profile_file == NULL) {
+		return;
+	}
+	Profiler::setEnabled(false);
+	if (Profiler::saveChromeTrace(options.profile_file)) {
+		printf("profiled: Chrome trace written into '%s'\n", options.profile_file);
+	}
+}
+
+// The path through a GridPipeline as the demo runs it: each frame takes the grid the worker
+//	built during the previous one, submits the next and draws. The stages are those of the
+//	frames' timestamps, the wait is the main thread blocked on the worker.
+static void runPipeline(const BenchOptions &options, const std::vector<Camera> &path, ProjectedGrid &proj_grid, HeightField *height_field) {
+	GridPipeline pipeline(proj_grid, 0.2f, -0.1f, 0.5f);
+	pipeline.setHeightField(height_field);
+	pipeline.start();
+
+	StageTimes wait_times("wait");
+	StageTimes field_times("height field");
+	StageTimes range_times("range matrix");
+	StageTimes grid_times("grid generation");
+	StageTimes latency_times("latency");
+	StageTimes frame_times("frame");
+	double worker_us = 0.0;
+	int early_outs = 0;
+	// The first loop only warms up the caches
+	for (int loop = 0; loop <= options.loops; ++loop) {
+		const bool measured = loop > 0;
+		startProfile(options, loop);
+		for (size_t f = 0; f < path.size(); ++f) {
+			PROFILE_ZONE("gridBench frame");
+			BenchClock::time_point t0 = BenchClock::now();
+			const GridPipelineFrame *frame = pipeline.acquire(true);
+			pipeline.submit(path[f], f / 60.f);
+			BenchClock::time_point t1 = BenchClock::now();
+			if (frame && frame->visible) {
+				waitDraw(options.draw_us);
+			}
+			BenchClock::time_point t2 = BenchClock::now();
+			if (!measured || frame == NULL) {
+				continue;
+			}
+			wait_times.add(t0, t1);
+			frame_times.add(t0, t2);
+			latency_times.samples.push_back((frame->acquire_ms - frame->submit_ms) * 1e3);
+			if (height_field) {
+				field_times.samples.push_back((frame->field_ms - frame->start_ms) * 1e3);
+			}
+			range_times.samples.push_back((frame->range_ms - frame->field_ms) * 1e3);
+			if (frame->visible) {
+				grid_times.samples.push_back((frame->generate_ms - frame->range_ms) * 1e3);
+			} else {
+				++early_outs;
+			}
+			worker_us += (frame->publish_ms - frame->start_ms) * 1e3;
+		}
+	}
+	pipeline.stop();
+	saveProfile(options);
+
+	printf("%-16s %10s %10s %10s %10s %10s %8s\n", "stage (us)", "mean", "p50", "p90", "p99", "max", "samples");
+	if (height_field) {
+		field_times.report();
+	}
+	range_times.report();
+	grid_times.report();
+	wait_times.report();
+	latency_times.report();
+	frame_times.report();
+	printf("early-outs: %d / %d frames\n", early_outs, (int)frame_times.samples.size());
+	// What the main thread didn't wait for ran while it was drawing
+	printf("hidden: %.1f%% of the worker's time behind the drawing\n",
+		worker_us > 0.0 ? std::max(0.0, 100.0 * (1.0 - wait_times.total() / worker_us)) : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+	BenchOptions options;
+	if (!parseArguments(argc, argv, options)) {
+		return -1;
+	}
+	Profiler::setThreadName("gridBench");
+	// Same camera settings as the demo
+	Camera camera(glm::vec3(0, 2, 6), 0, PI);
+	camera.setFOV(45.f);
+	camera.setFarClip(100.f);
+	camera.setNearClip(0.01f);
+	camera.setScreenWindow(1280, 720);
+
+	std::vector<Camera> path;
+	GridTraceReader trace;
+	if (options.replay_file) {
+		if (!trace.open(options.replay_file) || !loadTracePath(trace, camera, path)) {
+			return -1;
+		}
+	} else if (options.path_file) {
+		if (!loadCameraPath(options.path_file, camera, path)) {
+			return -1;
+		}
+	} else {
+		buildOrbitPath(options.frames, camera, path);
+	}
+
+	ProjectedGridOptions grid_options(options.sides, 0.1f, 0.1f);
+	grid_options.kernel = options.kernel;
+	grid_options.threads = options.threads;
+	grid_options.rows = options.rows;
+	grid_options.warp_rows = options.warp;
+	grid_options.cull_rows = options.cull;
+	grid_options.temporal = options.temporal;
+	grid_options.stats = options.stats_file != NULL;
+	if (options.budget > 0.f) {
+		grid_options.adaptive = true;
+		grid_options.budget_ms = options.budget;
+	}
+	const float tilt = options.tilt * PI / 180.f;
+	Plane base_plane(glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, cos(tilt), sin(tilt)));
+	if (options.replay_file) {
+		// As the grid of the trace was when it started
+		base_plane = trace.getBasePlane();
+		grid_options = GridTraceReader::getReplayOptions(trace.getFrame(0));
+		grid_options.stats = options.stats_file != NULL;
+	}
+	ProjectedGrid proj_grid(base_plane, &camera, grid_options);
+
+	// Same waves as the demo, the ocean on as many threads as the grid. A trace brings its own.
+	HeightField *height_field = NULL;
+	if (options.replay_file) {
+		height_field = trace.createHeightField();
+		options.ocean = trace.getFieldType() == GRID_TRACE_FIELD_OCEAN ? height_field->getResolution() : 0;
+		options.noise = trace.getFieldType() == GRID_TRACE_FIELD_NOISE ? height_field->getResolution() : 0;
+	} else if (options.ocean > 0) {
+		OceanFFTOptions ocean_options(options.ocean, 16.f, 6.f);
+		ocean_options.threads = options.threads;
+		height_field = new OceanFFT(ocean_options);
+	} else if (options.noise > 0) {
+		height_field = new PerlinNoise(PerlinNoiseOptions(options.noise, 16.f));
+	}
+	proj_grid.setHeightField(height_field);
+
+	// Caller-owned output, as a mapped buffer object would be
+	const int vertex_count = proj_grid.getVertexCapacity();
+	std::vector<float> output(vertex_count * (options.attributes ? 8 : 3));
+	GridVertexSink sink;
+	bool own_buffer = !strcmp(options.layout, "grid") && !options.attributes;
+	bool separate_attributes = false;
+	if (options.attributes) {
+		// Positions, normals and texcoords interleaved, whatever the layout
+		sink = GridVertexSink::AoS(&output[0], true, 8);
+		if (!strcmp(options.attributes, "fused")) {
+			sink = sink.withAttributes(&output[3], &output[6], 8);
+		} else if (!strcmp(options.attributes, "separate")) {
+			separate_attributes = true;
+		} else {
+			fprintf(stderr, "Unknown attributes '%s'\n", options.attributes);
+			return -1;
+		}
+	} else if (!strcmp(options.layout, "xyz")) {
+		sink = GridVertexSink::AoS(&output[0]);
+	} else if (!strcmp(options.layout, "xz")) {
+		sink = GridVertexSink::AoS(&output[0], false);
+	} else if (!strcmp(options.layout, "soa")) {
+		sink = GridVertexSink::SoA(&output[0], &output[vertex_count]);
+	} else if (!strcmp(options.layout, "half")) {
+		sink = GridVertexSink::Half(&output[0]);
+	} else if (!strcmp(options.layout, "quantized")) {
+		// As the renderer sets it up, see ProjectedGridRenderer::updatePacking
+		sink = GridVertexSink::Quantized(&output[0], glm::vec3(0.f), 1.25f * camera.getFarClip() / 32767.f);
+	} else if (!own_buffer) {
+		fprintf(stderr, "Unknown layout '%s'\n", options.layout);
+		return -1;
+	}
+	// With several views all of them go into one arena, as xyz
+	std::vector<Camera> view_cameras(options.views, camera);
+	std::vector<ProjectedGridView> views(options.views);
+	std::vector<float> arena;
+	if (options.views > 1) {
+		arena.resize(options.views * vertex_count * 3);
+		for (int k = 0; k < options.views; ++k) {
+			views[k].camera = &view_cameras[k];
+		}
+	}
+
+	printf("gridBench: %d frames x %d loops, %dx%d grid, budget %.2f ms, kernel %s, threads %d, layout %s, ocean %d, noise %d, views %d, draw %.0f us, %s plane%s%s%s%s\n",
+		(int)path.size(), options.loops, proj_grid.getColumns(), proj_grid.getRows(), options.budget,
+		getGridKernelName(resolveGridKernel(options.kernel)), options.threads, options.attributes ? "xyz+normal+uv" : options.layout, options.ocean, options.noise, options.views, options.draw_us,
+		proj_grid.getPlaneType() == GRID_PLANE_Y_UP ? "horizontal" : "general",
+		options.warp ? ", warped rows" : "", options.cull ? ", culled rows" : "", options.temporal ? ", temporal" : "", options.pipeline ? ", pipelined" : "");
+
+	if (options.pipeline) {
+		// The pipeline generates one view into frames of its own
+		if (options.views > 1 || !own_buffer || options.stats_file || options.record_file || options.replay_file) {
+			fprintf(stderr, "-pipeline ignores -views, -layout, -attributes, -stats, -record and -replay\n");
+		}
+		runPipeline(options, path, proj_grid, height_field);
+		delete height_field;
+		return 0;
+	}
+
+	FILE *stats_writer = NULL;
+	if (options.stats_file) {
+		stats_writer = fopen(options.stats_file, "w");
+		if (stats_writer == NULL) {
+			fprintf(stderr, "Cannot write grid stats into file '%s'\n", options.stats_file);
+			return -1;
+		}
+		GridStats::writeCSVHeader(stats_writer);
+	}
+	// A trace is of a single view
+	GridTraceWriter trace_writer;
+	if (options.record_file && (options.views > 1 || options.replay_file)) {
+		fprintf(stderr, "-record ignores -views and -replay\n");
+	} else if (options.record_file && !trace_writer.open(options.record_file, proj_grid)) {
+		return -1;
+	}
+	if (options.replay_file && options.views > 1) {
+		fprintf(stderr, "-replay ignores -views\n");
+		options.views = 1;
+	}
+	int replay_matches = 0;
+	int replay_options_frame = 0;	// the frame whose options the grid has
+
+	StageTimes field_times("height field");
+	StageTimes range_times("range matrix");
+	StageTimes grid_times("grid generation");
+	StageTimes frame_times("frame");
+	int early_outs = 0;
+	long long vertices = 0;
+	long long generated_vertices = 0;
+	long long grid_rows = 0, regenerated_rows = 0;
+	long long columns_sum = 0, rows_sum = 0;
+	// Smallest and largest screen distance between two rows, averaged over the frames
+	double row_spacing_min = 0.0, row_spacing_max = 0.0;
+	// The first loop only warms up the caches
+	for (int loop = 0; loop <= options.loops; ++loop) {
+		const bool measured = loop > 0;
+		startProfile(options, loop);
+		for (size_t f = 0; f < path.size(); ++f) {
+			PROFILE_ZONE("gridBench frame");
+			camera = path[f];
+			float time = f / 60.f;
+			float water_max_height = 0.2f, water_min_height = -0.1f, projector_height_inc = 0.5f;
+			if (options.replay_file) {
+				const GridTraceFrame &frame = trace.getFrame((int)f);
+				time = frame.time;
+				water_max_height = frame.water_max_height;
+				water_min_height = frame.water_min_height;
+				projector_height_inc = frame.projector_height_inc;
+				if (!GridTraceReader::isSameGrid(frame, trace.getFrame(replay_options_frame))) {
+					ProjectedGridOptions replay_options = GridTraceReader::getReplayOptions(frame);
+					replay_options.stats = options.stats_file != NULL;
+					proj_grid.setOptions(replay_options);
+					replay_options_frame = (int)f;
+				}
+			}
+			// Packed vertices are relative to the camera, as the renderer has them
+			if (sink.isPacked()) {
+				sink.origin = glm::vec3(camera.getPosition().x, 0.f, camera.getPosition().z);
+			}
+			BenchClock::time_point t_field = BenchClock::now();
+			if (height_field) {
+				height_field->update(time);
+			}
+			for (int k = 1; k < options.views; ++k) {
+				turnCamera(camera, 2.f * PI * k / options.views, view_cameras[k]);
+			}
+			view_cameras[0] = camera;
+			BenchClock::time_point t0 = BenchClock::now();
+			int frame_vertices = 0;
+			bool visible;
+			if (options.views > 1) {
+				visible = proj_grid.getRangeMatrices(&views[0], options.views, 0.2f, -0.1f, 0.5f) > 0;
+			} else {
+				visible = proj_grid.getRangeMatrix(water_max_height, water_min_height, projector_height_inc);
+			}
+			BenchClock::time_point t1 = BenchClock::now();
+			// The first pass runs on the grid as new, as the recording did
+			if (loop == 0 && trace_writer.isOpen()) {
+				trace_writer.record(proj_grid, time, water_max_height, water_min_height, projector_height_inc, visible);
+			}
+			if (loop == 0 && options.replay_file) {
+				replay_matches += GridTraceReader::matches(trace.getFrame((int)f), proj_grid, visible) ? 1 : 0;
+			}
+			if (visible) {
+				if (options.views > 1) {
+					frame_vertices = proj_grid.generateGeometry(&views[0], options.views, GridVertexSink::AoS(&arena[0]));
+				} else if (own_buffer) {
+					frame_vertices = proj_grid.getVertexCount();
+					proj_grid.generateGeometry();
+				} else {
+					frame_vertices = proj_grid.getVertexCount();
+					proj_grid.generateGeometry(sink);
+					if (separate_attributes) {
+						computeAttributes(proj_grid, &output[0]);
+					}
+				}
+			}
+			BenchClock::time_point t2 = BenchClock::now();
+			if (visible) {
+				waitDraw(options.draw_us);
+			}
+			BenchClock::time_point t3 = BenchClock::now();
+			if (!measured) {
+				continue;
+			}
+			if (height_field) {
+				field_times.add(t_field, t0);
+			}
+			range_times.add(t0, t1);
+			frame_times.add(t_field, t3);
+			if (stats_writer) {
+				GridStats::writeCSVRow(stats_writer, proj_grid.getStats()->getLastFrame());
+			}
+			if (visible) {
+				grid_times.add(t1, t2);
+				vertices += frame_vertices;
+				generated_vertices += proj_grid.getGeneratedVertexCount();
+				grid_rows += proj_grid.getRows() * (options.views > 1 ? (long long)frame_vertices / proj_grid.getVertexCount() : 1);
+				regenerated_rows += proj_grid.getRegeneratedRowCount();
+				columns_sum += proj_grid.getColumns();
+				rows_sum += proj_grid.getRows();
+				const float *spacing = proj_grid.getRowSpacing();
+				const float *spacing_end = spacing + proj_grid.getRows();
+				row_spacing_min += *std::min_element(spacing, spacing_end);
+				row_spacing_max += *std::max_element(spacing, spacing_end);
+			} else {
+				++early_outs;
+			}
+		}
+	}
+
+	printf("%-16s %10s %10s %10s %10s %10s %8s\n", "stage (us)", "mean", "p50", "p90", "p99", "max", "samples");
+	if (height_field) {
+		field_times.report();
+	}
+	range_times.report();
+	grid_times.report();
+	frame_times.report();
+	printf("early-outs: %d / %d frames\n", early_outs, (int)frame_times.samples.size());
+	double grid_seconds = grid_times.total() * 1e-6;
+	if (!grid_times.samples.empty()) {
+		const int frames = (int)grid_times.samples.size();
+		printf("row spacing: %.2f to %.2f pixels\n", row_spacing_min / frames, row_spacing_max / frames);
+	}
+	if (options.budget > 0.f && !grid_times.samples.empty()) {
+		const int frames = (int)grid_times.samples.size();
+		printf("adaptive: mean %.0fx%.0f, last %dx%d\n", (double)columns_sum / frames, (double)rows_sum / frames,
+			proj_grid.getColumns(), proj_grid.getRows());
+	}
+	printf("generated: %.1f%% of the grid vertices\n", vertices > 0 ? 100.0 * generated_vertices / vertices : 0.0);
+	if (options.views == 1 && !grid_times.samples.empty()) {
+		const int vertex_bytes = options.attributes ? 8 * (int)sizeof(float) :
+			sink.isPacked() ? 3 * (int)sizeof(short) : own_buffer || sink.hasY() ? 3 * (int)sizeof(float) : 2 * (int)sizeof(float);
+		printf("output: %d bytes per vertex, %.2f MB per frame\n", vertex_bytes,
+			(double)generated_vertices / grid_times.samples.size() * vertex_bytes / (1024.0 * 1024.0));
+	}
+	if (options.temporal) {
+		printf("regenerated: %.1f%% of the rows\n", grid_rows > 0 ? 100.0 * regenerated_rows / grid_rows : 0.0);
+	}
+	printf("throughput: %.2f M vertices/s\n", grid_seconds > 0.0 ? vertices / grid_seconds * 1e-6 : 0.0);
+	if (trace_writer.isOpen()) {
+		printf("recorded: %d frames into '%s'\n", trace_writer.getFrameCount(), options.record_file);
+	}
+	if (options.replay_file) {
+		printf("replayed: %d / %d frames with the recorded range matrix\n", replay_matches, (int)path.size());
+	}
+	saveProfile(options);
+	if (stats_writer) {
+		const GridStats &stats = *proj_grid.getStats();
+		printf("stats (last %d frames): %.1f%% of the vertices in the viewport, edges p50 %.2f px, p90 %.2f px, %.1f intersections\n",
+			stats.getWindowSize(), stats.getMean(GRID_STATS_INSIDE_PERCENT), stats.getPercentile(GRID_STATS_EDGE_MEDIAN, 50.f),
+			stats.getPercentile(GRID_STATS_EDGE_MEDIAN, 90.f), stats.getMean(GRID_STATS_INTERSECTIONS));
+		fclose(stats_writer);
+	}
+	delete height_field;
+	return 0;
+}
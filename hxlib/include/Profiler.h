@@ -0,0 +1,102 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <atomic>
+#include <cstddef>
+
+/*
+	Scoped zones timed in nanoseconds, for a sub-millisecond view of a frame on any platform.
+	PROFILE_ZONE("name") times the rest of its scope. The zone is written when it ends into a
+	ring buffer of the calling thread's own: no lock and no allocation once the thread wrote its
+	first zone, and only the last RING_SIZE zones of each thread are kept. Zones nest, each one
+	keeps its depth in the thread's stack of zones.
+	The clock is QueryPerformanceCounter on Windows (the steady clock of older MSVC ticks by
+	milliseconds) and std::chrono::steady_clock elsewhere.
+	Profiler::saveChromeTrace writes the zones of all the threads as Chrome trace JSON, for
+	chrome://tracing or Perfetto. It should be called while no zone is being written, e.g.
+	between frames, or the oldest zones of a busy thread may be torn.
+	Nothing is recorded until Profiler::setEnabled(true): a zone then costs a load and a branch.
+*/
+
+// One zone, written when it ends
+struct ProfilerZone {
+	const char *name;			// must outlive the profiler, e.g. a literal
+	unsigned long long begin_ns, end_ns;
+	int depth;					// zones of the thread it is nested in
+};
+
+// The zones of one thread
+struct ProfilerThread {
+	enum {
+		RING_SIZE = 1 << 15
+	};
+
+	int id;						// in the order the threads wrote their first zone
+	char name[32];
+	int depth;					// zones open
+	std::atomic<unsigned> count;	// zones written, the next one goes to count % RING_SIZE
+	ProfilerZone zones[RING_SIZE];
+};
+
+class Profiler {
+public:
+	static void setEnabled(bool enabled);
+	static inline bool isEnabled() {
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+	// Since the program started
+	static unsigned long long getNanoseconds();
+
+	// The calling thread's, created the first time
+	static ProfilerThread& getThread();
+	// The calling thread's name in the trace, up to 31 characters
+	static void setThreadName(const char *name);
+	// Forget the zones of all the threads
+	static void reset();
+
+	// The zones kept, false if the file can't be written
+	static bool saveChromeTrace(const char *filename);
+
+protected:
+	static std::atomic<bool> s_enabled;
+};
+
+class ProfileZone {
+public:
+	inline explicit ProfileZone(const char *name)
+		: m_thread(Profiler::isEnabled() ? &Profiler::getThread() : NULL), m_name(name), m_begin_ns(0) {
+		if (m_thread) {
+			++m_thread->depth;
+			m_begin_ns = Profiler::getNanoseconds();
+		}
+	}
+	inline ~ProfileZone() {
+		if (m_thread) {
+			const unsigned long long end_ns = Profiler::getNanoseconds();
+			--m_thread->depth;
+			const unsigned index = m_thread->count.load(std::memory_order_relaxed);
+			ProfilerZone &zone = m_thread->zones[index % ProfilerThread::RING_SIZE];
+			zone.name = m_name;
+			zone.begin_ns = m_begin_ns;
+			zone.end_ns = end_ns;
+			zone.depth = m_thread->depth;
+			m_thread->count.store(index + 1, std::memory_order_release);
+		}
+	}
+
+protected:
+	ProfilerThread *m_thread;
+	const char *m_name;
+	unsigned long long m_begin_ns;
+
+private:
+	ProfileZone(const ProfileZone &);
+	ProfileZone& operator = (const ProfileZone &);
+};
+
+#define PROFILE_ZONE_CONCAT(a, b) a##b
+#define PROFILE_ZONE_NAME(line) PROFILE_ZONE_CONCAT(profile_zone_, line)
+// Times the rest of the scope as `name'
+#define PROFILE_ZONE(name) ProfileZone PROFILE_ZONE_NAME(__LINE__)(name)
+
+#endif	/* __PROFILER_H__ */
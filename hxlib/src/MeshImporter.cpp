@@ -1,8 +1,10 @@
 #include "MeshImporter.h"
 
 #include "MeshBuilder.h"
+#include "Profiler.h"
 
 bool MeshImporterOBJ::import(const char *mesh_path, MeshBuilder *mesh_builder) {
+	PROFILE_ZONE("MeshImporterOBJ::import");
 	FILE *mesh_reader = fopen(mesh_path, "r");
 	if (mesh_reader == NULL) {
 		fprintf(stderr, "Cannot read model '%s'!\n", mesh_path);
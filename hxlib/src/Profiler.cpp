@@ -0,0 +1,139 @@
+#include "../include/Profiler.h"
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+
+#if defined(_MSC_VER)
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#endif
+
+namespace {
+#if defined(_WIN32)
+	long long queryTicks() {
+		LARGE_INTEGER ticks;
+		QueryPerformanceCounter(&ticks);
+		return ticks.QuadPart;
+	}
+	long long queryFrequency() {
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		return frequency.QuadPart;
+	}
+	// Set before main, the statics of functions aren't initialized thread-safely by older MSVC
+	const long long s_frequency = queryFrequency();
+	const long long s_epoch = queryTicks();
+#else
+	const std::chrono::steady_clock::time_point s_epoch = std::chrono::steady_clock::now();
+#endif
+
+	// The threads never give their zones back, a thread ending leaves its zones to the trace
+	std::mutex s_threads_mutex;
+	std::vector<ProfilerThread*> s_threads;
+	PROFILER_THREAD_LOCAL ProfilerThread *t_thread = NULL;
+	// Kept until the thread writes its first zone, naming a thread doesn't allocate its zones
+	PROFILER_THREAD_LOCAL char t_thread_name[32];
+
+	void writeJSONString(FILE *writer, const char *s) {
+		fputc('"', writer);
+		for (; *s; ++s) {
+			if (*s == '"' || *s == '\\') {
+				fputc('\\', writer);
+				fputc(*s, writer);
+			} else if ((unsigned char)*s < 0x20) {
+				fprintf(writer, "\\u%04x", (unsigned char)*s);
+			} else {
+				fputc(*s, writer);
+			}
+		}
+		fputc('"', writer);
+	}
+}
+
+std::atomic<bool> Profiler::s_enabled(false);
+
+void Profiler::setEnabled(bool enabled) {
+	s_enabled.store(enabled);
+}
+
+unsigned long long Profiler::getNanoseconds() {
+#if defined(_WIN32)
+	const long long ticks = queryTicks() - s_epoch;
+	// In two parts, ticks * 1e9 would overflow after a few minutes
+	return (unsigned long long)(ticks / s_frequency * 1000000000LL + ticks % s_frequency * 1000000000LL / s_frequency);
+#else
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_epoch).count();
+#endif
+}
+
+ProfilerThread& Profiler::getThread() {
+	if (t_thread == NULL) {
+		ProfilerThread *thread = new ProfilerThread;
+		thread->depth = 0;
+		thread->count.store(0);
+		std::lock_guard<std::mutex> lock(s_threads_mutex);
+		thread->id = (int)s_threads.size();
+		if (t_thread_name[0]) {
+			strcpy(thread->name, t_thread_name);
+		} else {
+			sprintf(thread->name, "thread %d", thread->id);
+		}
+		s_threads.push_back(thread);
+		t_thread = thread;
+	}
+	return *t_thread;
+}
+
+void Profiler::setThreadName(const char *name) {
+	strncpy(t_thread_name, name, sizeof(t_thread_name) - 1);
+	t_thread_name[sizeof(t_thread_name) - 1] = '\0';
+	if (t_thread) {
+		strcpy(t_thread->name, t_thread_name);
+	}
+}
+
+void Profiler::reset() {
+	std::lock_guard<std::mutex> lock(s_threads_mutex);
+	for (size_t i = 0; i < s_threads.size(); ++i) {
+		s_threads[i]->count.store(0);
+	}
+}
+
+bool Profiler::saveChromeTrace(const char *filename) {
+	FILE *writer = fopen(filename, "w");
+	if (writer == NULL) {
+		fprintf(stderr, "Cannot write profile into file '%s'\n", filename);
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(s_threads_mutex);
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", writer);
+	bool first_event = true;
+	for (size_t t = 0; t < s_threads.size(); ++t) {
+		const ProfilerThread &thread = *s_threads[t];
+		fprintf(writer, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first_event ? "" : ",\n", thread.id);
+		writeJSONString(writer, thread.name);
+		fputs("}}", writer);
+		first_event = false;
+		// Complete events, in microseconds
+		const unsigned count = thread.count.load(std::memory_order_acquire);
+		const unsigned first = count > ProfilerThread::RING_SIZE ? count - ProfilerThread::RING_SIZE : 0;
+		for (unsigned i = first; i < count; ++i) {
+			const ProfilerZone &zone = thread.zones[i % ProfilerThread::RING_SIZE];
+			fputs(",\n{\"name\":", writer);
+			writeJSONString(writer, zone.name);
+			fprintf(writer, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%d}}",
+				thread.id, zone.begin_ns * 1e-3, (zone.end_ns - zone.begin_ns) * 1e-3, zone.depth);
+		}
+	}
+	fputs("\n]}\n", writer);
+	fclose(writer);
+	return true;
+}
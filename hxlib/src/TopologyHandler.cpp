@@ -1,8 +1,10 @@
 #include "TopologyHandler.h"
+#include "Profiler.h"
 
 #include <algorithm>
 
 void TopologyHandler::buildEdgeMap() {
+	PROFILE_ZONE("TopologyHandler::buildEdgeMap");
 	using namespace std;
 	// start to build edge map
 	int edge_num = m_face_num << 2;
@@ -56,6 +58,7 @@ void TopologyHandler::buildEdgeMap() {
 }
 
 void TopologyHandler::setIndexArray(const int _face_num, const int _vertex_num, const int *_face_degrees, const int *_face_indices) {
+	PROFILE_ZONE("TopologyHandler::setIndexArray");
 	m_face_num = _face_num;
 	m_face_degrees = const_cast<int*>(_face_degrees);
 	m_face_indices = const_cast<int*>(_face_indices);
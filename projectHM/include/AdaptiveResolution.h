@@ -0,0 +1,56 @@
+#ifndef __ADAPTIVERESOLUTION_H__
+#define __ADAPTIVERESOLUTION_H__
+
+/*
+	Steers the resolution of the grid toward a CPU time budget per frame.
+	The frame times are smoothed, and as long as they stay within TOLERANCE of the budget
+	nothing changes: only a drift lasting SETTLE_FRAMES frames moves the resolution, by at
+	most MAX_STEP in vertex count at once, so that the grid neither flickers between two
+	resolutions nor pops. The vertex count is scaled by budget / time, each axis taking the
+	square root of it within its own [min, max] range (an axis at its limit leaves the rest
+	to the other one), and an axis ignores changes smaller than 1/GRANULARITY of itself.
+*/
+class AdaptiveResolution {
+public:
+	enum {
+		SETTLE_FRAMES = 8,
+		GRANULARITY = 32
+	};
+	static const float TOLERANCE;
+	static const float SMOOTHING;
+	static const float MAX_STEP;
+
+	AdaptiveResolution();
+
+	// Start again from the maximum resolution
+	void reset(int min_columns, int max_columns, int min_rows, int max_rows, float budget_ms);
+	// The time the last frame took at the current resolution, true if the resolution changed
+	bool update(float frame_ms);
+
+	inline int getColumns() const {
+		return m_columns;
+	}
+	inline int getRows() const {
+		return m_rows;
+	}
+	inline float getBudget() const {
+		return m_budget_ms;
+	}
+	// Smoothed frame time, predicted for the new resolution right after a change
+	inline float getSmoothedTime() const {
+		return m_smoothed_ms;
+	}
+
+protected:
+	// The new resolution of an axis scaled by `scale', unchanged when too close
+	static int scaleAxis(int sides, float scale, int min_sides, int max_sides);
+
+	int m_min_columns, m_max_columns;
+	int m_min_rows, m_max_rows;
+	int m_columns, m_rows;
+	float m_budget_ms;
+	float m_smoothed_ms;	// < 0 until the first frame
+	int m_drift_frames;		// consecutive frames over (> 0) or under (< 0) the budget
+};
+
+#endif	/* __ADAPTIVERESOLUTION_H__ */
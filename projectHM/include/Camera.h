@@ -1,37 +1,40 @@
 #ifndef __CAMERA_H__
 #define __CAMERA_H__
 
+/*
+	A perspective camera placed by its position and its rotation.
+	The setters only mark the matrices they change as stale: the matrices are brought up to date
+	by the getters, once however many setters were called since, or all together by update().
+	The view and projection matrices are inverted in closed form (the view is rigid, the
+	projection a plain perspective), and the view-projection matrix and its inverse are cached
+	along with them. The getters are const but may update the cache, so a camera changed since
+	its last update() must not be read from several threads at once.
+*/
+
 class Camera {
 public:
-	Camera(const Camera &c) {
-		*this = c;
-		updateViewMatrix();
-		updateProjectionMatrix();
-	}
 	Camera(const glm::vec3 &_position = glm::vec3(0.f), float h_angle = PI, float v_angle = 0.f)
-		: m_position(_position), m_zNear(0.001f), m_zFar(100.f) {
+		: m_position(_position), m_zNear(0.001f), m_zFar(100.f), m_dirty(DIRTY_ALL) {
 		setRotation(v_angle, h_angle);
-		updateViewMatrix();
-		updateProjectionMatrix();
 	}
 
 	// Modifiations on the projection matrix
 	inline void setFOV(float fov) {
 		m_fov = fov;
-		updateProjectionMatrix();
+		invalidateProjection();
 	}
 	inline void setFarClip(float zFar) {
 		m_zFar = zFar;
-		updateProjectionMatrix();
+		invalidateProjection();
 	}
 	inline void setNearClip(float zNear) {
 		m_zNear = zNear;
-		updateProjectionMatrix();
+		invalidateProjection();
 	}
 	inline void setScreenWindow(int _width, int _height) {
 		m_width = _width;
 		m_height = _height;
-		updateProjectionMatrix();
+		invalidateProjection();
 	}
 	inline float getFOV() const {
 		return m_fov;
@@ -55,77 +58,134 @@ public:
 		return m_position;
 	}
 	inline glm::vec3 getDirection() const {
+		validateRotation();
 		return m_direction_tar;
 	}
+	inline glm::vec2 getRotation() const {
+		return m_rotation;
+	}
 
 	// Modifications on the view matrix
 	// Move the camera
 	inline void moveX(float dis) {
+		validateRotation();
 		m_position += m_direction_right * dis;
-		updateViewMatrix();
+		invalidatePosition();
 	}
 	inline void moveY(float dis) {
+		validateRotation();
 		m_position += m_direction_upv * dis;
-		updateViewMatrix();
+		invalidatePosition();
 	}
 	inline void moveZ(float dis) {
+		validateRotation();
 		m_position += m_direction_tar * dis;
-		updateViewMatrix();
+		invalidatePosition();
 	}
 	inline void addRotation(const glm::vec2 &_rotation) {
 		m_rotation += _rotation;
-		updateViewMatrix();
+		invalidateRotation();
 	}
 	inline void addRotation(float h_angle, float v_angle) {
 		m_rotation.x += h_angle;
 		m_rotation.y += v_angle;
-		updateViewMatrix();
+		invalidateRotation();
 	}
 	inline void setPosition(const glm::vec3 &_position) {
 		m_position = _position;
-		updateViewMatrix();
+		invalidatePosition();
 	}
 	inline void setPotision(float px, float py, float pz) {
 		m_position = glm::vec3(px, py, pz);
-		updateViewMatrix();
+		invalidatePosition();
 	}
 	inline void setRotation(const glm::vec2 &_rotation) {
 		m_rotation = _rotation;
-		updateViewMatrix();
+		invalidateRotation();
 	}
 	inline void setRotation(float h_angle, float v_angle) {
 		m_rotation = glm::vec2(h_angle, v_angle);
-		updateViewMatrix();
+		invalidateRotation();
 	}
 	inline void setDirection(const glm::vec3 &_direction) {
 		glm::vec3 dir_norm = glm::normalize(_direction);
 		m_rotation.x = atan2(dir_norm.x, dir_norm.z);
 		m_rotation.y = asin(dir_norm.y);
-		updateViewMatrix();
+		invalidateRotation();
 	}
 
-	void updateViewMatrix();
-	void updateProjectionMatrix();
-	const glm::mat4& getProjectionMatrix();
-	const glm::mat4& getViewMatrix();
-	const glm::mat4 getViewProjectionMatrix() const;
+	// Bring all the matrices up to date
+	void update() const;
+	const glm::mat4& getProjectionMatrix() const;
+	const glm::mat4& getViewMatrix() const;
+	const glm::mat4& getViewProjectionMatrix() const;
+	const glm::mat4& getInverseProjectionMatrix() const;
+	const glm::mat4& getInverseViewMatrix() const;
+	const glm::mat4& getInverseViewProjectionMatrix() const;
 	void saveParasToFile(const char *filename) const;
 	void loadParasFromFile(const char *filename);
+	// A camera path is a sequence of the records written by writeParas, one per frame
+	void writeParas(FILE *writter) const;
+	bool readParas(FILE *reader);
 	// For GPU ray propagation
 	float* getPositionPtr();
 	float* getViewMatrixInvPtr();
 
 protected:
+	// What each setter leaves stale, the directions are only stale after a rotation
+	enum {
+		DIRTY_DIRECTIONS = 1,
+		DIRTY_VIEW = 2,
+		DIRTY_PROJECTION = 4,
+		DIRTY_VIEW_PROJECTION = 8,
+		DIRTY_ALL = 15
+	};
+
+	inline void invalidateRotation() {
+		m_dirty |= DIRTY_DIRECTIONS | DIRTY_VIEW | DIRTY_VIEW_PROJECTION;
+	}
+	inline void invalidatePosition() {
+		m_dirty |= DIRTY_VIEW | DIRTY_VIEW_PROJECTION;
+	}
+	inline void invalidateProjection() {
+		m_dirty |= DIRTY_PROJECTION | DIRTY_VIEW_PROJECTION;
+	}
+	inline void validateRotation() const {
+		if (m_dirty & DIRTY_DIRECTIONS) {
+			updateDirections();
+		}
+	}
+	inline void validateView() const {
+		if (m_dirty & (DIRTY_DIRECTIONS | DIRTY_VIEW)) {
+			updateViewMatrix();
+		}
+	}
+	inline void validateProjection() const {
+		if (m_dirty & DIRTY_PROJECTION) {
+			updateProjectionMatrix();
+		}
+	}
+	inline void validateViewProjection() const {
+		if (m_dirty & DIRTY_ALL) {
+			update();
+		}
+	}
+	void updateDirections() const;
+	void updateViewMatrix() const;
+	void updateProjectionMatrix() const;
+
 	glm::vec2 m_rotation;						// camera's rotation
 	glm::vec3 m_position;						// camera's position
-	glm::vec3 m_direction_tar;
-	glm::vec3 m_direction_upv;
-	glm::vec3 m_direction_right;
+	mutable glm::vec3 m_direction_tar;
+	mutable glm::vec3 m_direction_upv;
+	mutable glm::vec3 m_direction_right;
 	int m_width, m_height;
 	float m_fov, m_zNear, m_zFar;
-	// Matrices
-	glm::mat4 m_worldToCamera, m_cameraToWorld;		// view matrix (world space -> camera(eye) space)
-	glm::mat4 m_cameraToScreen, m_screenToCamera;	// projection matrix (camera(eye) space -> clip space)
+	mutable int m_dirty;
+	// Matrices, cached
+	mutable glm::mat4 m_worldToCamera, m_cameraToWorld;		// view matrix (world space -> camera(eye) space)
+	mutable glm::mat4 m_cameraToScreen, m_screenToCamera;	// projection matrix (camera(eye) space -> clip space)
+	mutable glm::mat4 m_worldToScreen, m_screenToWorld;		// view projection matrix
 	//glm::mat4 m_cameraToRaster, m_rasterToCamera;	// (clip space -> NDC space, a [-1, 1]^3 cube -> Image space)
 };
 
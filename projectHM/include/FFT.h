@@ -0,0 +1,38 @@
+#ifndef __FFT_H__
+#define __FFT_H__
+
+class WorkerPool;
+
+/*
+	In-place inverse 2D FFT of a n x n complex field, n being a power of 2:
+		x(m, n) = sum_k X(k) * exp(+2 pi i (k_x m + k_z n) / n)
+	without the 1/n^2 normalization.
+	The real and imaginary parts live in separate arrays (row-major), so that all the
+	butterflies are done 4 complex numbers at a time with SSE:
+	- along the rows, over the butterflies of a same stage,
+	- along the columns, over 4 neighbouring columns sharing the same twiddle.
+	Rows, then bands of columns, are spread over the worker pool when one is given.
+*/
+class FFT2D {
+public:
+	explicit FFT2D(int n);
+
+	inline int getSize() const {
+		return m_n;
+	}
+
+	void inverse(float *re, float *im, WorkerPool *pool) const;
+
+protected:
+	void transformRows(float *re, float *im, int row_begin, int row_end) const;
+	void transformColumns(float *re, float *im, int column_begin, int column_end) const;
+	static void transformRowsTask(void *context, int begin, int end);
+	static void transformColumnsTask(void *context, int begin, int end);
+
+	int m_n;
+	std::vector<int> m_bit_reverse;
+	// Twiddles of the stage with half-size h at [h, 2h): exp(+2 pi i j / 2h)
+	std::vector<float> m_twiddle_re, m_twiddle_im;
+};
+
+#endif	/* __FFT_H__ */
@@ -0,0 +1,220 @@
+#ifndef __GRIDKERNELS_H__
+#define __GRIDKERNELS_H__
+
+/*
+	Row kernels of the projected grid.
+	As long as homogeneous coordinates are used, each row of the grid is a straight line
+	between the (interpolated) left and right corners, so a row is fully described by its
+	homogeneous start point and the per-vertex step along it:
+		p(i) = start + i * step,	vertex(i) = (p(i).x / p(i).w, 0, p(i).z / p(i).w)
+	The SIMD kernels walk the row 4 (SSE2) or 8 (AVX2) vertices at a time, and replace the
+	divide by a reciprocal estimation refined with one Newton-Raphson step.
+	On a horizontal plane y is the same for the whole row (p.y / p.w of the start point); on any
+	other plane y is divided like x and z, the line staying on the plane in homogeneous space.
+	Each kernel is specialized for the plane type and for the most common row lengths, which
+	getGridRowKernel picks from the options of the grid.
+	Besides 32-bit floats the kernels can pack the vertices into 6 bytes, relative to an origin
+	(e.g. the camera) so that the precision goes where the grid is dense: three half floats,
+	or x and z as 16-bit integers counting quanta and y as a half float. GL draws the half
+	floats as they are, data/shaders/projected_grid_quantized.vert decodes the quantized ones.
+*/
+
+enum GridKernelType {
+	GRID_KERNEL_SCALAR = 0,
+	GRID_KERNEL_SSE2,
+	GRID_KERNEL_AVX2,
+	GRID_KERNEL_AUTO		// pick the best one supported by the running CPU
+};
+
+enum GridVertexLayout {
+	GRID_LAYOUT_AOS_XYZ = 0,	// x y z | x y z | ...
+	GRID_LAYOUT_AOS_XZ,			// x z | x z | ..., the always-zero y is dropped
+	GRID_LAYOUT_SOA,			// x x ... | z z ... (| y y ...)
+	GRID_LAYOUT_HALF_XYZ,		// x y z | ... as half floats, relative to the origin
+	GRID_LAYOUT_QUANTIZED		// x z as 16-bit integers in quanta, then y as a half float, relative to the origin
+};
+
+enum GridPlaneType {
+	GRID_PLANE_Y_UP = 0,	// horizontal, y = constant
+	GRID_PLANE_GENERAL		// any orientation, e.g. a tilted lake
+};
+
+struct GridVertexSink {
+	GridVertexLayout layout;
+	// AoS: vertex i starts at data[i * stride], stride is in floats, 0 for tightly packed
+	float *data;
+	int stride;
+	// SoA: one stream per channel, y is NULL when the channel is dropped
+	float *x, *y, *z;
+	// Packed: vertex i starts at packed[i * stride], stride is in 16-bit words, 0 for tightly packed
+	short *packed;
+	glm::vec3 origin;		// subtracted before packing
+	float quantum;			// world units per step of the quantized x and z
+	// Optional attributes, written by ProjectedGrid along with the positions but not by the row
+	//	kernels: the unit normal (3 floats) and the grid's (u, v) (2 floats) of vertex i at
+	//	normals[i * attribute_stride] and texcoords[i * attribute_stride]. NULL when not wanted,
+	//	attribute_stride is in floats, 0 for tightly packed.
+	float *normals, *texcoords;
+	int attribute_stride;
+public:
+	GridVertexSink()
+		: layout(GRID_LAYOUT_AOS_XYZ), data(NULL), stride(0), x(NULL), y(NULL), z(NULL), packed(NULL), origin(0.f), quantum(1.f),
+		normals(NULL), texcoords(NULL), attribute_stride(0) {}
+
+	static inline GridVertexSink AoS(float *_data, bool with_y = true, int _stride = 0) {
+		GridVertexSink sink;
+		sink.layout = with_y ? GRID_LAYOUT_AOS_XYZ : GRID_LAYOUT_AOS_XZ;
+		sink.data = _data;
+		sink.stride = _stride;
+		return sink;
+	}
+	static inline GridVertexSink SoA(float *_x, float *_z, float *_y = NULL) {
+		GridVertexSink sink;
+		sink.layout = GRID_LAYOUT_SOA;
+		sink.x = _x, sink.y = _y, sink.z = _z;
+		return sink;
+	}
+	static inline GridVertexSink Half(void *_data, const glm::vec3 &_origin = glm::vec3(0.f), int _stride = 0) {
+		GridVertexSink sink;
+		sink.layout = GRID_LAYOUT_HALF_XYZ;
+		sink.packed = static_cast<short*>(_data);
+		sink.stride = _stride;
+		sink.origin = _origin;
+		return sink;
+	}
+	// x and z within +-32767 quanta of the origin, farther ones are clamped
+	static inline GridVertexSink Quantized(void *_data, const glm::vec3 &_origin, float _quantum, int _stride = 0) {
+		GridVertexSink sink;
+		sink.layout = GRID_LAYOUT_QUANTIZED;
+		sink.packed = static_cast<short*>(_data);
+		sink.stride = _stride;
+		sink.origin = _origin;
+		sink.quantum = _quantum;
+		return sink;
+	}
+	// The same sink, also taking the normals and the texcoords, e.g. interleaved after the
+	//	positions of an AoS sink
+	inline GridVertexSink withAttributes(float *_normals, float *_texcoords, int _attribute_stride = 0) const {
+		GridVertexSink sink = *this;
+		sink.normals = _normals;
+		sink.texcoords = _texcoords;
+		sink.attribute_stride = _attribute_stride;
+		return sink;
+	}
+	inline bool hasAttributes() const {
+		return normals != NULL || texcoords != NULL;
+	}
+	inline bool isPacked() const {
+		return layout == GRID_LAYOUT_HALF_XYZ || layout == GRID_LAYOUT_QUANTIZED;
+	}
+	inline int getStride() const {
+		if (stride) return stride;
+		return layout == GRID_LAYOUT_AOS_XZ ? 2 : 3;
+	}
+	inline bool hasY() const {
+		return layout != GRID_LAYOUT_AOS_XZ && (layout != GRID_LAYOUT_SOA || y != NULL);
+	}
+	// Where the vertices go, whatever the layout
+	inline const void* getMemory() const {
+		return isPacked() ? (const void*)packed : layout == GRID_LAYOUT_SOA ? (const void*)x : (const void*)data;
+	}
+	static inline short quantize(float v, float quantum) {
+		const float q = floor(v / quantum + 0.5f);
+		return (short)std::min(std::max(q, -32767.f), 32767.f);
+	}
+	inline glm::vec3 load(int i) const {
+		if (layout == GRID_LAYOUT_SOA) {
+			return glm::vec3(x[i], y ? y[i] : 0.f, z[i]);
+		}
+		if (isPacked()) {
+			const short *src = packed + i * getStride();
+			if (layout == GRID_LAYOUT_HALF_XYZ) {
+				return origin + glm::vec3(glm::detail::toFloat32(src[0]), glm::detail::toFloat32(src[1]), glm::detail::toFloat32(src[2]));
+			}
+			return origin + glm::vec3(src[0] * quantum, glm::detail::toFloat32(src[2]), src[1] * quantum);
+		}
+		const float *src = data + i * getStride();
+		return layout == GRID_LAYOUT_AOS_XYZ ? glm::vec3(src[0], src[1], src[2]) : glm::vec3(src[0], 0.f, src[1]);
+	}
+	// Write vertex i = p, y is dropped if the sink has no such channel
+	inline void set(int i, const glm::vec3 &p) const {
+		if (isPacked()) {
+			short *dst = packed + i * getStride();
+			const glm::vec3 r = p - origin;
+			if (layout == GRID_LAYOUT_HALF_XYZ) {
+				dst[0] = glm::detail::toFloat16(r.x);
+				dst[1] = glm::detail::toFloat16(r.y);
+				dst[2] = glm::detail::toFloat16(r.z);
+			} else {
+				dst[0] = quantize(r.x, quantum);
+				dst[1] = quantize(r.z, quantum);
+				dst[2] = glm::detail::toFloat16(r.y);
+			}
+		} else if (layout == GRID_LAYOUT_SOA) {
+			x[i] = p.x;
+			z[i] = p.z;
+			if (y) y[i] = p.y;
+		} else {
+			float *dst = data + i * getStride();
+			dst[0] = p.x;
+			if (layout == GRID_LAYOUT_AOS_XYZ) {
+				dst[1] = p.y;
+				dst[2] = p.z;
+			} else {
+				dst[1] = p.z;
+			}
+		}
+	}
+	// Write the attributes of vertex i, those the sink doesn't take are dropped
+	inline void setAttributes(int i, const glm::vec3 &n, float u, float v) const {
+		if (normals) {
+			float *dst = normals + i * (attribute_stride ? attribute_stride : 3);
+			dst[0] = n.x;
+			dst[1] = n.y;
+			dst[2] = n.z;
+		}
+		if (texcoords) {
+			float *dst = texcoords + i * (attribute_stride ? attribute_stride : 2);
+			dst[0] = u;
+			dst[1] = v;
+		}
+	}
+	// Write vertex i = (x, 0, z)
+	inline void store(int i, float _x, float _z) const {
+		if (isPacked()) {
+			set(i, glm::vec3(_x, 0.f, _z));
+		} else if (layout == GRID_LAYOUT_SOA) {
+			x[i] = _x;
+			z[i] = _z;
+			if (y) y[i] = 0.f;
+		} else {
+			float *dst = data + i * getStride();
+			dst[0] = _x;
+			if (layout == GRID_LAYOUT_AOS_XYZ) {
+				dst[1] = 0.f;
+				dst[2] = _z;
+			} else {
+				dst[1] = _z;
+			}
+		}
+	}
+};
+
+// Write the `count' vertices of a row into the sink, starting at vertex `first'
+typedef void (*GridRowKernel)(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first);
+
+// Best kernel supported by the running CPU
+GridKernelType detectGridKernel();
+// Resolve GRID_KERNEL_AUTO and unsupported requests to a kernel which is safe to run
+GridKernelType resolveGridKernel(GridKernelType type);
+// The kernel of `type' for rows on a plane of type `plane', specialized for rows of `columns'
+//	vertices when it is 128, 256, 512 or 1024; rows of other lengths are generated all the same
+GridRowKernel getGridRowKernel(GridKernelType type, GridPlaneType plane = GRID_PLANE_Y_UP, int columns = 0);
+const char* getGridKernelName(GridKernelType type);
+
+// The generic kernels of horizontal planes
+void gridRowScalar(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first);
+void gridRowSSE2(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first);
+void gridRowAVX2(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first);
+
+#endif	/* __GRIDKERNELS_H__ */
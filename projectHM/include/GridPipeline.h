@@ -0,0 +1,140 @@
+#ifndef __GRIDPIPELINE_H__
+#define __GRIDPIPELINE_H__
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "Camera.h"
+#include "GridTopology.h"
+
+class HeightField;
+class ProjectedGrid;
+
+/*
+	The projected grid built one frame ahead on a worker thread.
+	submit() hands the worker the camera and the time of the next frame and returns right away;
+	the worker updates the height field, builds the range matrix, generates and displaces the
+	vertices into a frame of its own while the caller draws the previous one.
+	The frames go through a triple buffer: the worker writes the back frame, the caller reads
+	the front one, and publishing or acquiring swaps its side with the middle one through a
+	single atomic exchange, so neither side ever waits on the other for the data. A fresh bit
+	in the middle index tells the reader whether the worker published since the last swap.
+	Every stage of a frame is timestamped on the pipeline's clock, to see how much of the grid
+	was hidden behind the drawing.
+	While running, the worker owns the grid and the height field: finish() must be called
+	before changing the grid's options or switching the field.
+*/
+
+// One frame of the pipeline, everything needed to draw it without the grid
+struct GridPipelineFrame {
+	unsigned index;				// of the submission, from 1
+	bool visible;				// nothing else is set when the water isn't in view
+	int columns, rows;
+	GridTopologyType topology;
+	bool culled;				// only the draw ranges hold generated vertices
+	std::vector<glm::vec3> vertices;	// room for the grid's largest resolution
+	// Index ranges (vertex ranges with points) of the generated rows when culled
+	std::vector<int> range_firsts, range_counts;
+	int range_count;
+	// Of the camera the frame was built for
+	glm::mat4 view_matrix, projection_matrix;
+	// Stage timestamps in milliseconds: submitted, picked up by the worker, height field
+	//	updated, range matrix built, vertices generated, published, acquired by the reader
+	double submit_ms, start_ms, field_ms, range_ms, generate_ms, publish_ms, acquire_ms;
+public:
+	GridPipelineFrame()
+		: index(0), visible(false), columns(0), rows(0), topology(GRID_TOPOLOGY_STRIPS), culled(false), range_count(0),
+		submit_ms(0.0), start_ms(0.0), field_ms(0.0), range_ms(0.0), generate_ms(0.0), publish_ms(0.0), acquire_ms(0.0) {}
+};
+
+class GridPipeline {
+public:
+	// The heights bound the water when the grid has no height field, see
+	//	ProjectedGrid::getRangeMatrix
+	GridPipeline(ProjectedGrid &grid, float water_max_height, float water_min_height, float projector_height_inc);
+	~GridPipeline();
+
+	// Start the worker, the grid is then projected for a camera of the pipeline's own
+	void start();
+	// Wait for the worker to finish and stop it, the grid goes back to its camera
+	void stop();
+	inline bool isRunning() const {
+		return m_worker.joinable();
+	}
+
+	// Updated by the worker before each frame, also set as the grid's height field. May be NULL.
+	void setHeightField(HeightField *height_field);
+
+	// The next frame, seen by `camera' at `time' seconds. A submission the worker hasn't
+	//	picked up yet is replaced.
+	void submit(const Camera &camera, float time);
+	// Wait until the worker is done with all the submissions
+	void finish();
+	// The last frame published, swapped in if the worker published since the last call.
+	//	With `wait', the frame of the last submission. NULL before the first frame.
+	//	The frame stays valid until the next acquire.
+	const GridPipelineFrame* acquire(bool wait);
+
+	// Submissions, frames published and those replaced before being acquired
+	inline unsigned getSubmittedCount() const {
+		return m_submitted;
+	}
+	inline unsigned getPublishedCount() const {
+		return m_published.load();
+	}
+	inline unsigned getSkippedCount() const {
+		return m_skipped;
+	}
+	// The clock of the timestamps
+	double getMilliseconds() const;
+
+protected:
+	enum {
+		FRAME_MASK = 3,
+		FRESH_BIT = 4
+	};
+
+	struct Request {
+		Camera camera;
+		float time;
+		unsigned index;
+		double submit_ms;
+	};
+
+	void workerLoop();
+	// Run the grid for `request' into the back frame
+	void buildFrame(const Request &request);
+
+	ProjectedGrid &m_grid;
+	const Camera *m_grid_camera;	// the grid's own, while running
+	HeightField *m_height_field;
+	float m_water_max_height, m_water_min_height, m_projector_height_inc;
+	Camera m_camera;				// the worker's copy of the submitted camera
+	std::chrono::steady_clock::time_point m_epoch;
+
+	// Triple buffer: m_back is the worker's, m_front the reader's, m_middle the spare one
+	//	with FRESH_BIT when published and not acquired yet
+	GridPipelineFrame m_frames[3];
+	int m_back, m_front;
+	std::atomic<int> m_middle;
+	bool m_has_front;
+
+	std::thread m_worker;
+	std::mutex m_mutex;
+	std::condition_variable m_wake_cond;
+	std::condition_variable m_done_cond;
+	Request m_request;
+	bool m_pending, m_busy, m_quit;
+	unsigned m_submitted, m_acquired_index, m_skipped;
+	std::atomic<unsigned> m_published;
+
+private:
+	GridPipeline(const GridPipeline &);
+	GridPipeline& operator = (const GridPipeline &);
+};
+
+#endif	/* __GRIDPIPELINE_H__ */
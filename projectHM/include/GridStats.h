@@ -0,0 +1,115 @@
+#ifndef __GRIDSTATS_H__
+#define __GRIDSTATS_H__
+
+/*
+	What a projected grid did with its vertices, frame by frame, to tune the resolution and the
+	projector aiming against real camera paths.
+	A frame records the range matrix search (how many points of V_visible were found, whether
+	it was an early-out or the cached matrix), how the grid lands on the screen (the part of
+	the generated vertices inside the viewport, the screen length of the grid edges) and the
+	time of each stage. The last WINDOW frames are kept: the histograms and percentiles are
+	taken over them when asked, so recording a frame costs a copy. Frames can be exported as
+	CSV, one line each.
+*/
+
+// Counters of one frame
+struct GridFrameStats {
+	int frame;					// index since the last reset
+	bool visible;				// the water was in view
+	bool cached;				// the range matrix of the previous frame was reused
+	int intersections;			// points bounding V_visible: the ends of the frustum edges within the slab
+	int columns, rows;
+	int generated_vertices;
+	float inside_percent;		// of the generated vertices, within the rendering camera's viewport
+	// Screen length in pixels of the grid edges within the viewport, undisplaced
+	float edge_min, edge_median, edge_max;
+	float range_ms;				// getRangeMatrix
+	float generate_ms;			// generateGeometry, displacement included
+	float displace_ms;			// displacing the vertices, summed over the threads
+public:
+	GridFrameStats()
+		: frame(0), visible(false), cached(false), intersections(0), columns(0), rows(0), generated_vertices(0),
+		inside_percent(0.f), edge_min(0.f), edge_median(0.f), edge_max(0.f), range_ms(0.f), generate_ms(0.f), displace_ms(0.f) {}
+};
+
+// The values of GridFrameStats the histograms can be taken on
+enum GridStatsValue {
+	GRID_STATS_INTERSECTIONS,
+	GRID_STATS_GENERATED_VERTICES,
+	GRID_STATS_INSIDE_PERCENT,
+	GRID_STATS_EDGE_MIN,
+	GRID_STATS_EDGE_MEDIAN,
+	GRID_STATS_EDGE_MAX,
+	GRID_STATS_RANGE_MS,
+	GRID_STATS_GENERATE_MS,
+	GRID_STATS_DISPLACE_MS,
+	GRID_STATS_VALUE_COUNT
+};
+
+class GridStats {
+public:
+	enum {
+		WINDOW = 256
+	};
+
+	GridStats();
+
+	void reset();
+	// The frame being recorded, cleared by beginFrame
+	inline GridFrameStats& getCurrentFrame() {
+		return m_current;
+	}
+	// Push the frame being recorded, if any, and start a new one
+	void beginFrame();
+	// Push the frame being recorded
+	void endFrame();
+
+	// Frames since the last reset, and those of them that didn't see the water
+	inline int getFrameCount() const {
+		return m_frame_count;
+	}
+	inline int getEarlyOutCount() const {
+		return m_early_outs;
+	}
+	inline int getCachedCount() const {
+		return m_cached;
+	}
+	// The frames kept, at most WINDOW; 0 is the oldest
+	inline int getWindowSize() const {
+		return std::min(m_frame_count, (int)WINDOW);
+	}
+	const GridFrameStats& getFrame(int i) const;
+	// The last frame pushed, an empty one before the first
+	inline const GridFrameStats& getLastFrame() const {
+		return m_frame_count > 0 ? getFrame(getWindowSize() - 1) : m_empty;
+	}
+
+	static float getValue(const GridFrameStats &frame, GridStatsValue value);
+	static const char* getValueName(GridStatsValue value);
+	// Nearest-rank percentile of `value' over the visible frames of the window (all of them for
+	//	the range matrix time), 0 without any
+	float getPercentile(GridStatsValue value, float p) const;
+	float getMean(GridStatsValue value) const;
+	// Counts of `value' over the visible frames of the window in `bins' even bins from
+	//	`low' to `high', the values out of the range going to the first or the last bin
+	void getHistogram(GridStatsValue value, float low, float high, int bins, int *counts) const;
+
+	// One line of column names, then one line per frame
+	static void writeCSVHeader(FILE *writer);
+	static void writeCSVRow(FILE *writer, const GridFrameStats &frame);
+	// The frames of the window, false if the file can't be written
+	bool saveCSV(const char *filename) const;
+
+protected:
+	// The visible frames' `value' into m_values
+	void gatherValues(GridStatsValue value) const;
+
+	GridFrameStats m_frames[WINDOW];	// ring, m_frame_count % WINDOW is the next
+	GridFrameStats m_current, m_empty;
+	bool m_recording;
+	int m_frame_count;
+	int m_early_outs, m_cached;
+	mutable std::vector<float> m_values;
+};
+
+#endif	/* __GRIDSTATS_H__ */
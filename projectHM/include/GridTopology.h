@@ -0,0 +1,108 @@
+#ifndef __GRIDTOPOLOGY_H__
+#define __GRIDTOPOLOGY_H__
+
+/*
+	Index buffer of a columns x rows grid, vertex (iu, iv) being iv * columns + iu.
+	The connectivity of the projected grid never changes, only the positions do, so the
+	indices are only built again when the resolution or the primitive type changes.
+	To keep the post-transform cache warm the quads are walked in vertical stripes of
+	STRIPE_QUADS columns instead of full rows: a stripe row shares STRIPE_QUADS + 1 vertices
+	with the next one, which still fit in the cache.
+	16-bit indices are used whenever they can address all the vertices (and, with strips,
+	leave 0xFFFF free for the primitive restart).
+*/
+
+enum GridTopologyType {
+	GRID_TOPOLOGY_POINTS = 0,	// no connectivity at all
+	GRID_TOPOLOGY_TRIANGLES,	// indexed triangles
+	GRID_TOPOLOGY_STRIPS		// triangle strips separated by the restart index
+};
+
+class GridTopology {
+public:
+	enum {
+		STRIPE_QUADS = 16
+	};
+
+	GridTopology();
+
+	// Build the indices again if the resolution or the type changed, true if rebuilt
+	bool update(int columns, int rows, GridTopologyType type);
+	// Room for the indices of any resolution up to max_columns x max_rows, so that changing
+	//	the resolution later on doesn't allocate. The 16-bit indices only get room for the
+	//	grids they can address, the 32-bit ones only if the largest grid needs them.
+	void reserve(int max_columns, int max_rows, GridTopologyType type);
+
+	inline GridTopologyType getType() const {
+		return m_type;
+	}
+	inline int getColumns() const {
+		return m_columns;
+	}
+	inline int getRows() const {
+		return m_rows;
+	}
+	// Increased each time the indices are rebuilt, to know when to upload them again
+	inline unsigned getRevision() const {
+		return m_revision;
+	}
+	inline bool isShortIndex() const {
+		return m_short_index;
+	}
+	inline int getIndexSize() const {
+		return m_short_index ? (int)sizeof(unsigned short) : (int)sizeof(unsigned);
+	}
+	inline int getIndexCount() const {
+		return m_index_count;
+	}
+	inline const void* getIndices() const {
+		if (m_index_count == 0) return NULL;
+		return m_short_index ? (const void*)&m_indices16[0] : (const void*)&m_indices32[0];
+	}
+	inline unsigned getRestartIndex() const {
+		return m_short_index ? 0xFFFFu : 0xFFFFFFFFu;
+	}
+	// Where each strip starts and how many indices it has (the restart index excluded),
+	//	for drawing the strips one by one when primitive restart isn't available
+	inline int getStripCount() const {
+		return (int)m_strip_first.size();
+	}
+	inline const std::vector<int>& getStripFirsts() const {
+		return m_strip_first;
+	}
+	inline const std::vector<int>& getStripSizes() const {
+		return m_strip_size;
+	}
+	// Vertical stripes of at most STRIPE_QUADS quads the indices walk
+	inline int getStripeCount() const {
+		return (m_columns - 1 + STRIPE_QUADS - 1) / STRIPE_QUADS;
+	}
+	// The indices of the quads [quad_begin, quad_end) of the row of quads `iv' which lie in
+	//	the stripe `stripe': a run of the triangles, or a piece of a strip starting on an even
+	//	index so the winding stays the same (never holding the restart index).
+	//	False if the stripe holds none of them, or with points.
+	bool getQuadRange(int stripe, int iv, int quad_begin, int quad_end, int &first, int &count) const;
+
+protected:
+	// Indices of a columns x rows grid, the restart indices included
+	static size_t countIndices(int columns, int rows, GridTopologyType type);
+	// Vertices 16-bit indices can address, the restart index aside
+	static int getMaxShortVertices(GridTopologyType type);
+
+	template <typename Index>
+	void buildTriangles(std::vector<Index> &indices) const;
+	template <typename Index>
+	void buildStrips(std::vector<Index> &indices, Index restart);
+
+	GridTopologyType m_type;
+	int m_columns, m_rows;
+	unsigned m_revision;
+	bool m_short_index;
+	int m_index_count;
+	std::vector<int> m_strip_first;
+	std::vector<int> m_strip_size;
+	std::vector<unsigned short> m_indices16;
+	std::vector<unsigned> m_indices32;
+};
+
+#endif	/* __GRIDTOPOLOGY_H__ */
@@ -0,0 +1,159 @@
+#ifndef __GRIDTRACE_H__
+#define __GRIDTRACE_H__
+
+#include "Shape.h"
+#include "Camera.h"
+#include "ProjectedGrid.h"
+
+/*
+	Binary trace of a projected grid's frames, to replay a slow frame offline exactly as it ran.
+	A frame holds all the range matrix and the vertices depend on: the rendering camera's pose
+	and projection, the grid's options and the resolution it had, the time the height field was
+	updated to, the water heights given to getRangeMatrix, and the range matrix that came out of
+	it. The header holds the base plane and the height field the grid had when the trace started,
+	an OceanFFT or a PerlinNoise and its options, from which the reader builds the field again.
+	The file is a GridTraceHeader followed by one GridTraceFrame per frame, fixed-size records of
+	4-byte fields in the machine's byte order: the reader maps the file and reads the frames in
+	place, and a trace cut short by a crash keeps the frames that reached the file.
+	Replayed from its first frame into a new grid on the same build, a frame gets the same range
+	matrix bit for bit. An adaptive grid is replayed at the resolution each frame had, the
+	controller steering on the time it measures.
+*/
+
+enum GridTraceFieldType {
+	GRID_TRACE_FIELD_NONE = 0,	// flat grid, or a field the trace can't rebuild
+	GRID_TRACE_FIELD_OCEAN,
+	GRID_TRACE_FIELD_NOISE
+};
+
+// OceanFFTOptions, fields of 4 bytes
+struct GridTraceOceanOptions {
+	int resolution;
+	float tile_size;
+	int spectrum;
+	float wind_speed;
+	float wind_direction[2];
+	float amplitude, fetch, gamma, choppiness, repeat_period;
+	unsigned seed;
+	int threads;
+};
+
+// PerlinNoiseOptions, fields of 4 bytes
+struct GridTraceNoiseOptions {
+	int resolution;
+	float tile_size;
+	int octaves;
+	float amplitude, persistence, speed, speed_ratio;
+	unsigned seed;
+};
+
+struct GridTraceHeader {
+	char magic[4];				// "PGTR"
+	int version;
+	int frame_size;				// sizeof(GridTraceFrame) of the writer
+	float base_plane[4];		// of the grid, normalized
+	int field;					// GridTraceFieldType of the grid's height field
+	GridTraceOceanOptions ocean;	// with GRID_TRACE_FIELD_OCEAN, zeros otherwise
+	GridTraceNoiseOptions noise;	// with GRID_TRACE_FIELD_NOISE, zeros otherwise
+};
+
+// ProjectedGridOptions, fields of 4 bytes
+struct GridTraceOptions {
+	int sides, rows;
+	float strength, elevation;
+	int smooth;
+	int kernel, threads, topology;
+	int adaptive;
+	float budget_ms;
+	int min_sides;
+	int warp_rows, cull_rows;
+	float cull_margin;
+	int stats, temporal;
+	float reuse_pixels, refresh_pixels;
+	int refresh_rows;
+};
+
+struct GridTraceFrame {
+	int index;					// from 0
+	int visible;				// getRangeMatrix's result, the range matrix is the last visible one's otherwise
+	float time;					// seconds, given to HeightField::update
+	// The rendering camera
+	float position[3];
+	float rotation[2];
+	float fov, near_clip, far_clip;
+	int width, height;
+	GridTraceOptions options;
+	int columns, rows;			// resolution of the frame
+	float water_max_height, water_min_height, projector_height_inc;
+	float range_matrix[16];
+};
+
+class GridTraceWriter {
+public:
+	GridTraceWriter();
+	~GridTraceWriter();
+
+	// Starts a trace of frames of `grid' and its current height field, false if the file can't
+	//	be written. The field must stay the same until the trace is closed.
+	bool open(const char *filename, const ProjectedGrid &grid);
+	void close();
+	inline bool isOpen() const {
+		return m_writer != NULL;
+	}
+	// The frame `grid' just got its range matrix for, with the arguments of getRangeMatrix
+	void record(const ProjectedGrid &grid, float time, float water_max_height, float water_min_height, float projector_height_inc, bool visible);
+	inline int getFrameCount() const {
+		return m_frame_count;
+	}
+
+protected:
+	FILE *m_writer;
+	int m_frame_count;
+
+private:
+	GridTraceWriter(const GridTraceWriter &);
+	GridTraceWriter& operator = (const GridTraceWriter &);
+};
+
+class GridTraceReader {
+public:
+	GridTraceReader();
+	~GridTraceReader();
+
+	// Maps the trace, false if it can't be read or isn't one
+	bool open(const char *filename);
+	void close();
+	inline int getFrameCount() const {
+		return m_frame_count;
+	}
+	inline const GridTraceFrame& getFrame(int i) const {
+		return m_frames[i];
+	}
+	Plane getBasePlane() const;
+	inline GridTraceFieldType getFieldType() const {
+		return (GridTraceFieldType)((const GridTraceHeader*)m_data)->field;
+	}
+	// The height field the trace was recorded with, new and not updated yet, NULL for a flat grid
+	HeightField* createHeightField() const;
+
+	// The camera of `frame', its other settings left as they are
+	static void applyCamera(const GridTraceFrame &frame, Camera &camera);
+	// The options replaying `frame': adaptive grids at the frame's resolution
+	static ProjectedGridOptions getReplayOptions(const GridTraceFrame &frame);
+	// Whether the grid must be given new options between the frames
+	static bool isSameGrid(const GridTraceFrame &a, const GridTraceFrame &b);
+	// The range matrix of `frame' bit for bit, and the same visibility
+	static bool matches(const GridTraceFrame &frame, const ProjectedGrid &grid, bool visible);
+
+protected:
+	HANDLE m_file, m_mapping;
+	const char *m_data;
+	const GridTraceFrame *m_frames;
+	int m_frame_count;
+
+private:
+	GridTraceReader(const GridTraceReader &);
+	GridTraceReader& operator = (const GridTraceReader &);
+};
+
+#endif	/* __GRIDTRACE_H__ */
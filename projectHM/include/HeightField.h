@@ -0,0 +1,127 @@
+#ifndef __HEIGHTFIELD_H__
+#define __HEIGHTFIELD_H__
+
+/*
+	Texels of a periodic height field, laid out for sampling at scattered positions.
+	The texels are stored in TILE_SIZE x TILE_SIZE blocks, row-major within a block and the
+	blocks row-major within the map: a bilinear footprint almost always stays within one
+	block, i.e. a few cache lines, where rows of resolution floats would need one line per
+	row. Horizontally displaced fields interleave (height, x, z, 0) per texel so that the
+	three channels come from the same lines. Addressing wraps around, the map is periodic.
+*/
+class TiledHeightMap {
+public:
+	enum {
+		TILE_BITS = 3,
+		TILE_SIZE = 1 << TILE_BITS
+	};
+
+	TiledHeightMap();
+
+	// resolution must be a power of 2 >= TILE_SIZE, channels 1 (height) or 4 (height, x, z, 0)
+	void resize(int resolution, int channels);
+	// From row-major samples, disp_x and disp_z are ignored with 1 channel
+	void pack(const float *heights, const float *disp_x, const float *disp_z);
+
+	inline int getResolution() const {
+		return m_resolution;
+	}
+	inline int getChannels() const {
+		return m_channels;
+	}
+	// Texel (x, z), wrapped into the map
+	inline int getTexelIndex(int x, int z) const {
+		x &= m_mask;
+		z &= m_mask;
+		return ((((z >> TILE_BITS) << m_tile_row_bits) + (x >> TILE_BITS)) << (2 * TILE_BITS))
+			+ ((z & (TILE_SIZE - 1)) << TILE_BITS) + (x & (TILE_SIZE - 1));
+	}
+	inline const float* getTexel(int x, int z) const {
+		return &m_texels[getTexelIndex(x, z) * m_channels];
+	}
+
+	// Bilinear sample at (tx, tz) in texels, `out' gets the channels but the padding
+	void sample(float tx, float tz, float *out) const;
+	// Bilinear samples at the `count' positions (x[i] * scale, z[i] * scale) in texels.
+	//	dx and dz may be NULL, and are only written with 4 channels.
+	//	8 (AVX2 gathers) or 4 (SSE2) positions at a time.
+	void sampleBatch(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const;
+
+protected:
+	void sampleRange(const float *x, const float *z, int begin, int end, float scale, float *h, float *dx, float *dz) const;
+	void sampleBatchSSE2(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const;
+	void sampleBatchAVX2(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const;
+
+	int m_resolution, m_mask, m_tile_row_bits;
+	int m_channels;
+	std::vector<float> m_texels;
+};
+
+/*
+	A periodic height field displacing the projected grid.
+	The field is a resolution x resolution tile of samples covering tile_size x tile_size
+	world units and repeating itself in x and z. Besides the height, a field may also move
+	the vertices horizontally (e.g. the choppy waves of an ocean).
+	Subclasses fill the row-major samples in update() and commit() them to the tiled texels
+	all the sampling goes through.
+*/
+class HeightField {
+public:
+	HeightField();
+	virtual ~HeightField() {}
+
+	// Bring the field to the time `time' in seconds
+	virtual void update(float time) = 0;
+
+	inline int getResolution() const {
+		return m_resolution;
+	}
+	inline float getTileSize() const {
+		return m_tile_size;
+	}
+	inline bool hasHorizontalDisplacement() const {
+		return !m_disp_x.empty();
+	}
+	// Raw samples, row z then column x
+	inline const float* getHeights() const {
+		return m_heights.empty() ? NULL : &m_heights[0];
+	}
+	inline const TiledHeightMap& getTexels() const {
+		return m_texels;
+	}
+	// Range of the heights as of the last commit(), the filtered samples stay within it
+	inline float getMinHeight() const {
+		return m_min_height;
+	}
+	inline float getMaxHeight() const {
+		return m_max_height;
+	}
+	// Longest horizontal move as of the last commit(), 0 without horizontal displacement
+	inline float getMaxHorizontalDisplacement() const {
+		return m_max_horizontal;
+	}
+
+	// Bilinearly filtered, (x, z) in world units
+	float sampleHeight(float x, float z) const;
+	// (horizontal x, height, horizontal z)
+	glm::vec3 sampleDisplacement(float x, float z) const;
+	// Batched, `count' positions (x[i], z[i]) in world units. dx and dz may be NULL, they get
+	//	0 if the field has no horizontal displacement.
+	void sampleDisplacements(const float *x, const float *z, int count, float *dx, float *h, float *dz) const;
+
+protected:
+	// resolution must be a power of 2
+	void resize(int resolution, float tile_size, bool horizontal);
+	// The samples are ready, update the texels and the height range
+	void commit();
+
+	int m_resolution;
+	float m_tile_size;
+	std::vector<float> m_heights;
+	float m_min_height, m_max_height;
+	float m_max_horizontal;
+	std::vector<float> m_disp_x, m_disp_z;
+	TiledHeightMap m_texels;
+};
+
+#endif	/* __HEIGHTFIELD_H__ */
@@ -0,0 +1,86 @@
+#ifndef __OCEANFFT_H__
+#define __OCEANFFT_H__
+
+#include "HeightField.h"
+
+class FFT2D;
+class WorkerPool;
+
+/*
+	Ocean height field synthesized with FFTs, after J. Tessendorf's "Simulating Ocean Water".
+	The initial amplitudes h0(k) are drawn once from a wave spectrum, then each frame:
+		h(k, t) = h0(k) * exp(i w(k) t) + conj(h0(-k)) * exp(-i w(k) t),	w(k) = sqrt(g |k|)
+		D(k, t) = -i k / |k| * h(k, t)
+	and an inverse 2D FFT gives the heights and the horizontal (choppy) displacement.
+	h(k, t) and D(k, t) are both Hermitian, so their transforms are real: the height and the
+	x-displacement share one complex FFT (h + i Dx), the z-displacement takes a second one.
+	The frequencies are quantized to multiples of 2 pi / repeat_period, which makes the
+	animation loop after repeat_period seconds and keeps the phases small.
+*/
+
+enum OceanSpectrumType {
+	OCEAN_SPECTRUM_PHILLIPS = 0,	// Tessendorf's, fully developed sea
+	OCEAN_SPECTRUM_JONSWAP			// fetch-limited sea
+};
+
+struct OceanFFTOptions {
+	int resolution;			// samples per side of the tile, power of 2 in [128, 1024]
+	float tile_size;		// in world units (meters), the size of the longest wave
+	OceanSpectrumType spectrum;
+	float wind_speed;		// m/s, 10m above the water
+	glm::vec2 wind_direction;	// in the xz plane
+	float amplitude;		// scale of the spectrum, 1 for the nominal wave heights
+	float fetch;			// JONSWAP: distance over which the wind blows, in m
+	float gamma;			// JONSWAP: peak enhancement factor
+	float choppiness;		// scale of the horizontal displacement, 0 for heights only
+	float repeat_period;	// in seconds
+	unsigned seed;
+	int threads;			// threads running the FFTs, 1 for serial, 0 for all hardware threads
+public:
+	OceanFFTOptions(int _resolution = 256, float _tile_size = 100.f, float _wind_speed = 10.f)
+		: resolution(_resolution), tile_size(_tile_size), spectrum(OCEAN_SPECTRUM_PHILLIPS),
+		wind_speed(_wind_speed), wind_direction(1.f, 0.f), amplitude(1.f), fetch(100000.f), gamma(3.3f),
+		choppiness(1.f), repeat_period(200.f), seed(1), threads(1) {}
+};
+
+class OceanFFT : public HeightField {
+public:
+	explicit OceanFFT(const OceanFFTOptions &options);
+	virtual ~OceanFFT();
+
+	// Draw the initial amplitudes again
+	void setOptions(const OceanFFTOptions &options);
+	inline const OceanFFTOptions& getOptions() const {
+		return m_options;
+	}
+
+	virtual void update(float time);
+
+protected:
+	// Directional spectrum at the wave vector k, in m^4
+	float getSpectrum(const glm::vec2 &k) const;
+	void initSpectrum();
+	// h(k, t) of the rows [row_begin, row_end), into the FFT buffers
+	void evolveRows(int row_begin, int row_end);
+	static void evolveRowsTask(void *ocean, int row_begin, int row_end);
+
+	OceanFFTOptions m_options;
+	FFT2D *m_fft;
+	WorkerPool *m_worker_pool;
+	float m_time;		// in [0, repeat_period)
+	// Per wave vector, in the FFT order: index i of a row or column is the
+	//	frequency i for i < n/2, i - n otherwise
+	std::vector<float> m_h0_re, m_h0_im;		// h0(k)
+	std::vector<float> m_h0c_re, m_h0c_im;		// conj(h0(-k))
+	std::vector<float> m_omega;
+	std::vector<float> m_chop_x, m_chop_z;		// -choppiness * k / |k|
+	// FFT buffers, swapped with the samples once transformed
+	std::vector<float> m_hx_re, m_hx_im;		// h + i * Dx
+	std::vector<float> m_dz_re, m_dz_im;		// Dz
+
+private:
+	OceanFFT(const OceanFFT &);
+	OceanFFT& operator = (const OceanFFT &);
+};
+
+#endif	/* __OCEANFFT_H__ */
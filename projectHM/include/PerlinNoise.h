@@ -0,0 +1,83 @@
+#ifndef __PERLINNOISE_H__
+#define __PERLINNOISE_H__
+
+#include "HeightField.h"
+
+/*
+	Height field made of octaves of animated gradient noise, as in Johanson's thesis.
+	Every octave is the same small periodic texture (OCTAVE_CELLS x OCTAVE_CELLS noise cells,
+	a 2D slice moving through 3D Perlin noise) tiled twice as often as the previous one.
+	An octave moves along the time axis of the noise at its own speed, and is cached at the
+	two steps around its time, one texel apart along that axis: it is only generated again
+	once it crossed a step, at the default speeds every 12 frames at 60 fps for the first
+	octave and every 4 for the fifth. In between, the two steps are blended and the octave
+	moves smoothly.
+	The resolution x resolution tile keeps the sum of the octaves, and an update only adds
+	what the octaves that moved changed. The changes are summed at each octave's period
+	first, the finer octaves repeating within the coarser ones, then added to the tile once.
+	The sum is rebuilt from zero every REBUILD_UPDATES updates, so that the rounding of the
+	changes doesn't add up.
+	Much cheaper than the FFT ocean, at the cost of less realistic waves.
+*/
+
+struct PerlinNoiseOptions {
+	int resolution;			// samples per side of the tile, power of 2 in [64, 1024]
+	float tile_size;		// in world units, the size of the first octave
+	int octaves;			// clamped so that the last one still has 2 samples per cell
+	float amplitude;		// of the first octave
+	float persistence;		// amplitude ratio between two octaves
+	float speed;			// of the first octave, in noise cells per second
+	float speed_ratio;		// speed ratio between two octaves
+	unsigned seed;
+public:
+	PerlinNoiseOptions(int _resolution = 256, float _tile_size = 16.f, int _octaves = 5)
+		: resolution(_resolution), tile_size(_tile_size), octaves(_octaves), amplitude(0.5f),
+		persistence(0.5f), speed(0.6f), speed_ratio(1.3f), seed(1) {}
+};
+
+class PerlinNoise : public HeightField {
+public:
+	enum {
+		OCTAVE_CELLS = 8,
+		TEXELS_PER_CELL = 8,
+		OCTAVE_SIZE = OCTAVE_CELLS * TEXELS_PER_CELL,
+		TIME_STEPS = TEXELS_PER_CELL,	// per noise cell along the time axis
+		REBUILD_UPDATES = 256
+	};
+
+	explicit PerlinNoise(const PerlinNoiseOptions &options);
+
+	void setOptions(const PerlinNoiseOptions &options);
+	inline const PerlinNoiseOptions& getOptions() const {
+		return m_options;
+	}
+
+	virtual void update(float time);
+
+	// Octave steps generated by the last update
+	inline int getOctaveUpdates() const {
+		return m_octave_updates;
+	}
+
+protected:
+	void generateOctave(int octave, long long time_step, float *texels);
+	// Adds the octave's `texels' to the octave's period x period corner of m_changes,
+	//	cleared first if `first'
+	void addOctave(int octave, const float *texels, bool first);
+	// Repeats the period x period corner of m_changes up to `to' x `to'
+	void tileChanges(int period, int to);
+
+	PerlinNoiseOptions m_options;
+	float m_time;
+	int m_octave_updates;
+	int m_updates_to_rebuild;
+	unsigned char m_permutation[512];
+	std::vector<float> m_octave_texels;		// 2 OCTAVE_SIZE^2 per octave, its steps around its time
+	std::vector<long long> m_octave_steps;	// the first of the two steps of each octave
+	std::vector<double> m_octave_times;		// of each octave in the tile, in steps
+	std::vector<float> m_octave_blended;	// OCTAVE_SIZE^2 per octave, as in the tile
+	std::vector<float> m_octave_delta;		// OCTAVE_SIZE^2, change of the octave being added
+	std::vector<float> m_changes;			// resolution^2, change of the tile
+};
+
+#endif	/* __PERLINNOISE_H__ */
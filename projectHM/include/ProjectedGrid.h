@@ -2,8 +2,14 @@
 #define __PROJECTEDGRID_H__
 
 #include "Shape.h"
+#include "GridKernels.h"
+#include "GridTopology.h"
+#include "AdaptiveResolution.h"
+#include "GridStats.h"
 
 class Camera;
+class WorkerPool;
+class HeightField;
 
 /*
 	The steps of the algorithm:
@@ -48,39 +54,303 @@ class Camera;
 		in world space.
 */
 
+// One of several views of the same water, see ProjectedGrid::getRangeMatrices
+struct ProjectedGridView {
+	const Camera *camera;
+	glm::mat4 range_matrix;		// set by getRangeMatrices when visible
+	bool visible;				// set by getRangeMatrices
+	int first_vertex;			// set by generateGeometry, -1 when not visible
+public:
+	ProjectedGridView(const Camera *_camera = NULL) : camera(_camera), visible(false), first_vertex(-1) {}
+};
+
 struct ProjectedGridOptions {
-	int sides;
+	int sides;			// Columns of the grid, the maximum when adaptive
+	int rows;			// Rows of the grid, 0 for as many as columns
 	float strength;		// Scale of displacement
 	float elevation;	// Maximum height
 	bool smooth;
+	GridKernelType kernel;	// Row kernel used to generate the vertices
+	int threads;			// Threads generating the rows, 1 for serial, 0 for all hardware threads
+	GridTopologyType topology;	// How the vertices are connected
+	bool adaptive;		// Steer the resolution toward budget_ms, see AdaptiveResolution
+	float budget_ms;	// CPU time for generating and displacing the vertices of a frame
+	int min_sides;		// Lowest columns and rows when adaptive
+	bool warp_rows;		// Space the rows evenly on the screen rather than in projector space
+	bool cull_rows;		// Only generate the columns of each row inside the rendering camera's frustum
+	float cull_margin;	// World units kept around the frustum besides the displacement
+	bool stats;			// Record a GridStats frame per getRangeMatrix, see ProjectedGrid::getStats
+	bool temporal;		// Keep the vertices of the last frames while the projector barely moves, displaced again each frame
+	float reuse_pixels;		// Motion of the grid's boundary on the screen under which the vertices are reused whole
+	float refresh_pixels;	// Under which only refresh_rows rows of them are regenerated per frame
+	int refresh_rows;
 public:
 	ProjectedGridOptions(int _sides = 256, float _strength = 0.1f, float _elevation = 0.1f, bool _smooth = false)
-		: sides(_sides), strength(_strength), elevation(_elevation), smooth(_smooth) {}
+		: sides(_sides), rows(0), strength(_strength), elevation(_elevation), smooth(_smooth), kernel(GRID_KERNEL_AUTO), threads(1), topology(GRID_TOPOLOGY_STRIPS),
+		adaptive(false), budget_ms(4.f), min_sides(32), warp_rows(false),
+		cull_rows(false), cull_margin(0.f), stats(false),
+		temporal(false), reuse_pixels(0.25f), refresh_pixels(2.f), refresh_rows(16) {}
 };
 
 class ProjectedGrid {
 	ProjectedGridOptions m_options;
 
 	glm::mat4 m_range_matrix;
-	Camera *m_projecting_camera;
+	Camera *m_projecting_camera;	// created once, re-aimed every frame
+	// What the last range matrix was built from, to skip the work when nothing changed
+	struct RangeInputs {
+		glm::mat4 view_proj;
+		float upper_height, lower_height, projector_height_inc;
+		float strength, elevation;
+	} m_range_inputs;
+	bool m_range_dirty;		// the inputs must be compared again, e.g. the options changed
+	bool m_range_visible;	// result of the last getRangeMatrix
+	int m_range_intersections;	// points bounding V_visible found by the last getRangeMatrix
 	const Camera *m_rendering_camera;
 	Plane m_base_plane, m_upper_bound_plane, m_lower_bound_plane;
+	GridPlaneType m_plane_type;		// of the base plane, which picks the row kernels
+	float m_upper_height, m_lower_height;	// of the bound planes above the base plane
 
+	// Room for the largest resolution, only allocated once generated into: a grid writing into
+	//	the caller's memory (e.g. packed) doesn't hold a float copy
 	std::vector<glm::vec3> m_vertices;
-	glm::vec4 t_corners0, t_corners1, t_corners2, t_corners3;
+	int m_vertex_capacity;
+	int m_columns, m_rows;				// current resolution
+	AdaptiveResolution m_resolution;
+	GridTopology m_topology;
+	GridRowKernel m_row_kernel;
+	GridVertexSink m_sink;		// where the rows being generated go
+	WorkerPool *m_worker_pool;
+	const HeightField *m_height_field;
+	// Corners of each view being generated (4 per view) and where its vertices go
+	std::vector<glm::vec4> m_view_corners;
+	std::vector<int> m_view_firsts;
+	// v of each row and its distance to the previous one on the screen, m_rows per view
+	std::vector<float> m_row_v, m_row_spacing;
+	// Columns [begin, end) generated in each row, m_rows per view
+	std::vector<int> m_row_spans;
+	int m_generated_vertices;
+	// NULL unless the stats option is set, nothing is measured then
+	GridStats *m_stats;
+	std::vector<float> m_row_displace_ms;	// time displacing each row, m_rows per view
+	std::vector<float> m_edge_lengths;
+	// Temporal reuse of the single view's vertices: the corners of the oldest rows, which the
+	//	boundary is measured from, and the row parameters of the current frame
+	glm::vec4 m_temporal_corners[4];
+	GridVertexSink m_temporal_sink;	// of the last generation
+	bool m_temporal_valid;		// the last generation's sink holds rows of the current resolution and options
+	int m_refresh_row;			// next row of the rolling refresh
+	int m_refresh_cycle;		// rows refreshed since m_temporal_matrix
+	int m_refreshed_first, m_refreshed_rows;	// by the last generation
+	std::vector<float> m_fresh_row_v, m_fresh_row_spacing;
+	std::vector<int> m_fresh_row_spans;
+	// Displaced on the CPU, the rows are kept undisplaced here and displaced again every frame
+	std::vector<glm::vec3> m_temporal_base;
+	bool m_temporal_displaced;	// m_temporal_valid is of m_temporal_base rather than of the sink
+	bool m_filling_base;		// the rows being generated go to m_temporal_base, undisplaced
+	int m_regenerated_rows;		// by the last generation
+
+	// Switch to the resolution picked by m_resolution, if any
+	void applyResolution();
+	// Start a frame of m_stats with the range matrix search, if any
+	void endRange(double start_ms, bool cached, bool visible, int intersections);
+	// Time of a generation of `view_num' views, for m_resolution, and the rest of the frame
+	//	of m_stats
+	void endGeneration(double start_ms, int view_num, const Camera *first_camera);
+	// The screen counters of the frame being recorded for a view with the given corners, row v
+	//	and spans seen by `camera', from a lattice of at most 64 x 64 of its vertices
+	void measureView(const glm::vec4 *corners, const float *row_v, const int *row_spans, const Camera &camera);
+	// Put the bound planes around the displaced surface (step 2b): the height field's range
+	//	scaled by the strength, or the water heights given when there's no field
+	void updateBoundPlanes(float water_max_height, float water_min_height);
+	// Aim m_projecting_camera for the rendering camera `camera' (step 3)
+	void aimProjector(const Camera &camera);
+	// Range matrices of up to 4 cameras, one per SIMD lane. range_matrices[i] is only
+	//	written when visible[i] is true. intersections, if not NULL, gets the points found.
+	void getRangeMatrices4(const Camera *const *cameras, int count, glm::mat4 *range_matrices, bool *visible, int *intersections);
+	// v of the rows of a view with the given corners seen through `view_proj', and their
+	//	spacing in pixels on a width x height screen
+	void parameterizeRows(const glm::vec4 *corners, const glm::mat4 &view_proj, float width, float height, float *row_v, float *row_spacing) const;
+	// The columns of each row to generate: those whose quads may show through `view_proj'
+	//	once displaced, or all of them. Returns the vertex count.
+	int cullRows(const glm::vec4 *corners, const float *row_v, const glm::mat4 &view_proj, int *row_spans) const;
+	// Fill the spans of the rows [row_begin, row_end) of the grid with the given corners and
+	//	row v into m_sink, the grid starting at the vertex `first_vertex'. The time displacing
+	//	each row goes to row_displace_ms unless NULL.
+	void generateRows(const glm::vec4 *corners, const float *row_v, const int *row_spans, int first_vertex, int row_begin, int row_end,
+		float *row_displace_ms);
+	// All the rows of the first `view_num' views of m_view_corners in one parallel loop
+	void generateViews(int view_num);
+	// Rows of the single view the next generation computes again from the range matrix, the
+	//	others being kept if rows_kept
+	int getRegenerateRowCount(bool rows_kept) const;
+	// Write `refresh_num' rows of the single view into m_sink: all of them, or the next ones
+	//	of the rolling refresh with the others left as they are
+	void generateRefreshedRows(int refresh_num);
+	// Displace all the spans of m_temporal_base into m_sink
+	void displaceKeptRows();
+	static void displaceKeptRowsTask(void *grid, int row_begin, int row_end);
+	// The same with the normals and the texcoords of m_sink in one pass: the grid is walked
+	//	in strips of columns down the rows, each strip generated and displaced into a window of
+	//	three rows on the stack, and a row is written once its next one is there for the
+	//	normals. The rows around the band are generated too but only read.
+	void generateFusedRows(const glm::vec4 *corners, const float *row_v, const int *row_spans, int first_vertex, int row_begin, int row_end,
+		float *row_displace_ms);
+	// Move the `count' vertices of `sink' from `first' by the height field (step 7), unless
+	//	m_sink has no y or is m_temporal_base. They are read from `source' at the same index
+	//	rather than from the sink if not NULL.
+	void displaceVertices(const GridVertexSink &sink, int first, int count, const glm::vec3 *source = NULL) const;
+	static void generateRowsTask(void *grid, int row_begin, int row_end);
 public:
 	ProjectedGrid(const Plane &base_plane, const Camera *camera, const ProjectedGridOptions &options);
 	~ProjectedGrid();
 
 	void setOptions(const ProjectedGridOptions &options);
+	inline const ProjectedGridOptions& getOptions() const {
+		return m_options;
+	}
 
+	// The field displacing the vertices, scaled by the strength option, NULL for a flat grid.
+	//	Sinks without y are left flat: the displacement is then up to the vertex shader.
+	inline void setHeightField(const HeightField *height_field) {
+		m_height_field = height_field;
+	}
+	inline const HeightField* getHeightField() const {
+		return m_height_field;
+	}
+	// The camera the grid is projected for, e.g. a copy owned by the thread generating the grid
+	inline void setRenderingCamera(const Camera *camera) {
+		m_rendering_camera = camera;
+		m_range_dirty = true;
+	}
+	inline const Camera* getRenderingCamera() const {
+		return m_rendering_camera;
+	}
+
+	// Returns false when the water isn't visible. The range matrix is only rebuilt when the
+	//	rendering camera's view-projection, the bound planes or the options changed.
+	//	The water heights only bound the surface when there is no height field.
+	//	In adaptive mode, a new resolution takes effect here, so that the vertex count and the
+	//	topology stay the same until the grid is drawn.
 	bool getRangeMatrix(float water_max_height, float water_min_height, float projector_height_inc);
+	// The range matrix of the last visible getRangeMatrix
+	inline const glm::mat4& getLastRangeMatrix() const {
+		return m_range_matrix;
+	}
+
+	// The same for several views at once (e.g. main view, reflection, split screen), 4 cameras
+	//	per SIMD batch. The grid's own camera and range matrix are left untouched, nothing is
+	//	cached. Returns the number of visible views.
+	int getRangeMatrices(ProjectedGridView *views, int count, float water_max_height, float water_min_height, float projector_height_inc);
 
 	glm::vec3 getCorner(float u, float v);
 
 	glm::vec4 getCorner4(float u, float v);
 
-	void renderGeometry();
+	// Build the vertices of the grid from the current range matrix, no GL involved
+	void generateGeometry();
+	// Same, but into memory owned by the caller (e.g. a mapped buffer object), which must
+	//	hold getVertexCount() vertices. The internal vertices are left untouched.
+	//	In adaptive mode the generation time steers the resolution of the next frames.
+	//	sink_kept tells that the sink still holds what the last generation wrote: in temporal
+	//	mode only getRefreshRowCount(true) rows are written then. A grid displaced on the CPU
+	//	keeps its undisplaced rows itself, whatever the sink.
+	void generateGeometry(const GridVertexSink &sink, bool sink_kept = false);
+	// Rows the next generation will write after the last getRangeMatrix. Unless all of them,
+	//	the others are left as they were: in temporal mode, when the grid's boundary moved less
+	//	than refresh_pixels on the screen since the oldest rows, nothing is displaced on the
+	//	CPU and the sink is kept. 0 when the vertices are reused as they are, e.g. not uploaded
+	//	again. A grid displaced on the CPU writes all its rows, see getRegeneratedRowCount.
+	int getRefreshRowCount(bool sink_kept) const;
+	// The vertices of all the visible views into one arena, which must hold count *
+	//	getVertexCapacity() vertices. The views are packed one after the other (see first_vertex)
+	//	and all their rows are spread over the workers together. Returns the vertices the views
+	//	take in the arena.
+	int generateGeometry(ProjectedGridView *views, int count, const GridVertexSink &arena);
+
+	// Normalized
+	inline const Plane& getBasePlane() const {
+		return m_base_plane;
+	}
+	// Horizontal or not, from the base plane
+	inline GridPlaneType getPlaneType() const {
+		return m_plane_type;
+	}
+	inline int getVertexCount() const {
+		return m_columns * m_rows;
+	}
+	// The most vertices the grid can have with the current options
+	inline int getVertexCapacity() const {
+		return m_vertex_capacity;
+	}
+	inline int getColumns() const {
+		return m_columns;
+	}
+	inline int getRows() const {
+		return m_rows;
+	}
+	inline const AdaptiveResolution& getAdaptiveResolution() const {
+		return m_resolution;
+	}
+	// Screen distance in pixels between each row of the last generated grid and the previous
+	//	one (the first row gets the second's), along the middle column. With several views,
+	//	`view' is the index among the visible ones.
+	inline const float* getRowSpacing(int view = 0) const {
+		return &m_row_spacing[view * m_rows];
+	}
+	// Columns [begin, end) of the row `iv' written by the last generation, all of them unless
+	//	cull_rows. The vertices out of the spans are left as they were.
+	inline void getRowSpan(int iv, int &begin, int &end, int view = 0) const {
+		begin = m_row_spans[(view * m_rows + iv) * 2];
+		end = m_row_spans[(view * m_rows + iv) * 2 + 1];
+	}
+	// Vertices written by the last generation, all views together
+	inline int getGeneratedVertexCount() const {
+		return m_generated_vertices;
+	}
+	// Rows written by the last generation, from `first' on and wrapping around the grid, all
+	//	of them unless temporal
+	inline int getRefreshedRowCount() const {
+		return m_refreshed_rows;
+	}
+	inline int getFirstRefreshedRow() const {
+		return m_refreshed_first;
+	}
+	// Rows the last generation computed from the range matrix, the others being reused (and
+	//	displaced again when displaced on the CPU), all of them unless temporal
+	inline int getRegeneratedRowCount() const {
+		return m_regenerated_rows;
+	}
+	// Most ranges getDrawRanges may return
+	inline int getMaxDrawRanges() const {
+		if (m_topology.getType() == GRID_TOPOLOGY_POINTS) {
+			return m_rows;
+		}
+		return std::max(m_topology.getStripeCount() * (m_rows - 1), 0);
+	}
+	// The index ranges of the topology covering the quads between the spans of the last
+	//	generation, in the topology's order, e.g. for glMultiDrawElements (no range holds the
+	//	restart index). With points, the vertex ranges of the spans themselves.
+	//	firsts and counts need room for getMaxDrawRanges(). Returns the count.
+	int getDrawRanges(int *firsts, int *counts, int view = 0) const;
+	// What the grid did over the last frames, NULL unless the stats option is set. A frame
+	//	starts with getRangeMatrix (or getRangeMatrices) and ends with the generation, or right
+	//	away when the water isn't visible. With several views the screen counters are those of
+	//	the first visible one and the intersections those of all of them.
+	inline const GridStats* getStats() const {
+		return m_stats;
+	}
+	inline GridStats* getStats() {
+		return m_stats;
+	}
+	// Index buffer of the grid, only rebuilt when the resolution or the topology changes
+	inline const GridTopology& getTopology() const {
+		return m_topology;
+	}
+	// The vertices of the last generateGeometry() without a sink, NULL before the first
+	inline const glm::vec3* getVertices() const {
+		return m_vertices.empty() ? NULL : &m_vertices[0];
+	}
 
 	// for debugging
 };
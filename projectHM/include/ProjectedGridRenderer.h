@@ -0,0 +1,103 @@
+#ifndef __PROJECTEDGRIDRENDERER_H__
+#define __PROJECTEDGRIDRENDERER_H__
+
+#include "gl/glew.h"
+
+#include "GridTopology.h"
+
+class ProjectedGrid;
+struct GridPipelineFrame;
+struct GridVertexSink;
+
+// How the vertices are stored in the vertex buffer
+enum GridVertexFormat {
+	GRID_FORMAT_FLOAT = 0,		// 3 floats, 12 bytes
+	GRID_FORMAT_HALF,			// 3 half floats around the camera, 6 bytes (GL 3.0 or ARB_half_float_vertex)
+	GRID_FORMAT_QUANTIZED		// x z in 16-bit quanta around the camera and a half float y, 6 bytes (GLSL)
+};
+
+/*
+	The OpenGL side of the projected grid.
+	The grid is generated straight into a mapped buffer object, so the vertices are written
+	once and never copied on the CPU. ProjectedGrid itself knows nothing about GL.
+	The index buffer is only uploaded again when the grid's topology is rebuilt.
+	When the grid culls its rows, only the spans it generated are flushed to the buffer and
+	only the index ranges between them are drawn. A temporal grid keeps the buffer between
+	frames: nothing is uploaded while it reuses its vertices, and only the refreshed rows
+	are written (without orphaning the buffer) during its rolling refresh.
+	A frame of a GridPipeline was generated on the worker thread, it is only copied into the
+	buffer and drawn with indices of the renderer's own.
+	The packed formats halve the buffer. Their origin follows the camera in steps of a
+	sixteenth of its far distance, and the quanta cover 1.25 times that distance, so the
+	vertices stay in range without regenerating a kept buffer every frame. Half floats are
+	drawn as they are with the origin in the modelview matrix, the quantized vertices through
+	data/shaders/projected_grid_quantized.vert. Without the GL support the floats are used.
+*/
+class ProjectedGridRenderer {
+public:
+	ProjectedGridRenderer();
+	~ProjectedGridRenderer();
+
+	// Generate the grid into the vertex buffer and draw it, needs a current GL context
+	void render(ProjectedGrid &grid);
+	// Upload and draw a frame of a GridPipeline, nothing when the water isn't in it
+	void render(const GridPipelineFrame &frame);
+	// Free the buffer objects while the GL context is still alive
+	void release();
+
+	// For the next frames, pipeline frames are always floats
+	inline void setVertexFormat(GridVertexFormat format) {
+		m_format = format;
+	}
+	inline GridVertexFormat getVertexFormat() const {
+		return m_format;
+	}
+	static const char* getVertexFormatName(GridVertexFormat format);
+	static inline int getVertexSize(GridVertexFormat format) {
+		return format == GRID_FORMAT_FLOAT ? 3 * (int)sizeof(float) : 3 * (int)sizeof(short);
+	}
+
+protected:
+	void uploadTopology(const GridTopology &topology);
+	// m_format if the GL can draw it, the floats otherwise
+	GridVertexFormat resolveFormat();
+	// Compile the quantized decoding program once, false if it can't be used
+	bool loadDecodeProgram();
+	// Move m_origin and m_quantum along with the grid's rendering camera, true if they changed
+	bool updatePacking(const ProjectedGrid &grid);
+	// A sink of `format' into `memory'
+	GridVertexSink getSink(void *memory, GridVertexFormat format) const;
+	// Draw `count' vertices of `format' from `pointer' (an offset when a vertex buffer is
+	//	bound) with the indices of `topology', only the first range_count ranges of the
+	//	m_range_ vectors unless range_count < 0
+	void drawGrid(const GLvoid *pointer, GridVertexFormat format, const GridTopology &topology, int count, int range_count);
+	// The generated part of the grid into the m_range_ vectors, returns the range count
+	int gatherDrawRanges(const ProjectedGrid &grid);
+	// Byte offsets into the index buffer of the first range_count ranges
+	void updateRangeOffsets(const GridTopology &topology, int range_count);
+
+	GridVertexFormat m_format;
+	GLuint m_vertex_buffer;
+	int m_buffer_vertices;		// capacity of m_vertex_buffer
+	GridVertexFormat m_buffer_format;
+	bool m_buffer_kept;			// m_vertex_buffer holds the last generation
+	GLuint m_index_buffer;
+	const GridTopology *m_uploaded_topology;
+	unsigned m_uploaded_revision;
+	GridTopology m_frame_topology;		// of the pipeline frames
+	// What the packed vertices are relative to
+	glm::vec3 m_origin;
+	float m_quantum;
+	GLuint m_decode_program;
+	GLint m_decode_origin, m_decode_quantum;	// uniform locations
+	bool m_decode_failed;		// don't try again
+	// Strips drawn one by one when primitive restart isn't supported
+	std::vector<GLsizei> m_strip_sizes;
+	std::vector<const GLvoid*> m_strip_offsets;
+	// Index ranges (or vertex ranges with points) of the rows a culling grid generated
+	std::vector<int> m_range_firsts;
+	std::vector<GLsizei> m_range_sizes;
+	std::vector<const GLvoid*> m_range_offsets;
+};
+
+#endif	/* __PROJECTEDGRIDRENDERER_H__ */
@@ -1,6 +1,19 @@
 #ifndef __TRANSFORM_H__
 #define __TRANSFORM_H__
 
+#include "GridKernels.h"
+
+/*
+	Points and vectors through 4x4 matrices (column-major, as glm).
+	The single point helpers are inlined. The batched ones take the points as SoA arrays (one
+	array per coordinate), broadcast the matrix once and transform 4 or 8 points per
+	instruction, with the same instruction sets as the grid's row kernels: GRID_KERNEL_SCALAR
+	is the reference the SIMD kernels match bit for bit, the products being summed in the same
+	order and the divide being a true one.
+	Any alignment is taken; arrays all aligned to the vector width are loaded and stored
+	aligned. The outputs may be the inputs, but no other overlap.
+*/
+
 inline glm::vec3 transformPoint(float *m_transform, const glm::vec3 &p) {
 	float x = (m_transform[0] * p.x + m_transform[4] * p.y
 		+ m_transform[8] * p.z + m_transform[12]);
@@ -16,7 +29,7 @@ inline glm::vec3 transformPoint(float *m_transform, const glm::vec3 &p) {
 		return glm::vec3(x, y, z) / w;
 }
 
-inline glm::vec3 transformPoint(const glm::mat4 m_transform, const glm::vec3 &p) {
+inline glm::vec3 transformPoint(const glm::mat4 &m_transform, const glm::vec3 &p) {
 	float x = m_transform[0][0] * p.x + m_transform[1][0] * p.y
 		+ m_transform[2][0] * p.z + m_transform[3][0];
 	float y = m_transform[0][1] * p.x + m_transform[1][1] * p.y
@@ -36,11 +49,11 @@ inline glm::vec3 transformPoint(const glm::mat4 m_transform, const glm::vec3 &p)
 		return glm::vec3(x, y, z) / w;
 }
 
-inline glm::vec4 transformPoint(const glm::mat4 m_transform, const glm::vec4 &p) {
+inline glm::vec4 transformPoint(const glm::mat4 &m_transform, const glm::vec4 &p) {
 	return m_transform * p;
 }
 
-inline glm::vec3 transformAffinePoint(const glm::mat4 m_transform, const glm::vec3 &p) {
+inline glm::vec3 transformAffinePoint(const glm::mat4 &m_transform, const glm::vec3 &p) {
 	float x = m_transform[0][0] * p.x + m_transform[1][0] * p.y
 		+ m_transform[2][0] * p.z + m_transform[3][0];
 	float y = m_transform[0][1] * p.x + m_transform[1][1] * p.y
@@ -50,7 +63,7 @@ inline glm::vec3 transformAffinePoint(const glm::mat4 m_transform, const glm::ve
 	return glm::vec3(x, y, z);
 }
 
-inline glm::vec3 transformVector(const glm::mat4 m_transform, const glm::vec3 &v) {
+inline glm::vec3 transformVector(const glm::mat4 &m_transform, const glm::vec3 &v) {
 	float x = m_transform[0][0] * v.x + m_transform[1][0] * v.y
 		+ m_transform[2][0] * v.z;
 	float y = m_transform[0][1] * v.x + m_transform[1][1] * v.y
@@ -61,4 +74,17 @@ inline glm::vec3 transformVector(const glm::mat4 m_transform, const glm::vec3 &v
 }
 
 
-#endif
\ No newline at end of file
+// -------------------------
+// Batched transforms
+// -------------------------
+// With the perspective divide
+void transformPoints(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel = GRID_KERNEL_AUTO);
+// The last row taken as (0, 0, 0, 1), no divide
+void transformAffinePoints(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel = GRID_KERNEL_AUTO);
+// Without the translation
+void transformVectors(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel = GRID_KERNEL_AUTO);
+
+#endif	/* __TRANSFORM_H__ */
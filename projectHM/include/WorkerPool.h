@@ -0,0 +1,56 @@
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+/*
+	A fixed set of worker threads running data-parallel loops.
+	parallelFor splits [0, count) into bands, the calling thread takes bands as well and
+	only returns once all of them are done. Which thread runs a band is not deterministic,
+	so the task must only write to the outputs of its own band.
+	parallelFor is not reentrant: a pool serves one caller at a time.
+*/
+class WorkerPool {
+public:
+	typedef void (*TaskFunc)(void *context, int begin, int end);
+
+	// thread_count includes the calling thread, 0 means one per hardware thread
+	explicit WorkerPool(int thread_count);
+	~WorkerPool();
+
+	inline int getThreadCount() const {
+		return (int)m_workers.size() + 1;
+	}
+
+	// Bands hold at least `grain' items
+	void parallelFor(int count, int grain, TaskFunc func, void *context);
+
+	static int getHardwareThreadCount();
+
+protected:
+	void workerLoop();
+	void runBands();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake_cond;
+	std::condition_variable m_done_cond;
+	unsigned m_generation;
+	int m_busy;
+	bool m_quit;
+	// The current job
+	TaskFunc m_func;
+	void *m_context;
+	int m_count, m_band_size, m_band_num;
+	std::atomic<int> m_next_band;
+
+private:
+	WorkerPool(const WorkerPool &);
+	WorkerPool& operator = (const WorkerPool &);
+};
+
+#endif	/* __WORKERPOOL_H__ */
@@ -0,0 +1,73 @@
+#include "projectHM_PCH.h"
+
+#include "AdaptiveResolution.h"
+
+const float AdaptiveResolution::TOLERANCE = 0.1f;
+const float AdaptiveResolution::SMOOTHING = 0.2f;
+const float AdaptiveResolution::MAX_STEP = 1.25f;
+
+AdaptiveResolution::AdaptiveResolution()
+	: m_min_columns(2), m_max_columns(2), m_min_rows(2), m_max_rows(2), m_columns(2), m_rows(2),
+	m_budget_ms(0.f), m_smoothed_ms(-1.f), m_drift_frames(0) {
+}
+
+void AdaptiveResolution::reset(int min_columns, int max_columns, int min_rows, int max_rows, float budget_ms) {
+	m_min_columns = min_columns;
+	m_max_columns = max_columns;
+	m_min_rows = min_rows;
+	m_max_rows = max_rows;
+	m_columns = max_columns;
+	m_rows = max_rows;
+	m_budget_ms = budget_ms;
+	m_smoothed_ms = -1.f;
+	m_drift_frames = 0;
+}
+
+int AdaptiveResolution::scaleAxis(int sides, float scale, int min_sides, int max_sides) {
+	int scaled = (int)floor(sides * scale + 0.5f);
+	scaled = std::min(std::max(scaled, min_sides), max_sides);
+	const int threshold = std::max(sides / GRANULARITY, 1);
+	// At a limit the axis moves whatever the step, or it would never reach it
+	if (abs(scaled - sides) < threshold && scaled != min_sides && scaled != max_sides) {
+		return sides;
+	}
+	return scaled;
+}
+
+bool AdaptiveResolution::update(float frame_ms) {
+	if (m_smoothed_ms < 0.f) {
+		m_smoothed_ms = frame_ms;
+	} else {
+		m_smoothed_ms += SMOOTHING * (frame_ms - m_smoothed_ms);
+	}
+	int drift = 0;
+	if (m_smoothed_ms > m_budget_ms * (1.f + TOLERANCE)) {
+		drift = 1;
+	} else if (m_smoothed_ms < m_budget_ms * (1.f - TOLERANCE)) {
+		drift = -1;
+	}
+	if (drift == 0 || drift * m_drift_frames < 0) {
+		m_drift_frames = drift;
+		return false;
+	}
+	m_drift_frames += drift;
+	if (abs(m_drift_frames) < SETTLE_FRAMES) {
+		return false;
+	}
+
+	float scale = m_budget_ms / std::max(m_smoothed_ms, 1e-3f);
+	scale = std::min(std::max(scale, 1.f / MAX_STEP), MAX_STEP);
+	const int columns = scaleAxis(m_columns, sqrt(scale), m_min_columns, m_max_columns);
+	// Whatever the columns didn't take goes to the rows
+	const float row_scale = scale * (float)m_columns / (float)columns;
+	const int rows = scaleAxis(m_rows, row_scale, m_min_rows, m_max_rows);
+	if (columns == m_columns && rows == m_rows) {
+		return false;
+	}
+	// The time is about proportional to the vertex count
+	m_smoothed_ms *= (float)(columns * rows) / (float)(m_columns * m_rows);
+	m_columns = columns;
+	m_rows = rows;
+	m_drift_frames = 0;
+	return true;
+}
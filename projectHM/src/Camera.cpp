@@ -2,7 +2,7 @@
 
 #include "Camera.h"
 
-void Camera::updateViewMatrix() {
+void Camera::updateDirections() const {
 	// The target direction
 	m_direction_tar = glm::vec3(
 		cos(m_rotation.y) * sin(m_rotation.x),
@@ -16,25 +16,84 @@ void Camera::updateViewMatrix() {
 		cos(m_rotation.x - PI * 0.5f)
 		);
 	m_direction_upv = glm::cross(m_direction_right, m_direction_tar);
+	m_dirty &= ~DIRTY_DIRECTIONS;
+}
+
+void Camera::updateViewMatrix() const {
+	validateRotation();
 	m_worldToCamera = glm::lookAt(m_position, m_position + m_direction_tar, m_direction_upv);
-	m_cameraToWorld = glm::inverse(m_worldToCamera);
+	// The view is a rotation then a translation: its inverse is the transposed rotation with
+	//	the camera's position
+	const glm::mat4 &m = m_worldToCamera;
+	m_cameraToWorld = glm::mat4(
+		m[0][0], m[1][0], m[2][0], 0.f,
+		m[0][1], m[1][1], m[2][1], 0.f,
+		m[0][2], m[1][2], m[2][2], 0.f,
+		m_position.x, m_position.y, m_position.z, 1.f);
+	m_dirty &= ~DIRTY_VIEW;
 }
 
-void Camera::updateProjectionMatrix() {
+void Camera::updateProjectionMatrix() const {
 	m_cameraToScreen = glm::perspective(m_fov, (float)m_width / (float)m_height, m_zNear, m_zFar);
-	m_screenToCamera = glm::inverse(m_cameraToScreen);
+	// Only the diagonal, [2][3] = -1 and [3][2] are set: x and y are scaled, w = -z and
+	//	z' = [2][2] * z + [3][2] * w, hence z = -w' and w = (z' + [2][2] * w') / [3][2]
+	const glm::mat4 &m = m_cameraToScreen;
+	m_screenToCamera = glm::mat4(0.f);
+	m_screenToCamera[0][0] = 1.f / m[0][0];
+	m_screenToCamera[1][1] = 1.f / m[1][1];
+	m_screenToCamera[2][3] = 1.f / m[3][2];
+	m_screenToCamera[3][2] = -1.f;
+	m_screenToCamera[3][3] = m[2][2] / m[3][2];
+	m_dirty &= ~DIRTY_PROJECTION;
+}
+
+void Camera::update() const {
+	validateView();
+	validateProjection();
+	if (m_dirty & DIRTY_VIEW_PROJECTION) {
+		// The products of the sparse projection with the view, column by column
+		const glm::mat4 &p = m_cameraToScreen, &p_inv = m_screenToCamera;
+		for (int c = 0; c < 4; ++c) {
+			const glm::vec4 &v = m_worldToCamera[c];
+			m_worldToScreen[c] = glm::vec4(p[0][0] * v.x, p[1][1] * v.y, p[2][2] * v.z + p[3][2] * v.w, -v.z);
+		}
+		const glm::mat4 &v_inv = m_cameraToWorld;
+		m_screenToWorld[0] = v_inv[0] * p_inv[0][0];
+		m_screenToWorld[1] = v_inv[1] * p_inv[1][1];
+		m_screenToWorld[2] = v_inv[3] * p_inv[2][3];
+		m_screenToWorld[3] = v_inv[3] * p_inv[3][3] - v_inv[2];
+		m_dirty &= ~DIRTY_VIEW_PROJECTION;
+	}
 }
 
-const glm::mat4& Camera::getProjectionMatrix() {
+const glm::mat4& Camera::getProjectionMatrix() const {
+	validateProjection();
 	return m_cameraToScreen;
 }
 
-const glm::mat4& Camera::getViewMatrix() {
+const glm::mat4& Camera::getViewMatrix() const {
+	validateView();
 	return m_worldToCamera;
 }
 
-const glm::mat4 Camera::getViewProjectionMatrix() const {
-	return m_cameraToScreen * m_worldToCamera;
+const glm::mat4& Camera::getViewProjectionMatrix() const {
+	validateViewProjection();
+	return m_worldToScreen;
+}
+
+const glm::mat4& Camera::getInverseProjectionMatrix() const {
+	validateProjection();
+	return m_screenToCamera;
+}
+
+const glm::mat4& Camera::getInverseViewMatrix() const {
+	validateView();
+	return m_cameraToWorld;
+}
+
+const glm::mat4& Camera::getInverseViewProjectionMatrix() const {
+	validateViewProjection();
+	return m_screenToWorld;
 }
 
 float* Camera::getPositionPtr() {
@@ -42,17 +101,35 @@ float* Camera::getPositionPtr() {
 }
 
 float* Camera::getViewMatrixInvPtr() {
+	validateView();
 	return glm::value_ptr(m_cameraToWorld);
 }
 
+void Camera::writeParas(FILE *writter) const {
+	fprintf(writter, "%f %f %f\n", m_position.x, m_position.y, m_position.z);
+	fprintf(writter, "%f %f\n", m_rotation.x, m_rotation.y);
+}
+
+bool Camera::readParas(FILE *reader) {
+	glm::vec3 position;
+	glm::vec2 rotation;
+	if (fscanf(reader, "%f %f %f", &position.x, &position.y, &position.z) != 3
+		|| fscanf(reader, "%f %f\n", &rotation.x, &rotation.y) != 2) {
+		return false;
+	}
+	m_position = position;
+	m_rotation = rotation;
+	invalidateRotation();
+	return true;
+}
+
 void Camera::saveParasToFile(const char *filename) const {
 	FILE *writter = fopen(filename, "w");
 	if (writter == NULL) {
 		fprintf(stderr, "Cannot save camera's settings into file '%s'\n", filename);
 		return;
 	}
-	fprintf(writter, "%f %f %f\n", m_position.x, m_position.y, m_position.z);
-	fprintf(writter, "%f %f\n", m_rotation.x, m_rotation.y);
+	writeParas(writter);
 	fclose(writter);
 	printf("Successfully saved camera's settings into file '%s'\n", filename);
 }
@@ -63,9 +140,11 @@ void Camera::loadParasFromFile(const char *filename) {
 		fprintf(stderr, "Cannot read camera's settings from file '%s'\n", filename);
 		return;
 	}
-	fscanf(reader, "%f %f %f", &m_position.x, &m_position.y, &m_position.z);
-	fscanf(reader, "%f %f\n", &m_rotation.x, &m_rotation.y);
+	bool succeed = readParas(reader);
 	fclose(reader);
-	updateViewMatrix();
+	if (!succeed) {
+		fprintf(stderr, "Invalid camera's settings in file '%s'\n", filename);
+		return;
+	}
 	printf("Successfully loaded camera's settings from file '%s'\n", filename);
-}
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "projectHM_PCH.h"
+
+#include "FFT.h"
+
+#include "WorkerPool.h"
+
+#include <emmintrin.h>
+
+namespace {
+	struct FFTJob {
+		const FFT2D *fft;
+		float *re, *im;
+	};
+
+	// (a, b) <- (a + w * b, a - w * b) for 4 complex numbers
+	inline void butterfly4(float *a_re, float *a_im, float *b_re, float *b_im, __m128 w_re, __m128 w_im) {
+		const __m128 ar = _mm_loadu_ps(a_re), ai = _mm_loadu_ps(a_im);
+		const __m128 br = _mm_loadu_ps(b_re), bi = _mm_loadu_ps(b_im);
+		const __m128 tr = _mm_sub_ps(_mm_mul_ps(w_re, br), _mm_mul_ps(w_im, bi));
+		const __m128 ti = _mm_add_ps(_mm_mul_ps(w_re, bi), _mm_mul_ps(w_im, br));
+		_mm_storeu_ps(a_re, _mm_add_ps(ar, tr));
+		_mm_storeu_ps(a_im, _mm_add_ps(ai, ti));
+		_mm_storeu_ps(b_re, _mm_sub_ps(ar, tr));
+		_mm_storeu_ps(b_im, _mm_sub_ps(ai, ti));
+	}
+
+	inline void butterfly(float &a_re, float &a_im, float &b_re, float &b_im, float w_re, float w_im) {
+		const float tr = w_re * b_re - w_im * b_im;
+		const float ti = w_re * b_im + w_im * b_re;
+		b_re = a_re - tr, b_im = a_im - ti;
+		a_re += tr, a_im += ti;
+	}
+}
+
+FFT2D::FFT2D(int n) : m_n(n), m_bit_reverse(n), m_twiddle_re(n), m_twiddle_im(n) {
+	assert(n >= 4 && (n & (n - 1)) == 0);
+	int bits = 0;
+	while ((1 << bits) < n) {
+		++bits;
+	}
+	for (int i = 0; i < n; ++i) {
+		int r = 0;
+		for (int b = 0; b < bits; ++b) {
+			r |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		m_bit_reverse[i] = r;
+	}
+	for (int h = 1; h < n; h <<= 1) {
+		for (int j = 0; j < h; ++j) {
+			// In double, the twiddles of the last stages are the ones that need it
+			double angle = acos(-1.0) * j / h;
+			m_twiddle_re[h + j] = (float)cos(angle);
+			m_twiddle_im[h + j] = (float)sin(angle);
+		}
+	}
+}
+
+void FFT2D::inverse(float *re, float *im, WorkerPool *pool) const {
+	FFTJob job = {this, re, im};
+	if (pool) {
+		pool->parallelFor(m_n, 8, transformRowsTask, &job);
+		pool->parallelFor(m_n / 4, 4, transformColumnsTask, &job);
+	} else {
+		transformRows(re, im, 0, m_n);
+		transformColumns(re, im, 0, m_n);
+	}
+}
+
+void FFT2D::transformRowsTask(void *context, int begin, int end) {
+	FFTJob *job = static_cast<FFTJob*>(context);
+	job->fft->transformRows(job->re, job->im, begin, end);
+}
+
+void FFT2D::transformColumnsTask(void *context, int begin, int end) {
+	// Scheduled by groups of 4 columns
+	FFTJob *job = static_cast<FFTJob*>(context);
+	job->fft->transformColumns(job->re, job->im, begin * 4, end * 4);
+}
+
+void FFT2D::transformRows(float *re, float *im, int row_begin, int row_end) const {
+	const int n = m_n;
+	for (int row = row_begin; row < row_end; ++row) {
+		float *r = re + row * n;
+		float *i = im + row * n;
+		for (int k = 0; k < n; ++k) {
+			int rk = m_bit_reverse[k];
+			if (k < rk) {
+				std::swap(r[k], r[rk]);
+				std::swap(i[k], i[rk]);
+			}
+		}
+		// The first two stages have less than 4 butterflies per group
+		for (int k = 0; k < n; k += 2) {
+			butterfly(r[k], i[k], r[k + 1], i[k + 1], 1.f, 0.f);
+		}
+		for (int k = 0; k < n; k += 4) {
+			butterfly(r[k], i[k], r[k + 2], i[k + 2], 1.f, 0.f);
+			butterfly(r[k + 1], i[k + 1], r[k + 3], i[k + 3], m_twiddle_re[3], m_twiddle_im[3]);
+		}
+		for (int h = 4; h < n; h <<= 1) {
+			for (int k = 0; k < n; k += 2 * h) {
+				for (int j = 0; j < h; j += 4) {
+					butterfly4(r + k + j, i + k + j, r + k + j + h, i + k + j + h,
+						_mm_loadu_ps(&m_twiddle_re[h + j]), _mm_loadu_ps(&m_twiddle_im[h + j]));
+				}
+			}
+		}
+	}
+}
+
+void FFT2D::transformColumns(float *re, float *im, int column_begin, int column_end) const {
+	// Every butterfly of a stage works on two whole rows, with the same twiddle for all
+	//	the columns: the columns [column_begin, column_end) are transformed side by side
+	const int n = m_n;
+	for (int k = 0; k < n; ++k) {
+		int rk = m_bit_reverse[k];
+		if (k < rk) {
+			std::swap_ranges(re + k * n + column_begin, re + k * n + column_end, re + rk * n + column_begin);
+			std::swap_ranges(im + k * n + column_begin, im + k * n + column_end, im + rk * n + column_begin);
+		}
+	}
+	for (int h = 1; h < n; h <<= 1) {
+		for (int k = 0; k < n; k += 2 * h) {
+			for (int j = 0; j < h; ++j) {
+				const __m128 w_re = _mm_set1_ps(m_twiddle_re[h + j]);
+				const __m128 w_im = _mm_set1_ps(m_twiddle_im[h + j]);
+				const int a = (k + j) * n, b = (k + j + h) * n;
+				for (int c = column_begin; c < column_end; c += 4) {
+					butterfly4(re + a + c, im + a + c, re + b + c, im + b + c, w_re, w_im);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,380 @@
+#include "projectHM_PCH.h"
+
+#include "GridKernels.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GRID_FORCEINLINE __forceinline
+#define GRID_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define GRID_FORCEINLINE inline __attribute__((always_inline))
+#define GRID_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#endif
+
+// -------------------------
+// CPU features
+// -------------------------
+static void queryCPUID(int info[4], int leaf, int subleaf) {
+#if defined(_MSC_VER)
+	__cpuidex(info, leaf, subleaf);
+#else
+	unsigned a, b, c, d;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	info[0] = (int)a, info[1] = (int)b, info[2] = (int)c, info[3] = (int)d;
+#endif
+}
+
+static unsigned long long queryXCR0() {
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	unsigned eax, edx;
+	__asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+static GridKernelType detectGridKernelOnce() {
+	int info[4];
+	queryCPUID(info, 0, 0);
+	const int max_leaf = info[0];
+	queryCPUID(info, 1, 0);
+	const bool sse2 = (info[3] & (1 << 26)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	const bool f16c = (info[2] & (1 << 29)) != 0;
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	// The OS must also save the YMM registers on context switches
+	if (max_leaf >= 7 && fma && f16c && osxsave && avx && (queryXCR0() & 6) == 6) {
+		queryCPUID(info, 7, 0);
+		if (info[1] & (1 << 5)) {
+			return GRID_KERNEL_AVX2;
+		}
+	}
+	return sse2 ? GRID_KERNEL_SSE2 : GRID_KERNEL_SCALAR;
+}
+
+GridKernelType detectGridKernel() {
+	static const GridKernelType detected = detectGridKernelOnce();
+	return detected;
+}
+
+GridKernelType resolveGridKernel(GridKernelType type) {
+	const GridKernelType best = detectGridKernel();
+	if (type == GRID_KERNEL_AUTO || type > best) {
+		return best;
+	}
+	return type;
+}
+
+const char* getGridKernelName(GridKernelType type) {
+	switch (type) {
+	case GRID_KERNEL_SCALAR:
+		return "scalar";
+	case GRID_KERNEL_SSE2:
+		return "sse2";
+	case GRID_KERNEL_AVX2:
+		return "avx2";
+	default:
+		return "auto";
+	}
+}
+
+// -------------------------
+// Kernels
+// -------------------------
+// The kernels are instantiated for each plane type, and for a few row lengths so that the
+//	loops of full rows have constant bounds; rows of any other length take the generic loop
+
+// y of every vertex of a row on a GRID_PLANE_Y_UP plane
+static inline float getRowHeight(const glm::vec4 &start) {
+	return start.y / start.w;
+}
+
+template <GridPlaneType PLANE>
+static GRID_FORCEINLINE void gridRowRange(const glm::vec4 &start, const glm::vec4 &step, int begin, int end, const GridVertexSink &sink, int first, float height) {
+	for (int i = begin; i < end; ++i) {
+		const float fi = (float)i;
+		const float divide = 1.f / (start.w + fi * step.w);
+		const float y = PLANE == GRID_PLANE_Y_UP ? height : (start.y + fi * step.y) * divide;
+		sink.set(first + i, glm::vec3((start.x + fi * step.x) * divide, y, (start.z + fi * step.z) * divide));
+	}
+}
+
+// Half floats of 4 floats in the low 16 bits of each lane, sign-extended, rounded to nearest
+//	even like the F16C conversion. Out of range values become infinities.
+static GRID_FORCEINLINE __m128i floatToHalf4(__m128 f) {
+	const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u));
+	const __m128 sign = _mm_and_ps(f, sign_mask);
+	const __m128 absf = _mm_xor_ps(f, sign);
+	const __m128i absi = _mm_castps_si128(absf);
+	// From 2^16 on the half overflows, NaNs keep a mantissa bit
+	const __m128i is_regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absi);
+	const __m128i nan_bit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+	const __m128i inf_or_nan = _mm_or_si128(nan_bit, _mm_set1_epi32(0x7C00));
+	// Below 2^-14 the half is subnormal: adding a magic float lets the FPU round the mantissa
+	const __m128i is_subnormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), absi);
+	const __m128i subnormal_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnormal_magic))), subnormal_magic);
+	// Otherwise rebias the exponent and round the mantissa to nearest, ties to even
+	const __m128i odd = _mm_srai_epi32(_mm_slli_epi32(absi, 31 - 13), 31);
+	const __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absi, _mm_set1_epi32(0xFFF - ((127 - 15) << 23))), odd), 13);
+	const __m128i finite = _mm_or_si128(_mm_and_si128(is_subnormal, subnormal), _mm_andnot_si128(is_subnormal, normal));
+	const __m128i half = _mm_or_si128(_mm_and_si128(is_regular, finite), _mm_andnot_si128(is_regular, inf_or_nan));
+	return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+
+// Write 4 packed vertices of the words (a, b, c), given as the 4 low words of each
+static GRID_FORCEINLINE void storePacked4(const GridVertexSink &sink, int i, __m128i a, __m128i b, __m128i c) {
+	const __m128i ab = _mm_unpacklo_epi16(a, b);	// a0 b0 a1 b1 a2 b2 a3 b3
+	const __m128i c32 = _mm_unpacklo_epi16(c, _mm_setzero_si128());
+	// Each vertex as a 6-byte value in a 64-bit lane: (a0 b0 c0 0) (a1 b1 c1 0) | (a2 ...) (a3 ...)
+	const __m128i v01 = _mm_unpacklo_epi32(ab, c32);
+	const __m128i v23 = _mm_unpackhi_epi32(ab, c32);
+	if (sink.getStride() == 3) {
+		// Close the 2-byte gaps: 4 vertices of 6 bytes are 24 bytes
+		const __m128i bytes0_5 = _mm_setr_epi32(-1, 0xFFFF, 0, 0);
+		const __m128i bytes6_11 = _mm_setr_epi32(0, (int)0xFFFF0000u, -1, 0);
+		const __m128i lo = _mm_or_si128(_mm_or_si128(_mm_and_si128(v01, bytes0_5), _mm_and_si128(_mm_srli_si128(v01, 2), bytes6_11)),
+			_mm_slli_si128(v23, 12));
+		const __m128i hi = _mm_or_si128(_mm_and_si128(_mm_srli_si128(v23, 4), _mm_setr_epi32(0xFFFF, 0, 0, 0)), _mm_srli_si128(v23, 6));
+		short *dst = sink.packed + i * 3;
+		_mm_storeu_si128((__m128i*)dst, lo);
+		_mm_storel_epi64((__m128i*)(dst + 8), hi);
+	} else {
+		unsigned long long v[4];
+		_mm_storeu_si128((__m128i*)&v[0], v01);
+		_mm_storeu_si128((__m128i*)&v[2], v23);
+		for (int k = 0; k < 4; ++k) {
+			memcpy(sink.packed + (i + k) * sink.getStride(), &v[k], 3 * sizeof(short));
+		}
+	}
+}
+
+// What packing the vertices of a sink takes, set up once per row
+struct GridPacking {
+	__m128 origin_x, origin_y, origin_z;
+	__m128 scale;		// quanta per world unit
+	__m128i y;			// of the undisplaced vertices on a GRID_PLANE_Y_UP plane, packed, in every word
+public:
+	GridPacking(const GridVertexSink &sink, float height) {
+		origin_x = _mm_set1_ps(sink.origin.x);
+		origin_y = _mm_set1_ps(sink.origin.y);
+		origin_z = _mm_set1_ps(sink.origin.z);
+		scale = _mm_set1_ps(1.f / sink.quantum);
+		y = _mm_set1_epi16(sink.isPacked() ? glm::detail::toFloat16(height - sink.origin.y) : 0);
+	}
+};
+
+// Write the 4 vertices [i, i + 4) of the sink. y is only read on a general plane, the
+//	packing's otherwise
+template <GridPlaneType PLANE>
+static GRID_FORCEINLINE void storeVertices4(const GridVertexSink &sink, const GridPacking &packing, int i, __m128 x, __m128 y, __m128 z) {
+	if (sink.layout == GRID_LAYOUT_HALF_XYZ) {
+		const __m128i hx = floatToHalf4(_mm_sub_ps(x, packing.origin_x));
+		const __m128i hz = floatToHalf4(_mm_sub_ps(z, packing.origin_z));
+		__m128i hy = packing.y;
+		if (PLANE == GRID_PLANE_GENERAL) {
+			hy = floatToHalf4(_mm_sub_ps(y, packing.origin_y));
+			hy = _mm_packs_epi32(hy, hy);
+		}
+		storePacked4(sink, i, _mm_packs_epi32(hx, hx), hy, _mm_packs_epi32(hz, hz));
+	} else if (sink.layout == GRID_LAYOUT_QUANTIZED) {
+		// Clamped like GridVertexSink::quantize, rounded to nearest
+		const __m128 low = _mm_set1_ps(-32767.f), high = _mm_set1_ps(32767.f);
+		const __m128i qx = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(x, packing.origin_x), packing.scale), low), high));
+		const __m128i qz = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_sub_ps(z, packing.origin_z), packing.scale), low), high));
+		__m128i hy = packing.y;
+		if (PLANE == GRID_PLANE_GENERAL) {
+			hy = floatToHalf4(_mm_sub_ps(y, packing.origin_y));
+			hy = _mm_packs_epi32(hy, hy);
+		}
+		// packs saturates, the clamp above keeps it symmetric
+		storePacked4(sink, i, _mm_packs_epi32(qx, qx), _mm_packs_epi32(qz, qz), hy);
+	} else if (sink.layout == GRID_LAYOUT_SOA) {
+		_mm_storeu_ps(sink.x + i, x);
+		_mm_storeu_ps(sink.z + i, z);
+		if (sink.y) _mm_storeu_ps(sink.y + i, y);
+	} else if (sink.layout == GRID_LAYOUT_AOS_XYZ && sink.getStride() == 3) {
+		// Interleave into 4 tightly packed (x, y, z), i.e. 12 floats
+		float *dst = sink.data + i * 3;
+		const __m128 xz_lo = _mm_unpacklo_ps(x, z);		// x0 z0 x1 z1
+		const __m128 xz_hi = _mm_unpackhi_ps(x, z);		// x2 z2 x3 z3
+		const __m128 xy_lo = _mm_unpacklo_ps(x, y);		// x0 y0 x1 y1
+		const __m128 xy_hi = _mm_unpackhi_ps(x, y);		// x2 y2 x3 y3
+		const __m128 yz_lo = _mm_unpacklo_ps(y, z);		// y0 z0 y1 z1
+		const __m128 yz_hi = _mm_unpackhi_ps(y, z);		// y2 z2 y3 z3
+		_mm_storeu_ps(dst + 0, _mm_shuffle_ps(xy_lo, xz_lo, _MM_SHUFFLE(2, 1, 1, 0)));	// x0 y0 z0 x1
+		_mm_storeu_ps(dst + 4, _mm_shuffle_ps(yz_lo, xy_hi, _MM_SHUFFLE(1, 0, 3, 2)));	// y1 z1 x2 y2
+		_mm_storeu_ps(dst + 8, _mm_shuffle_ps(xz_hi, yz_hi, _MM_SHUFFLE(3, 2, 2, 1)));	// z2 x3 y3 z3
+	} else if (sink.layout == GRID_LAYOUT_AOS_XZ && sink.getStride() == 2) {
+		float *dst = sink.data + i * 2;
+		_mm_storeu_ps(dst + 0, _mm_unpacklo_ps(x, z));
+		_mm_storeu_ps(dst + 4, _mm_unpackhi_ps(x, z));
+	} else {
+		// Interleaved with other attributes, no way around scattering
+		float xs[4], ys[4], zs[4];
+		_mm_storeu_ps(xs, x);
+		_mm_storeu_ps(ys, y);
+		_mm_storeu_ps(zs, z);
+		for (int k = 0; k < 4; ++k) {
+			sink.set(i + k, glm::vec3(xs[k], ys[k], zs[k]));
+		}
+	}
+}
+
+template <GridPlaneType PLANE, int COLUMNS>
+static void gridRowScalarT(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	const float height = getRowHeight(start);
+	if (COLUMNS && count == COLUMNS) {
+		gridRowRange<PLANE>(start, step, 0, COLUMNS, sink, first, height);
+	} else {
+		gridRowRange<PLANE>(start, step, 0, count, sink, first, height);
+	}
+}
+
+template <GridPlaneType PLANE>
+static GRID_FORCEINLINE void gridRowSSE2Body(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	const __m128 sx = _mm_set1_ps(start.x), sy = _mm_set1_ps(start.y), sz = _mm_set1_ps(start.z), sw = _mm_set1_ps(start.w);
+	const __m128 dx = _mm_set1_ps(step.x), dy = _mm_set1_ps(step.y), dz = _mm_set1_ps(step.z), dw = _mm_set1_ps(step.w);
+	const __m128 two = _mm_set1_ps(2.f);
+	const __m128 four = _mm_set1_ps(4.f);
+	const float height = getRowHeight(start);
+	const __m128 row_y = _mm_set1_ps(height);
+	const GridPacking packing(sink, height);
+	__m128 fi = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+	// Whole batches, the rest goes through the scalar loop
+	const int batched = count & ~3;
+	for (int i = 0; i < batched; i += 4) {
+		const __m128 x = _mm_add_ps(sx, _mm_mul_ps(fi, dx));
+		const __m128 z = _mm_add_ps(sz, _mm_mul_ps(fi, dz));
+		const __m128 w = _mm_add_ps(sw, _mm_mul_ps(fi, dw));
+		// 1/w, refined with one Newton-Raphson step: r' = r * (2 - w * r)
+		__m128 r = _mm_rcp_ps(w);
+		r = _mm_mul_ps(r, _mm_sub_ps(two, _mm_mul_ps(w, r)));
+		const __m128 y = PLANE == GRID_PLANE_Y_UP ? row_y : _mm_mul_ps(_mm_add_ps(sy, _mm_mul_ps(fi, dy)), r);
+		storeVertices4<PLANE>(sink, packing, first + i, _mm_mul_ps(x, r), y, _mm_mul_ps(z, r));
+		fi = _mm_add_ps(fi, four);
+	}
+	gridRowRange<PLANE>(start, step, batched, count, sink, first, height);
+}
+
+template <GridPlaneType PLANE, int COLUMNS>
+static void gridRowSSE2T(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	if (COLUMNS && count == COLUMNS) {
+		gridRowSSE2Body<PLANE>(start, step, COLUMNS, sink, first);
+	} else {
+		gridRowSSE2Body<PLANE>(start, step, count, sink, first);
+	}
+}
+
+template <GridPlaneType PLANE>
+GRID_TARGET_AVX2 static GRID_FORCEINLINE void gridRowAVX2Body(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	const __m256 sx = _mm256_set1_ps(start.x), sy = _mm256_set1_ps(start.y), sz = _mm256_set1_ps(start.z), sw = _mm256_set1_ps(start.w);
+	const __m256 dx = _mm256_set1_ps(step.x), dy = _mm256_set1_ps(step.y), dz = _mm256_set1_ps(step.z), dw = _mm256_set1_ps(step.w);
+	const __m256 two = _mm256_set1_ps(2.f);
+	const __m256 eight = _mm256_set1_ps(8.f);
+	const float height = getRowHeight(start);
+	const __m256 row_y = _mm256_set1_ps(height);
+	const GridPacking packing(sink, height);
+	const __m256 origin_x = _mm256_set1_ps(sink.origin.x), origin_y = _mm256_set1_ps(sink.origin.y), origin_z = _mm256_set1_ps(sink.origin.z);
+	const __m256 scale = _mm256_set1_ps(1.f / sink.quantum);
+	const __m256 low = _mm256_set1_ps(-32767.f), high = _mm256_set1_ps(32767.f);
+	__m256 fi = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+	const int batched = count & ~7;
+	for (int i = 0; i < batched; i += 8) {
+		const __m256 w = _mm256_fmadd_ps(fi, dw, sw);
+		__m256 r = _mm256_rcp_ps(w);
+		r = _mm256_mul_ps(r, _mm256_fnmadd_ps(w, r, two));
+		const __m256 x = _mm256_mul_ps(_mm256_fmadd_ps(fi, dx, sx), r);
+		const __m256 y = PLANE == GRID_PLANE_Y_UP ? row_y : _mm256_mul_ps(_mm256_fmadd_ps(fi, dy, sy), r);
+		const __m256 z = _mm256_mul_ps(_mm256_fmadd_ps(fi, dz, sz), r);
+		if (sink.isPacked()) {
+			// The 8 words of each channel at once, F16C converting the half floats
+			const __m128i hy = PLANE == GRID_PLANE_Y_UP ? packing.y : _mm256_cvtps_ph(_mm256_sub_ps(y, origin_y), _MM_FROUND_TO_NEAREST_INT);
+			__m128i a, b, c;
+			if (sink.layout == GRID_LAYOUT_HALF_XYZ) {
+				a = _mm256_cvtps_ph(_mm256_sub_ps(x, origin_x), _MM_FROUND_TO_NEAREST_INT);
+				b = hy;
+				c = _mm256_cvtps_ph(_mm256_sub_ps(z, origin_z), _MM_FROUND_TO_NEAREST_INT);
+			} else {
+				const __m256i qx = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(x, origin_x), scale), low), high));
+				const __m256i qz = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_sub_ps(z, origin_z), scale), low), high));
+				a = _mm_packs_epi32(_mm256_castsi256_si128(qx), _mm256_extracti128_si256(qx, 1));
+				b = _mm_packs_epi32(_mm256_castsi256_si128(qz), _mm256_extracti128_si256(qz, 1));
+				c = hy;
+			}
+			storePacked4(sink, first + i, a, b, c);
+			storePacked4(sink, first + i + 4, _mm_unpackhi_epi64(a, a), _mm_unpackhi_epi64(b, b), _mm_unpackhi_epi64(c, c));
+		} else {
+			storeVertices4<PLANE>(sink, packing, first + i, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+			storeVertices4<PLANE>(sink, packing, first + i + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+		}
+		fi = _mm256_add_ps(fi, eight);
+	}
+	gridRowRange<PLANE>(start, step, batched, count, sink, first, height);
+}
+
+template <GridPlaneType PLANE, int COLUMNS>
+GRID_TARGET_AVX2 static void gridRowAVX2T(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	if (COLUMNS && count == COLUMNS) {
+		gridRowAVX2Body<PLANE>(start, step, COLUMNS, sink, first);
+	} else {
+		gridRowAVX2Body<PLANE>(start, step, count, sink, first);
+	}
+}
+
+void gridRowScalar(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	gridRowScalarT<GRID_PLANE_Y_UP, 0>(start, step, count, sink, first);
+}
+
+void gridRowSSE2(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	gridRowSSE2T<GRID_PLANE_Y_UP, 0>(start, step, count, sink, first);
+}
+
+void gridRowAVX2(const glm::vec4 &start, const glm::vec4 &step, int count, const GridVertexSink &sink, int first) {
+	gridRowAVX2T<GRID_PLANE_Y_UP, 0>(start, step, count, sink, first);
+}
+
+// -------------------------
+// Dispatch
+// -------------------------
+template <GridPlaneType PLANE, int COLUMNS>
+static GridRowKernel getGridRowKernelT(GridKernelType type) {
+	switch (type) {
+	case GRID_KERNEL_AVX2:
+		return gridRowAVX2T<PLANE, COLUMNS>;
+	case GRID_KERNEL_SSE2:
+		return gridRowSSE2T<PLANE, COLUMNS>;
+	default:
+		return gridRowScalarT<PLANE, COLUMNS>;
+	}
+}
+
+template <GridPlaneType PLANE>
+static GridRowKernel getGridRowKernelT(GridKernelType type, int columns) {
+	switch (columns) {
+	case 128:
+		return getGridRowKernelT<PLANE, 128>(type);
+	case 256:
+		return getGridRowKernelT<PLANE, 256>(type);
+	case 512:
+		return getGridRowKernelT<PLANE, 512>(type);
+	case 1024:
+		return getGridRowKernelT<PLANE, 1024>(type);
+	default:
+		return getGridRowKernelT<PLANE, 0>(type);
+	}
+}
+
+GridRowKernel getGridRowKernel(GridKernelType type, GridPlaneType plane, int columns) {
+	type = resolveGridKernel(type);
+	if (plane == GRID_PLANE_GENERAL) {
+		return getGridRowKernelT<GRID_PLANE_GENERAL>(type, columns);
+	}
+	return getGridRowKernelT<GRID_PLANE_Y_UP>(type, columns);
+}
@@ -0,0 +1,157 @@
+#include "projectHM_PCH.h"
+
+#include <chrono>
+
+#include "HeightField.h"
+#include "ProjectedGrid.h"
+#include "GridPipeline.h"
+#include "../../hxlib/include/Profiler.h"
+
+GridPipeline::GridPipeline(ProjectedGrid &grid, float water_max_height, float water_min_height, float projector_height_inc)
+	: m_grid(grid), m_grid_camera(NULL), m_height_field(NULL),
+	m_water_max_height(water_max_height), m_water_min_height(water_min_height), m_projector_height_inc(projector_height_inc),
+	m_epoch(std::chrono::steady_clock::now()), m_back(0), m_front(1), m_middle(2), m_has_front(false),
+	m_pending(false), m_busy(false), m_quit(false), m_submitted(0), m_acquired_index(0), m_skipped(0), m_published(0) {
+}
+
+GridPipeline::~GridPipeline() {
+	stop();
+}
+
+double GridPipeline::getMilliseconds() const {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_epoch).count();
+}
+
+void GridPipeline::start() {
+	if (isRunning()) {
+		return;
+	}
+	m_grid_camera = m_grid.getRenderingCamera();
+	m_camera = *m_grid_camera;
+	m_grid.setRenderingCamera(&m_camera);
+	// Nothing published yet, the frames of a previous run are stale
+	m_middle.store(m_middle.load() & FRAME_MASK);
+	m_has_front = false;
+	m_pending = false;
+	m_quit = false;
+	m_worker = std::thread(&GridPipeline::workerLoop, this);
+}
+
+void GridPipeline::stop() {
+	if (!isRunning()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake_cond.notify_all();
+	m_worker.join();
+	m_grid.setRenderingCamera(m_grid_camera);
+	m_grid_camera = NULL;
+}
+
+void GridPipeline::setHeightField(HeightField *height_field) {
+	finish();
+	m_height_field = height_field;
+	m_grid.setHeightField(height_field);
+}
+
+void GridPipeline::submit(const Camera &camera, float time) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_request.camera = camera;
+		m_request.time = time;
+		m_request.index = ++m_submitted;
+		m_request.submit_ms = getMilliseconds();
+		m_pending = true;
+	}
+	m_wake_cond.notify_one();
+}
+
+void GridPipeline::finish() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (isRunning() && (m_pending || m_busy)) {
+		m_done_cond.wait(lock);
+	}
+}
+
+const GridPipelineFrame* GridPipeline::acquire(bool wait) {
+	if (wait) {
+		finish();
+	}
+	if (m_middle.load(std::memory_order_relaxed) & FRESH_BIT) {
+		// Give the worker back the front frame, take the one it published last
+		m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & FRAME_MASK;
+		GridPipelineFrame &frame = m_frames[m_front];
+		frame.acquire_ms = getMilliseconds();
+		m_skipped += frame.index - m_acquired_index - 1;
+		m_acquired_index = frame.index;
+		m_has_front = true;
+	}
+	return m_has_front ? &m_frames[m_front] : NULL;
+}
+
+void GridPipeline::workerLoop() {
+	Profiler::setThreadName("grid pipeline");
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		while (!m_quit && !m_pending) {
+			m_wake_cond.wait(lock);
+		}
+		if (m_quit) {
+			break;
+		}
+		const Request request = m_request;
+		m_pending = false;
+		m_busy = true;
+		lock.unlock();
+		buildFrame(request);
+		// The back frame is complete, release it to the reader and take the spare one
+		m_frames[m_back].publish_ms = getMilliseconds();
+		m_back = m_middle.exchange(m_back | FRESH_BIT, std::memory_order_acq_rel) & FRAME_MASK;
+		m_published.fetch_add(1);
+		lock.lock();
+		m_busy = false;
+		m_done_cond.notify_all();
+	}
+}
+
+void GridPipeline::buildFrame(const Request &request) {
+	PROFILE_ZONE("GridPipeline::buildFrame");
+	GridPipelineFrame &frame = m_frames[m_back];
+	frame.index = request.index;
+	frame.submit_ms = request.submit_ms;
+	frame.start_ms = getMilliseconds();
+	m_camera = request.camera;
+	frame.view_matrix = m_camera.getViewMatrix();
+	frame.projection_matrix = m_camera.getProjectionMatrix();
+	if (m_height_field) {
+		m_height_field->update(request.time);
+	}
+	frame.field_ms = getMilliseconds();
+	frame.visible = m_grid.getRangeMatrix(m_water_max_height, m_water_min_height, m_projector_height_inc);
+	frame.range_ms = getMilliseconds();
+	frame.range_count = 0;
+	if (frame.visible) {
+		// Only grows, the options can't change while running
+		if ((int)frame.vertices.size() < m_grid.getVertexCapacity()) {
+			frame.vertices.resize(m_grid.getVertexCapacity());
+		}
+		// The frames take turns, none of them holds the last generation
+		m_grid.generateGeometry(GridVertexSink::AoS(&frame.vertices[0].x));
+		frame.columns = m_grid.getColumns();
+		frame.rows = m_grid.getRows();
+		frame.topology = m_grid.getTopology().getType();
+		frame.culled = m_grid.getOptions().cull_rows;
+		if (frame.culled) {
+			const int max_ranges = m_grid.getMaxDrawRanges();
+			if ((int)frame.range_firsts.size() < max_ranges) {
+				frame.range_firsts.resize(max_ranges);
+				frame.range_counts.resize(max_ranges);
+			}
+			frame.range_count = max_ranges > 0 ? m_grid.getDrawRanges(&frame.range_firsts[0], &frame.range_counts[0]) : 0;
+		}
+	}
+	frame.generate_ms = getMilliseconds();
+}
@@ -0,0 +1,140 @@
+#include "projectHM_PCH.h"
+
+#include "GridStats.h"
+
+GridStats::GridStats() {
+	reset();
+}
+
+void GridStats::reset() {
+	m_current = GridFrameStats();
+	m_recording = false;
+	m_frame_count = 0;
+	m_early_outs = 0;
+	m_cached = 0;
+}
+
+void GridStats::beginFrame() {
+	endFrame();
+	m_current = GridFrameStats();
+	m_current.frame = m_frame_count;
+	m_recording = true;
+}
+
+void GridStats::endFrame() {
+	if (!m_recording) {
+		return;
+	}
+	m_frames[m_frame_count % WINDOW] = m_current;
+	++m_frame_count;
+	m_early_outs += m_current.visible ? 0 : 1;
+	m_cached += m_current.cached ? 1 : 0;
+	m_recording = false;
+}
+
+const GridFrameStats& GridStats::getFrame(int i) const {
+	// The oldest frame kept is the next one to be overwritten once the ring is full
+	const int first = m_frame_count > WINDOW ? m_frame_count % WINDOW : 0;
+	return m_frames[(first + i) % WINDOW];
+}
+
+float GridStats::getValue(const GridFrameStats &frame, GridStatsValue value) {
+	switch (value) {
+	case GRID_STATS_INTERSECTIONS:			return (float)frame.intersections;
+	case GRID_STATS_GENERATED_VERTICES:		return (float)frame.generated_vertices;
+	case GRID_STATS_INSIDE_PERCENT:			return frame.inside_percent;
+	case GRID_STATS_EDGE_MIN:				return frame.edge_min;
+	case GRID_STATS_EDGE_MEDIAN:			return frame.edge_median;
+	case GRID_STATS_EDGE_MAX:				return frame.edge_max;
+	case GRID_STATS_RANGE_MS:				return frame.range_ms;
+	case GRID_STATS_GENERATE_MS:			return frame.generate_ms;
+	case GRID_STATS_DISPLACE_MS:			return frame.displace_ms;
+	default:								return 0.f;
+	}
+}
+
+const char* GridStats::getValueName(GridStatsValue value) {
+	static const char *names[GRID_STATS_VALUE_COUNT] = {
+		"intersections", "generated_vertices", "inside_percent", "edge_min", "edge_median", "edge_max",
+		"range_ms", "generate_ms", "displace_ms"
+	};
+	return value >= 0 && value < GRID_STATS_VALUE_COUNT ? names[value] : "unknown";
+}
+
+void GridStats::gatherValues(GridStatsValue value) const {
+	m_values.clear();
+	const int size = getWindowSize();
+	for (int i = 0; i < size; ++i) {
+		const GridFrameStats &frame = getFrame(i);
+		// Besides the range matrix, a frame without the water has nothing to measure
+		if (frame.visible || value == GRID_STATS_RANGE_MS) {
+			m_values.push_back(getValue(frame, value));
+		}
+	}
+}
+
+float GridStats::getPercentile(GridStatsValue value, float p) const {
+	gatherValues(value);
+	if (m_values.empty()) {
+		return 0.f;
+	}
+	std::sort(m_values.begin(), m_values.end());
+	size_t rank = (size_t)ceil(p / 100.f * m_values.size());
+	return m_values[std::min(std::max(rank, (size_t)1), m_values.size()) - 1];
+}
+
+float GridStats::getMean(GridStatsValue value) const {
+	gatherValues(value);
+	if (m_values.empty()) {
+		return 0.f;
+	}
+	double sum = 0.0;
+	for (size_t i = 0; i < m_values.size(); ++i) {
+		sum += m_values[i];
+	}
+	return (float)(sum / m_values.size());
+}
+
+void GridStats::getHistogram(GridStatsValue value, float low, float high, int bins, int *counts) const {
+	std::fill(counts, counts + bins, 0);
+	if (bins <= 0) {
+		return;
+	}
+	gatherValues(value);
+	const float scale = high > low ? bins / (high - low) : 0.f;
+	for (size_t i = 0; i < m_values.size(); ++i) {
+		const int bin = (int)floor((m_values[i] - low) * scale);
+		++counts[std::min(std::max(bin, 0), bins - 1)];
+	}
+}
+
+void GridStats::writeCSVHeader(FILE *writer) {
+	fputs("frame,visible,cached,columns,rows", writer);
+	for (int v = 0; v < GRID_STATS_VALUE_COUNT; ++v) {
+		fprintf(writer, ",%s", getValueName((GridStatsValue)v));
+	}
+	fputc('\n', writer);
+}
+
+void GridStats::writeCSVRow(FILE *writer, const GridFrameStats &frame) {
+	fprintf(writer, "%d,%d,%d,%d,%d,%d,%d,%.2f,%.3f,%.3f,%.3f,%.4f,%.4f,%.4f\n",
+		frame.frame, frame.visible ? 1 : 0, frame.cached ? 1 : 0, frame.columns, frame.rows,
+		frame.intersections, frame.generated_vertices, frame.inside_percent,
+		frame.edge_min, frame.edge_median, frame.edge_max,
+		frame.range_ms, frame.generate_ms, frame.displace_ms);
+}
+
+bool GridStats::saveCSV(const char *filename) const {
+	FILE *writer = fopen(filename, "w");
+	if (writer == NULL) {
+		fprintf(stderr, "Cannot write grid stats into file '%s'\n", filename);
+		return false;
+	}
+	writeCSVHeader(writer);
+	const int size = getWindowSize();
+	for (int i = 0; i < size; ++i) {
+		writeCSVRow(writer, getFrame(i));
+	}
+	fclose(writer);
+	return true;
+}
@@ -0,0 +1,156 @@
+#include "projectHM_PCH.h"
+
+#include "GridTopology.h"
+#include "../../hxlib/include/Profiler.h"
+
+GridTopology::GridTopology()
+	: m_type(GRID_TOPOLOGY_POINTS), m_columns(0), m_rows(0), m_revision(0), m_short_index(true), m_index_count(0) {
+}
+
+bool GridTopology::update(int columns, int rows, GridTopologyType type) {
+	if (columns == m_columns && rows == m_rows && type == m_type) {
+		return false;
+	}
+	PROFILE_ZONE("GridTopology::update");
+	m_columns = columns;
+	m_rows = rows;
+	m_type = type;
+	m_indices16.clear();
+	m_indices32.clear();
+	m_strip_first.clear();
+	m_strip_size.clear();
+	m_short_index = columns * rows <= getMaxShortVertices(type);
+	switch (type) {
+	case GRID_TOPOLOGY_TRIANGLES:
+		if (m_short_index) {
+			buildTriangles(m_indices16);
+		} else {
+			buildTriangles(m_indices32);
+		}
+		break;
+	case GRID_TOPOLOGY_STRIPS:
+		if (m_short_index) {
+			buildStrips(m_indices16, (unsigned short)0xFFFFu);
+		} else {
+			buildStrips(m_indices32, 0xFFFFFFFFu);
+		}
+		break;
+	default:
+		m_short_index = true;
+		break;
+	}
+	m_index_count = (int)(m_short_index ? m_indices16.size() : m_indices32.size());
+	++m_revision;
+	return true;
+}
+
+void GridTopology::reserve(int max_columns, int max_rows, GridTopologyType type) {
+	if (type == GRID_TOPOLOGY_POINTS) {
+		return;
+	}
+	// The most indices of a grid 16-bit indices address: not always a square one, the
+	//	strips of a narrow grid restart on every row
+	const int max_short_vertices = getMaxShortVertices(type);
+	size_t short_count = 0;
+	for (int columns = 2; columns <= max_columns; ++columns) {
+		const int rows = std::min(max_rows, max_short_vertices / columns);
+		if (rows < 2) {
+			break;
+		}
+		short_count = std::max(short_count, countIndices(columns, rows, type));
+	}
+	m_indices16.reserve(short_count);
+	if ((long long)max_columns * max_rows > max_short_vertices) {
+		m_indices32.reserve(countIndices(max_columns, max_rows, type));
+	}
+	if (type == GRID_TOPOLOGY_STRIPS) {
+		const int strips = (max_columns - 1 + STRIPE_QUADS - 1) / STRIPE_QUADS * (max_rows - 1);
+		m_strip_first.reserve(strips);
+		m_strip_size.reserve(strips);
+	}
+}
+
+size_t GridTopology::countIndices(int columns, int rows, GridTopologyType type) {
+	const int stripes = (columns - 1 + STRIPE_QUADS - 1) / STRIPE_QUADS;
+	switch (type) {
+	case GRID_TOPOLOGY_TRIANGLES:
+		// 6 per quad
+		return (size_t)(columns - 1) * (rows - 1) * 6;
+	case GRID_TOPOLOGY_STRIPS:
+		// 2 per column of a stripe row, its columns overlapping by one, and the restarts
+		return (size_t)(rows - 1) * (2 * columns + 3 * stripes);
+	default:
+		return 0;
+	}
+}
+
+int GridTopology::getMaxShortVertices(GridTopologyType type) {
+	// 0xFFFF is taken by the restart index of the strips
+	return type == GRID_TOPOLOGY_STRIPS ? 0xFFFF : 0x10000;
+}
+
+bool GridTopology::getQuadRange(int stripe, int iv, int quad_begin, int quad_end, int &first, int &count) const {
+	const int c0 = stripe * STRIPE_QUADS;
+	const int c1 = std::min(c0 + STRIPE_QUADS, m_columns - 1);
+	quad_begin = std::max(quad_begin, c0);
+	quad_end = std::min(quad_end, c1);
+	if (quad_begin >= quad_end) {
+		return false;
+	}
+	switch (m_type) {
+	case GRID_TOPOLOGY_TRIANGLES:
+		// The stripes before are all STRIPE_QUADS wide
+		first = 6 * ((m_rows - 1) * c0 + iv * (c1 - c0) + (quad_begin - c0));
+		count = 6 * (quad_end - quad_begin);
+		return true;
+	case GRID_TOPOLOGY_STRIPS:
+		first = m_strip_first[stripe * (m_rows - 1) + iv] + 2 * (quad_begin - c0);
+		count = 2 * (quad_end - quad_begin + 1);
+		return true;
+	default:
+		return false;
+	}
+}
+
+template <typename Index>
+void GridTopology::buildTriangles(std::vector<Index> &indices) const {
+	const int columns = m_columns, rows = m_rows;
+	indices.reserve(countIndices(columns, rows, GRID_TOPOLOGY_TRIANGLES));
+	for (int c0 = 0; c0 < columns - 1; c0 += STRIPE_QUADS) {
+		const int c1 = std::min(c0 + STRIPE_QUADS, columns - 1);
+		for (int iv = 0; iv < rows - 1; ++iv) {
+			for (int iu = c0; iu < c1; ++iu) {
+				Index i = (Index)(iv * columns + iu);
+				Index below = (Index)(i + columns);
+				indices.push_back(i);
+				indices.push_back(below);
+				indices.push_back((Index)(i + 1));
+				indices.push_back((Index)(i + 1));
+				indices.push_back(below);
+				indices.push_back((Index)(below + 1));
+			}
+		}
+	}
+}
+
+template <typename Index>
+void GridTopology::buildStrips(std::vector<Index> &indices, Index restart) {
+	const int columns = m_columns, rows = m_rows;
+	indices.reserve(countIndices(columns, rows, GRID_TOPOLOGY_STRIPS));
+	for (int c0 = 0; c0 < columns - 1; c0 += STRIPE_QUADS) {
+		const int c1 = std::min(c0 + STRIPE_QUADS, columns - 1);
+		for (int iv = 0; iv < rows - 1; ++iv) {
+			if (!indices.empty()) {
+				indices.push_back(restart);
+			}
+			m_strip_first.push_back((int)indices.size());
+			m_strip_size.push_back(2 * (c1 - c0 + 1));
+			// Same winding as the triangles: (i, below, i + 1), (i + 1, below, below + 1)
+			for (int iu = c0; iu <= c1; ++iu) {
+				Index i = (Index)(iv * columns + iu);
+				indices.push_back(i);
+				indices.push_back((Index)(i + columns));
+			}
+		}
+	}
+}
@@ -0,0 +1,278 @@
+#include "projectHM_PCH.h"
+
+#include "GridTrace.h"
+#include "OceanFFT.h"
+#include "PerlinNoise.h"
+
+namespace {
+	const char TRACE_MAGIC[4] = {'P', 'G', 'T', 'R'};
+	const int TRACE_VERSION = 2;
+
+	void packOptions(const ProjectedGridOptions &options, GridTraceOptions &packed) {
+		// Cleared whole, the padding included, so that two traces of the same frames are the same files
+		memset(&packed, 0, sizeof(packed));
+		packed.sides = options.sides;
+		packed.rows = options.rows;
+		packed.strength = options.strength;
+		packed.elevation = options.elevation;
+		packed.smooth = options.smooth ? 1 : 0;
+		packed.kernel = options.kernel;
+		packed.threads = options.threads;
+		packed.topology = options.topology;
+		packed.adaptive = options.adaptive ? 1 : 0;
+		packed.budget_ms = options.budget_ms;
+		packed.min_sides = options.min_sides;
+		packed.warp_rows = options.warp_rows ? 1 : 0;
+		packed.cull_rows = options.cull_rows ? 1 : 0;
+		packed.cull_margin = options.cull_margin;
+		packed.stats = options.stats ? 1 : 0;
+		packed.temporal = options.temporal ? 1 : 0;
+		packed.reuse_pixels = options.reuse_pixels;
+		packed.refresh_pixels = options.refresh_pixels;
+		packed.refresh_rows = options.refresh_rows;
+	}
+
+	// The fields the trace knows how to rebuild, the others are recorded as a flat grid
+	GridTraceFieldType packField(const HeightField *field, GridTraceHeader &header) {
+		if (const OceanFFT *ocean = dynamic_cast<const OceanFFT*>(field)) {
+			const OceanFFTOptions &options = ocean->getOptions();
+			GridTraceOceanOptions &packed = header.ocean;
+			packed.resolution = options.resolution;
+			packed.tile_size = options.tile_size;
+			packed.spectrum = options.spectrum;
+			packed.wind_speed = options.wind_speed;
+			packed.wind_direction[0] = options.wind_direction.x;
+			packed.wind_direction[1] = options.wind_direction.y;
+			packed.amplitude = options.amplitude;
+			packed.fetch = options.fetch;
+			packed.gamma = options.gamma;
+			packed.choppiness = options.choppiness;
+			packed.repeat_period = options.repeat_period;
+			packed.seed = options.seed;
+			packed.threads = options.threads;
+			return GRID_TRACE_FIELD_OCEAN;
+		}
+		if (const PerlinNoise *noise = dynamic_cast<const PerlinNoise*>(field)) {
+			const PerlinNoiseOptions &options = noise->getOptions();
+			GridTraceNoiseOptions &packed = header.noise;
+			packed.resolution = options.resolution;
+			packed.tile_size = options.tile_size;
+			packed.octaves = options.octaves;
+			packed.amplitude = options.amplitude;
+			packed.persistence = options.persistence;
+			packed.speed = options.speed;
+			packed.speed_ratio = options.speed_ratio;
+			packed.seed = options.seed;
+			return GRID_TRACE_FIELD_NOISE;
+		}
+		if (field) {
+			fprintf(stderr, "Grid trace can't record this height field, recording a flat grid\n");
+		}
+		return GRID_TRACE_FIELD_NONE;
+	}
+}
+
+GridTraceWriter::GridTraceWriter() : m_writer(NULL), m_frame_count(0) {
+}
+
+GridTraceWriter::~GridTraceWriter() {
+	close();
+}
+
+bool GridTraceWriter::open(const char *filename, const ProjectedGrid &grid) {
+	close();
+	m_writer = fopen(filename, "wb");
+	if (m_writer == NULL) {
+		fprintf(stderr, "Cannot write grid trace into file '%s'\n", filename);
+		return false;
+	}
+	GridTraceHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.frame_size = sizeof(GridTraceFrame);
+	const Plane &plane = grid.getBasePlane();
+	header.base_plane[0] = plane.a;
+	header.base_plane[1] = plane.b;
+	header.base_plane[2] = plane.c;
+	header.base_plane[3] = plane.d;
+	header.field = packField(grid.getHeightField(), header);
+	fwrite(&header, sizeof(header), 1, m_writer);
+	m_frame_count = 0;
+	return true;
+}
+
+void GridTraceWriter::close() {
+	if (m_writer) {
+		fclose(m_writer);
+		m_writer = NULL;
+	}
+}
+
+void GridTraceWriter::record(const ProjectedGrid &grid, float time, float water_max_height, float water_min_height, float projector_height_inc, bool visible) {
+	if (m_writer == NULL) {
+		return;
+	}
+	GridTraceFrame frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.index = m_frame_count;
+	frame.visible = visible ? 1 : 0;
+	frame.time = time;
+	const Camera &camera = *grid.getRenderingCamera();
+	const glm::vec3 position = camera.getPosition();
+	const glm::vec2 rotation = camera.getRotation();
+	frame.position[0] = position.x;
+	frame.position[1] = position.y;
+	frame.position[2] = position.z;
+	frame.rotation[0] = rotation.x;
+	frame.rotation[1] = rotation.y;
+	frame.fov = camera.getFOV();
+	frame.near_clip = camera.getNearClip();
+	frame.far_clip = camera.getFarClip();
+	frame.width = (int)camera.getWidth();
+	frame.height = (int)camera.getHeight();
+	packOptions(grid.getOptions(), frame.options);
+	frame.columns = grid.getColumns();
+	frame.rows = grid.getRows();
+	frame.water_max_height = water_max_height;
+	frame.water_min_height = water_min_height;
+	frame.projector_height_inc = projector_height_inc;
+	memcpy(frame.range_matrix, glm::value_ptr(grid.getLastRangeMatrix()), sizeof(frame.range_matrix));
+	fwrite(&frame, sizeof(frame), 1, m_writer);
+	++m_frame_count;
+}
+
+GridTraceReader::GridTraceReader()
+	: m_file(INVALID_HANDLE_VALUE), m_mapping(NULL), m_data(NULL), m_frames(NULL), m_frame_count(0) {
+}
+
+GridTraceReader::~GridTraceReader() {
+	close();
+}
+
+bool GridTraceReader::open(const char *filename) {
+	close();
+	m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Cannot read grid trace from file '%s'\n", filename);
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(GridTraceHeader)) {
+		fprintf(stderr, "Invalid grid trace in file '%s'\n", filename);
+		close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	m_data = m_mapping ? (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (m_data == NULL) {
+		fprintf(stderr, "Cannot map grid trace from file '%s'\n", filename);
+		close();
+		return false;
+	}
+	const GridTraceHeader &header = *(const GridTraceHeader*)m_data;
+	if (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION
+		|| header.frame_size != sizeof(GridTraceFrame)) {
+		fprintf(stderr, "Invalid grid trace in file '%s'\n", filename);
+		close();
+		return false;
+	}
+	// A frame cut short by a crash is dropped
+	m_frames = (const GridTraceFrame*)(m_data + sizeof(GridTraceHeader));
+	m_frame_count = (int)((size.QuadPart - sizeof(GridTraceHeader)) / sizeof(GridTraceFrame));
+	return true;
+}
+
+void GridTraceReader::close() {
+	if (m_data) {
+		UnmapViewOfFile(m_data);
+		m_data = NULL;
+	}
+	if (m_mapping) {
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+	m_frames = NULL;
+	m_frame_count = 0;
+}
+
+Plane GridTraceReader::getBasePlane() const {
+	const GridTraceHeader &header = *(const GridTraceHeader*)m_data;
+	return Plane(header.base_plane[0], header.base_plane[1], header.base_plane[2], header.base_plane[3]);
+}
+
+HeightField* GridTraceReader::createHeightField() const {
+	const GridTraceHeader &header = *(const GridTraceHeader*)m_data;
+	if (header.field == GRID_TRACE_FIELD_OCEAN) {
+		const GridTraceOceanOptions &packed = header.ocean;
+		OceanFFTOptions options(packed.resolution, packed.tile_size, packed.wind_speed);
+		options.spectrum = (OceanSpectrumType)packed.spectrum;
+		options.wind_direction = glm::vec2(packed.wind_direction[0], packed.wind_direction[1]);
+		options.amplitude = packed.amplitude;
+		options.fetch = packed.fetch;
+		options.gamma = packed.gamma;
+		options.choppiness = packed.choppiness;
+		options.repeat_period = packed.repeat_period;
+		options.seed = packed.seed;
+		options.threads = packed.threads;
+		return new OceanFFT(options);
+	}
+	if (header.field == GRID_TRACE_FIELD_NOISE) {
+		const GridTraceNoiseOptions &packed = header.noise;
+		PerlinNoiseOptions options(packed.resolution, packed.tile_size, packed.octaves);
+		options.amplitude = packed.amplitude;
+		options.persistence = packed.persistence;
+		options.speed = packed.speed;
+		options.speed_ratio = packed.speed_ratio;
+		options.seed = packed.seed;
+		return new PerlinNoise(options);
+	}
+	return NULL;
+}
+
+void GridTraceReader::applyCamera(const GridTraceFrame &frame, Camera &camera) {
+	camera.setPosition(glm::vec3(frame.position[0], frame.position[1], frame.position[2]));
+	camera.setRotation(glm::vec2(frame.rotation[0], frame.rotation[1]));
+	camera.setFOV(frame.fov);
+	camera.setNearClip(frame.near_clip);
+	camera.setFarClip(frame.far_clip);
+	camera.setScreenWindow(frame.width, frame.height);
+}
+
+ProjectedGridOptions GridTraceReader::getReplayOptions(const GridTraceFrame &frame) {
+	const GridTraceOptions &packed = frame.options;
+	ProjectedGridOptions options(packed.sides, packed.strength, packed.elevation, packed.smooth != 0);
+	options.rows = packed.rows;
+	options.kernel = (GridKernelType)packed.kernel;
+	options.threads = packed.threads;
+	options.topology = (GridTopologyType)packed.topology;
+	options.budget_ms = packed.budget_ms;
+	options.min_sides = packed.min_sides;
+	options.warp_rows = packed.warp_rows != 0;
+	options.cull_rows = packed.cull_rows != 0;
+	options.cull_margin = packed.cull_margin;
+	options.stats = packed.stats != 0;
+	options.temporal = packed.temporal != 0;
+	options.reuse_pixels = packed.reuse_pixels;
+	options.refresh_pixels = packed.refresh_pixels;
+	options.refresh_rows = packed.refresh_rows;
+	// The resolution the controller picked rather than the controller
+	if (packed.adaptive) {
+		options.sides = frame.columns;
+		options.rows = frame.rows;
+	}
+	return options;
+}
+
+bool GridTraceReader::isSameGrid(const GridTraceFrame &a, const GridTraceFrame &b) {
+	return memcmp(&a.options, &b.options, sizeof(a.options)) == 0 && a.columns == b.columns && a.rows == b.rows;
+}
+
+bool GridTraceReader::matches(const GridTraceFrame &frame, const ProjectedGrid &grid, bool visible) {
+	return (frame.visible != 0) == visible
+		&& memcmp(frame.range_matrix, glm::value_ptr(grid.getLastRangeMatrix()), sizeof(frame.range_matrix)) == 0;
+}
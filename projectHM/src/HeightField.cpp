@@ -0,0 +1,274 @@
+#include "projectHM_PCH.h"
+
+#include "HeightField.h"
+
+#include "GridKernels.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define FIELD_TARGET_AVX2
+#else
+#define FIELD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+// -------------------------
+// TiledHeightMap
+// -------------------------
+TiledHeightMap::TiledHeightMap() : m_resolution(0), m_mask(0), m_tile_row_bits(0), m_channels(1) {
+}
+
+void TiledHeightMap::resize(int resolution, int channels) {
+	assert(resolution >= TILE_SIZE && (resolution & (resolution - 1)) == 0);
+	assert(channels == 1 || channels == 4);
+	m_resolution = resolution;
+	m_mask = resolution - 1;
+	m_tile_row_bits = 0;
+	while ((TILE_SIZE << m_tile_row_bits) < resolution) {
+		++m_tile_row_bits;
+	}
+	m_channels = channels;
+	m_texels.assign(resolution * resolution * channels, 0.f);
+}
+
+void TiledHeightMap::pack(const float *heights, const float *disp_x, const float *disp_z) {
+	const int n = m_resolution;
+	for (int z = 0; z < n; ++z) {
+		// A block row at a time, TILE_SIZE contiguous texels
+		for (int x = 0; x < n; x += TILE_SIZE) {
+			const int src = z * n + x;
+			float *dst = &m_texels[getTexelIndex(x, z) * m_channels];
+			if (m_channels == 1) {
+				memcpy(dst, heights + src, TILE_SIZE * sizeof(float));
+				continue;
+			}
+			for (int i = 0; i < TILE_SIZE; ++i, dst += 4) {
+				dst[0] = heights[src + i];
+				dst[1] = disp_x[src + i];
+				dst[2] = disp_z[src + i];
+			}
+		}
+	}
+}
+
+void TiledHeightMap::sample(float tx, float tz, float *out) const {
+	const float fx0 = floor(tx), fz0 = floor(tz);
+	const int x0 = (int)fx0, z0 = (int)fz0;
+	const float fx = tx - fx0, fz = tz - fz0;
+	const float *t00 = getTexel(x0, z0), *t10 = getTexel(x0 + 1, z0);
+	const float *t01 = getTexel(x0, z0 + 1), *t11 = getTexel(x0 + 1, z0 + 1);
+	for (int c = 0; c < std::min(m_channels, 3); ++c) {
+		const float h0 = t00[c] + (t10[c] - t00[c]) * fx;
+		const float h1 = t01[c] + (t11[c] - t01[c]) * fx;
+		out[c] = h0 + (h1 - h0) * fz;
+	}
+}
+
+void TiledHeightMap::sampleRange(const float *x, const float *z, int begin, int end, float scale, float *h, float *dx, float *dz) const {
+	float texel[3];
+	for (int i = begin; i < end; ++i) {
+		sample(x[i] * scale, z[i] * scale, texel);
+		h[i] = texel[0];
+		if (m_channels == 4) {
+			if (dx) dx[i] = texel[1];
+			if (dz) dz[i] = texel[2];
+		}
+	}
+}
+
+void TiledHeightMap::sampleBatch(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const {
+	if (m_texels.empty()) {
+		return;
+	}
+	static const bool avx2 = detectGridKernel() == GRID_KERNEL_AVX2;
+	if (avx2) {
+		sampleBatchAVX2(x, z, count, scale, h, dx, dz);
+	} else {
+		sampleBatchSSE2(x, z, count, scale, h, dx, dz);
+	}
+}
+
+void TiledHeightMap::sampleBatchSSE2(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const {
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 s = _mm_set1_ps(scale);
+	const __m128i mask = _mm_set1_epi32(m_mask);
+	const __m128i low = _mm_set1_epi32(TILE_SIZE - 1);
+	const __m128i one_i = _mm_set1_epi32(1);
+	const __m128i block_row_shift = _mm_cvtsi32_si128(m_tile_row_bits + 2 * TILE_BITS);
+	const float *texels = &m_texels[0];
+	const bool channels4 = m_channels == 4;
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128 tx = _mm_mul_ps(_mm_loadu_ps(x + i), s);
+		const __m128 tz = _mm_mul_ps(_mm_loadu_ps(z + i), s);
+		// floor, there's no rounding mode control in SSE2
+		__m128i ix = _mm_cvttps_epi32(tx), iz = _mm_cvttps_epi32(tz);
+		__m128 fx0 = _mm_cvtepi32_ps(ix), fz0 = _mm_cvtepi32_ps(iz);
+		const __m128 adjust_x = _mm_cmpgt_ps(fx0, tx), adjust_z = _mm_cmpgt_ps(fz0, tz);
+		ix = _mm_add_epi32(ix, _mm_castps_si128(adjust_x));
+		iz = _mm_add_epi32(iz, _mm_castps_si128(adjust_z));
+		const __m128 fx = _mm_sub_ps(tx, _mm_sub_ps(fx0, _mm_and_ps(adjust_x, one)));
+		const __m128 fz = _mm_sub_ps(tz, _mm_sub_ps(fz0, _mm_and_ps(adjust_z, one)));
+		// The index is the sum of a part depending on x and one depending on z
+		const __m128i x0 = _mm_and_si128(ix, mask), x1 = _mm_and_si128(_mm_add_epi32(ix, one_i), mask);
+		const __m128i z0 = _mm_and_si128(iz, mask), z1 = _mm_and_si128(_mm_add_epi32(iz, one_i), mask);
+		const __m128i x0_part = _mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(x0, TILE_BITS), 2 * TILE_BITS), _mm_and_si128(x0, low));
+		const __m128i x1_part = _mm_add_epi32(_mm_slli_epi32(_mm_srli_epi32(x1, TILE_BITS), 2 * TILE_BITS), _mm_and_si128(x1, low));
+		const __m128i z0_part = _mm_add_epi32(_mm_sll_epi32(_mm_srli_epi32(z0, TILE_BITS), block_row_shift), _mm_slli_epi32(_mm_and_si128(z0, low), TILE_BITS));
+		const __m128i z1_part = _mm_add_epi32(_mm_sll_epi32(_mm_srli_epi32(z1, TILE_BITS), block_row_shift), _mm_slli_epi32(_mm_and_si128(z1, low), TILE_BITS));
+		int index[4][4];
+		_mm_storeu_si128((__m128i*)index[0], _mm_add_epi32(z0_part, x0_part));
+		_mm_storeu_si128((__m128i*)index[1], _mm_add_epi32(z0_part, x1_part));
+		_mm_storeu_si128((__m128i*)index[2], _mm_add_epi32(z1_part, x0_part));
+		_mm_storeu_si128((__m128i*)index[3], _mm_add_epi32(z1_part, x1_part));
+		const int channels = channels4 ? 3 : 1;
+		for (int c = 0; c < channels; ++c) {
+			__m128 t[4];
+			for (int k = 0; k < 4; ++k) {
+				const float *base = texels + c;
+				const int shift = channels4 ? 2 : 0;
+				t[k] = _mm_setr_ps(base[index[k][0] << shift], base[index[k][1] << shift], base[index[k][2] << shift], base[index[k][3] << shift]);
+			}
+			const __m128 h0 = _mm_add_ps(t[0], _mm_mul_ps(_mm_sub_ps(t[1], t[0]), fx));
+			const __m128 h1 = _mm_add_ps(t[2], _mm_mul_ps(_mm_sub_ps(t[3], t[2]), fx));
+			const __m128 value = _mm_add_ps(h0, _mm_mul_ps(_mm_sub_ps(h1, h0), fz));
+			float *out = c == 0 ? h : (c == 1 ? dx : dz);
+			if (out) _mm_storeu_ps(out + i, value);
+		}
+	}
+	sampleRange(x, z, i, count, scale, h, dx, dz);
+}
+
+FIELD_TARGET_AVX2 void TiledHeightMap::sampleBatchAVX2(const float *x, const float *z, int count, float scale, float *h, float *dx, float *dz) const {
+	const __m256 s = _mm256_set1_ps(scale);
+	const __m256i mask = _mm256_set1_epi32(m_mask);
+	const __m256i low = _mm256_set1_epi32(TILE_SIZE - 1);
+	const __m256i one_i = _mm256_set1_epi32(1);
+	const __m128i block_row_shift = _mm_cvtsi32_si128(m_tile_row_bits + 2 * TILE_BITS);
+	const __m128i channel_shift = _mm_cvtsi32_si128(m_channels == 4 ? 2 : 0);
+	const float *texels = &m_texels[0];
+	const int channels = m_channels == 4 ? 3 : 1;
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256 tx = _mm256_mul_ps(_mm256_loadu_ps(x + i), s);
+		const __m256 tz = _mm256_mul_ps(_mm256_loadu_ps(z + i), s);
+		const __m256 fx0 = _mm256_floor_ps(tx), fz0 = _mm256_floor_ps(tz);
+		const __m256 fx = _mm256_sub_ps(tx, fx0), fz = _mm256_sub_ps(tz, fz0);
+		const __m256i ix = _mm256_cvttps_epi32(fx0), iz = _mm256_cvttps_epi32(fz0);
+		const __m256i x0 = _mm256_and_si256(ix, mask), x1 = _mm256_and_si256(_mm256_add_epi32(ix, one_i), mask);
+		const __m256i z0 = _mm256_and_si256(iz, mask), z1 = _mm256_and_si256(_mm256_add_epi32(iz, one_i), mask);
+		const __m256i x0_part = _mm256_add_epi32(_mm256_slli_epi32(_mm256_srli_epi32(x0, TILE_BITS), 2 * TILE_BITS), _mm256_and_si256(x0, low));
+		const __m256i x1_part = _mm256_add_epi32(_mm256_slli_epi32(_mm256_srli_epi32(x1, TILE_BITS), 2 * TILE_BITS), _mm256_and_si256(x1, low));
+		const __m256i z0_part = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srli_epi32(z0, TILE_BITS), block_row_shift), _mm256_slli_epi32(_mm256_and_si256(z0, low), TILE_BITS));
+		const __m256i z1_part = _mm256_add_epi32(_mm256_sll_epi32(_mm256_srli_epi32(z1, TILE_BITS), block_row_shift), _mm256_slli_epi32(_mm256_and_si256(z1, low), TILE_BITS));
+		const __m256i index[4] = {
+			_mm256_sll_epi32(_mm256_add_epi32(z0_part, x0_part), channel_shift),
+			_mm256_sll_epi32(_mm256_add_epi32(z0_part, x1_part), channel_shift),
+			_mm256_sll_epi32(_mm256_add_epi32(z1_part, x0_part), channel_shift),
+			_mm256_sll_epi32(_mm256_add_epi32(z1_part, x1_part), channel_shift)
+		};
+		for (int c = 0; c < channels; ++c) {
+			const __m256 t00 = _mm256_i32gather_ps(texels + c, index[0], 4);
+			const __m256 t10 = _mm256_i32gather_ps(texels + c, index[1], 4);
+			const __m256 t01 = _mm256_i32gather_ps(texels + c, index[2], 4);
+			const __m256 t11 = _mm256_i32gather_ps(texels + c, index[3], 4);
+			const __m256 h0 = _mm256_fmadd_ps(_mm256_sub_ps(t10, t00), fx, t00);
+			const __m256 h1 = _mm256_fmadd_ps(_mm256_sub_ps(t11, t01), fx, t01);
+			const __m256 value = _mm256_fmadd_ps(_mm256_sub_ps(h1, h0), fz, h0);
+			float *out = c == 0 ? h : (c == 1 ? dx : dz);
+			if (out) _mm256_storeu_ps(out + i, value);
+		}
+	}
+	sampleRange(x, z, i, count, scale, h, dx, dz);
+}
+
+// -------------------------
+// HeightField
+// -------------------------
+HeightField::HeightField() : m_resolution(0), m_tile_size(1.f), m_min_height(0.f), m_max_height(0.f), m_max_horizontal(0.f) {
+}
+
+void HeightField::resize(int resolution, float tile_size, bool horizontal) {
+	assert(resolution > 0 && (resolution & (resolution - 1)) == 0);
+	m_resolution = resolution;
+	m_tile_size = tile_size;
+	m_heights.assign(resolution * resolution, 0.f);
+	m_min_height = m_max_height = 0.f;
+	m_max_horizontal = 0.f;
+	if (horizontal) {
+		m_disp_x.assign(resolution * resolution, 0.f);
+		m_disp_z.assign(resolution * resolution, 0.f);
+	} else {
+		m_disp_x.clear();
+		m_disp_z.clear();
+	}
+	m_texels.resize(resolution, horizontal ? 4 : 1);
+}
+
+void HeightField::commit() {
+	if (m_disp_x.empty()) {
+		m_texels.pack(&m_heights[0], NULL, NULL);
+	} else {
+		m_texels.pack(&m_heights[0], &m_disp_x[0], &m_disp_z[0]);
+	}
+	// The resolution is a power of 2, at least 8
+	const float *heights = &m_heights[0];
+	__m128 lo = _mm_loadu_ps(heights), hi = lo;
+	for (size_t i = 4; i < m_heights.size(); i += 4) {
+		const __m128 h = _mm_loadu_ps(heights + i);
+		lo = _mm_min_ps(lo, h);
+		hi = _mm_max_ps(hi, h);
+	}
+	float lows[4], highs[4];
+	_mm_storeu_ps(lows, lo);
+	_mm_storeu_ps(highs, hi);
+	m_min_height = std::min(std::min(lows[0], lows[1]), std::min(lows[2], lows[3]));
+	m_max_height = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+	if (!m_disp_x.empty()) {
+		// Bounded by the largest |x| and |z| apart
+		const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		__m128 mx = _mm_setzero_ps(), mz = _mm_setzero_ps();
+		for (size_t i = 0; i < m_disp_x.size(); i += 4) {
+			mx = _mm_max_ps(mx, _mm_and_ps(_mm_loadu_ps(&m_disp_x[i]), abs_mask));
+			mz = _mm_max_ps(mz, _mm_and_ps(_mm_loadu_ps(&m_disp_z[i]), abs_mask));
+		}
+		_mm_storeu_ps(lows, mx);
+		_mm_storeu_ps(highs, mz);
+		const float x = std::max(std::max(lows[0], lows[1]), std::max(lows[2], lows[3]));
+		const float z = std::max(std::max(highs[0], highs[1]), std::max(highs[2], highs[3]));
+		m_max_horizontal = sqrt(x * x + z * z);
+	}
+}
+
+float HeightField::sampleHeight(float x, float z) const {
+	if (m_heights.empty()) {
+		return 0.f;
+	}
+	const float scale = m_resolution / m_tile_size;
+	float texel[3];
+	m_texels.sample(x * scale, z * scale, texel);
+	return texel[0];
+}
+
+glm::vec3 HeightField::sampleDisplacement(float x, float z) const {
+	if (m_heights.empty()) {
+		return glm::vec3(0.f);
+	}
+	const float scale = m_resolution / m_tile_size;
+	float texel[3] = {0.f, 0.f, 0.f};
+	m_texels.sample(x * scale, z * scale, texel);
+	return glm::vec3(texel[1], texel[0], texel[2]);
+}
+
+void HeightField::sampleDisplacements(const float *x, const float *z, int count, float *dx, float *h, float *dz) const {
+	if (m_heights.empty()) {
+		std::fill(h, h + count, 0.f);
+	} else {
+		m_texels.sampleBatch(x, z, count, m_resolution / m_tile_size, h, dx, dz);
+	}
+	if (m_disp_x.empty()) {
+		if (dx) std::fill(dx, dx + count, 0.f);
+		if (dz) std::fill(dz, dz + count, 0.f);
+	}
+}
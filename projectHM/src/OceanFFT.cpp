@@ -0,0 +1,232 @@
+#include "projectHM_PCH.h"
+
+#include "OceanFFT.h"
+
+#include "FFT.h"
+#include "WorkerPool.h"
+
+#include <random>
+#include <emmintrin.h>
+
+namespace {
+	const float GRAVITY = 9.81f;
+	// Gives the significant wave height 0.21 U^2 / g of a fully developed sea
+	const float PHILLIPS_CONSTANT = 0.00175f;
+
+	// sin and cos of 4 angles, accurate to ~1e-6 over the range the phases stay in
+	inline void sinCos4(__m128 x, __m128 &s, __m128 &c) {
+		const __m128 sign_mask = _mm_set1_ps(-0.f);
+		const __m128 half_pi = _mm_set1_ps(1.57079637f);
+		const __m128 pi = _mm_set1_ps(3.14159274f);
+		// Down to [-pi, pi], 2 pi in two parts to keep the bits lost by the rounding
+		const __m128 q = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.159154937f))));
+		x = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(6.28125f)));
+		x = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(1.93530717e-3f)));
+		// Then to [-pi/2, pi/2]: sin(pi - x) = sin(x), cos(pi - x) = -cos(x)
+		const __m128 sign = _mm_and_ps(x, sign_mask);
+		__m128 ax = _mm_andnot_ps(sign_mask, x);
+		const __m128 flip = _mm_cmpgt_ps(ax, half_pi);
+		ax = _mm_or_ps(_mm_and_ps(flip, _mm_sub_ps(pi, ax)), _mm_andnot_ps(flip, ax));
+		x = _mm_or_ps(ax, sign);
+		const __m128 x2 = _mm_mul_ps(x, x);
+		__m128 ps = _mm_set1_ps(-2.50521084e-8f);
+		ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(2.75573192e-6f));
+		ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(-1.98412698e-4f));
+		ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(8.33333333e-3f));
+		ps = _mm_add_ps(_mm_mul_ps(ps, x2), _mm_set1_ps(-1.66666667e-1f));
+		s = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(ps, x2), x));
+		__m128 pc = _mm_set1_ps(2.08767570e-9f);
+		pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(-2.75573192e-7f));
+		pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(2.48015873e-5f));
+		pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(-1.38888889e-3f));
+		pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(4.16666667e-2f));
+		pc = _mm_add_ps(_mm_mul_ps(pc, x2), _mm_set1_ps(-0.5f));
+		c = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(pc, x2));
+		c = _mm_xor_ps(c, _mm_and_ps(flip, sign_mask));
+	}
+
+	inline int frequencyIndex(int i, int n) {
+		return i < n / 2 ? i : i - n;
+	}
+}
+
+OceanFFT::OceanFFT(const OceanFFTOptions &options)
+	: m_fft(NULL), m_worker_pool(NULL), m_time(0.f) {
+	setOptions(options);
+}
+
+OceanFFT::~OceanFFT() {
+	if (m_fft) {
+		delete m_fft;
+		m_fft = NULL;
+	}
+	if (m_worker_pool) {
+		delete m_worker_pool;
+		m_worker_pool = NULL;
+	}
+}
+
+void OceanFFT::setOptions(const OceanFFTOptions &options) {
+	m_options = options;
+	int n = options.resolution;
+	if (n < 128 || n > 1024 || (n & (n - 1)) != 0) {
+		fprintf(stderr, "Invalid ocean resolution %d, using 256\n", n);
+		n = m_options.resolution = 256;
+	}
+	if (!m_fft || m_fft->getSize() != n) {
+		delete m_fft;
+		m_fft = new FFT2D(n);
+	}
+	int threads = options.threads > 0 ? options.threads : WorkerPool::getHardwareThreadCount();
+	if (m_worker_pool && m_worker_pool->getThreadCount() != threads) {
+		delete m_worker_pool;
+		m_worker_pool = NULL;
+	}
+	if (!m_worker_pool && threads > 1) {
+		m_worker_pool = new WorkerPool(threads);
+	}
+
+	const bool choppy = options.choppiness != 0.f;
+	resize(n, options.tile_size, choppy);
+	m_hx_re.assign(n * n, 0.f);
+	m_hx_im.assign(n * n, 0.f);
+	m_dz_re.assign(choppy ? n * n : 0, 0.f);
+	m_dz_im.assign(choppy ? n * n : 0, 0.f);
+	initSpectrum();
+	update(m_time);
+}
+
+float OceanFFT::getSpectrum(const glm::vec2 &k) const {
+	const float k_length = glm::length(k);
+	const float wind_speed = std::max(m_options.wind_speed, 0.01f);
+	const glm::vec2 wind_dir = glm::normalize(m_options.wind_direction);
+	const float cos_theta = glm::dot(k / k_length, wind_dir);
+	// Waves shorter than 2 samples would only alias
+	const float small_wave = m_options.tile_size / m_options.resolution;
+	const float suppression = exp(-k_length * k_length * small_wave * small_wave);
+
+	if (m_options.spectrum == OCEAN_SPECTRUM_JONSWAP) {
+		// Waves only travel downwind, with a cos^2 spreading
+		if (cos_theta <= 0.f) {
+			return 0.f;
+		}
+		const float fetch = std::max(m_options.fetch, 1.f);
+		const float alpha = 0.076f * pow(wind_speed * wind_speed / (fetch * GRAVITY), 0.22f);
+		const float omega_peak = 22.f * pow(GRAVITY * GRAVITY / (wind_speed * fetch), 1.f / 3.f);
+		const float omega = sqrt(GRAVITY * k_length);
+		const float sigma = omega <= omega_peak ? 0.07f : 0.09f;
+		const float d = (omega - omega_peak) / (sigma * omega_peak);
+		const float peak = pow(m_options.gamma, exp(-0.5f * d * d));
+		const float ratio = omega_peak / omega;
+		const float s_omega = alpha * GRAVITY * GRAVITY / pow(omega, 5.f) * exp(-1.25f * ratio * ratio * ratio * ratio) * peak;
+		// S(k, theta) = S(w) * dw/dk / k * D(theta), with dw/dk = g / 2w in deep water
+		const float spreading = 2.f / PI * cos_theta * cos_theta;
+		return s_omega * GRAVITY / (2.f * omega) / k_length * spreading * suppression;
+	}
+
+	const float l = wind_speed * wind_speed / GRAVITY;
+	const float kl = k_length * l;
+	return PHILLIPS_CONSTANT * exp(-1.f / (kl * kl)) / (k_length * k_length * k_length * k_length)
+		* cos_theta * cos_theta * suppression;
+}
+
+void OceanFFT::initSpectrum() {
+	const int n = m_options.resolution;
+	const float dk = 2.f * PI / m_options.tile_size;
+	const float omega_0 = 2.f * PI / m_options.repeat_period;
+	std::mt19937 generator(m_options.seed);
+	std::normal_distribution<float> gaussian(0.f, 1.f);
+
+	m_h0_re.assign(n * n, 0.f);
+	m_h0_im.assign(n * n, 0.f);
+	m_omega.assign(n * n, 0.f);
+	m_chop_x.assign(n * n, 0.f);
+	m_chop_z.assign(n * n, 0.f);
+	for (int iz = 0; iz < n; ++iz) {
+		for (int ix = 0; ix < n; ++ix) {
+			const int i = iz * n + ix;
+			// Always draw, so that the waves don't depend on which ones are dropped
+			const float xi_re = gaussian(generator), xi_im = gaussian(generator);
+			const int fx = frequencyIndex(ix, n), fz = frequencyIndex(iz, n);
+			// No mean height, and the Nyquist frequencies have no opposite to pair with
+			if ((fx == 0 && fz == 0) || ix == n / 2 || iz == n / 2) {
+				continue;
+			}
+			const glm::vec2 k(fx * dk, fz * dk);
+			const float k_length = glm::length(k);
+			// E|h0|^2 = S dk^2 / 2, the other half of the energy comes from conj(h0(-k))
+			const float amplitude = 0.5f * dk * sqrt(m_options.amplitude * getSpectrum(k));
+			m_h0_re[i] = xi_re * amplitude;
+			m_h0_im[i] = xi_im * amplitude;
+			m_omega[i] = floor(sqrt(GRAVITY * k_length) / omega_0) * omega_0;
+			m_chop_x[i] = -m_options.choppiness * k.x / k_length;
+			m_chop_z[i] = -m_options.choppiness * k.y / k_length;
+		}
+	}
+	m_h0c_re.resize(n * n);
+	m_h0c_im.resize(n * n);
+	for (int iz = 0; iz < n; ++iz) {
+		for (int ix = 0; ix < n; ++ix) {
+			const int i = iz * n + ix;
+			const int mirror = ((n - iz) & (n - 1)) * n + ((n - ix) & (n - 1));
+			m_h0c_re[i] = m_h0_re[mirror];
+			m_h0c_im[i] = -m_h0_im[mirror];
+		}
+	}
+}
+
+void OceanFFT::evolveRows(int row_begin, int row_end) {
+	const int n = m_options.resolution;
+	const bool choppy = !m_dz_re.empty();
+	const __m128 t = _mm_set1_ps(m_time);
+	const __m128 one = _mm_set1_ps(1.f);
+	for (int i = row_begin * n; i < row_end * n; i += 4) {
+		__m128 s, c;
+		sinCos4(_mm_mul_ps(_mm_loadu_ps(&m_omega[i]), t), s, c);
+		const __m128 a_re = _mm_loadu_ps(&m_h0_re[i]), a_im = _mm_loadu_ps(&m_h0_im[i]);
+		const __m128 b_re = _mm_loadu_ps(&m_h0c_re[i]), b_im = _mm_loadu_ps(&m_h0c_im[i]);
+		// h = h0 * (c + i s) + conj(h0(-k)) * (c - i s)
+		const __m128 h_re = _mm_add_ps(_mm_mul_ps(_mm_add_ps(a_re, b_re), c), _mm_mul_ps(_mm_sub_ps(b_im, a_im), s));
+		const __m128 h_im = _mm_add_ps(_mm_mul_ps(_mm_add_ps(a_im, b_im), c), _mm_mul_ps(_mm_sub_ps(a_re, b_re), s));
+		if (!choppy) {
+			_mm_storeu_ps(&m_hx_re[i], h_re);
+			_mm_storeu_ps(&m_hx_im[i], h_im);
+			continue;
+		}
+		// With Dx = chop_x * (h_im - i h_re): h + i Dx = (1 + chop_x) * h
+		const __m128 chop_x = _mm_loadu_ps(&m_chop_x[i]), chop_z = _mm_loadu_ps(&m_chop_z[i]);
+		const __m128 scale = _mm_add_ps(one, chop_x);
+		_mm_storeu_ps(&m_hx_re[i], _mm_mul_ps(scale, h_re));
+		_mm_storeu_ps(&m_hx_im[i], _mm_mul_ps(scale, h_im));
+		_mm_storeu_ps(&m_dz_re[i], _mm_mul_ps(chop_z, h_im));
+		_mm_storeu_ps(&m_dz_im[i], _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(chop_z, h_re)));
+	}
+}
+
+void OceanFFT::evolveRowsTask(void *ocean, int row_begin, int row_end) {
+	static_cast<OceanFFT*>(ocean)->evolveRows(row_begin, row_end);
+}
+
+void OceanFFT::update(float time) {
+	const int n = m_options.resolution;
+	m_time = (float)fmod((double)time, (double)m_options.repeat_period);
+	if (m_time < 0.f) {
+		m_time += m_options.repeat_period;
+	}
+	if (m_worker_pool) {
+		m_worker_pool->parallelFor(n, 8, evolveRowsTask, this);
+	} else {
+		evolveRows(0, n);
+	}
+	m_fft->inverse(&m_hx_re[0], &m_hx_im[0], m_worker_pool);
+	if (!m_dz_re.empty()) {
+		m_fft->inverse(&m_dz_re[0], &m_dz_im[0], m_worker_pool);
+	}
+	// The transforms are the samples, the old samples become the next buffers
+	m_heights.swap(m_hx_re);
+	if (!m_dz_re.empty()) {
+		m_disp_x.swap(m_hx_im);
+		m_disp_z.swap(m_dz_re);
+	}
+	commit();
+}
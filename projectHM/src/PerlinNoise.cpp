@@ -0,0 +1,240 @@
+#include "projectHM_PCH.h"
+
+#include "PerlinNoise.h"
+
+#include <climits>
+#include <random>
+#include <emmintrin.h>
+
+namespace {
+	// Gradients of the improved noise, (x, z, t)
+	const float GRADIENTS[16][3] = {
+		{1, 1, 0}, {-1, 1, 0}, {1, -1, 0}, {-1, -1, 0},
+		{1, 0, 1}, {-1, 0, 1}, {1, 0, -1}, {-1, 0, -1},
+		{0, 1, 1}, {0, -1, 1}, {0, 1, -1}, {0, -1, -1},
+		{1, 1, 0}, {0, -1, 1}, {-1, 1, 0}, {0, -1, -1}
+	};
+	// Keeps the octaves from being the same noise at different times
+	const float OCTAVE_TIME_OFFSET = 31.7f;
+
+	inline float fade(float t) {
+		return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+	}
+
+	inline __m128 fade4(__m128 t) {
+		__m128 f = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.f)), _mm_set1_ps(15.f));
+		f = _mm_add_ps(_mm_mul_ps(f, t), _mm_set1_ps(10.f));
+		return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(f, t), t), t);
+	}
+
+	inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	inline int log2i(int n) {
+		int bits = 0;
+		while ((1 << bits) < n) {
+			++bits;
+		}
+		return bits;
+	}
+}
+
+PerlinNoise::PerlinNoise(const PerlinNoiseOptions &options)
+	: m_time(0.f), m_octave_updates(0), m_updates_to_rebuild(0) {
+	setOptions(options);
+}
+
+void PerlinNoise::setOptions(const PerlinNoiseOptions &options) {
+	m_options = options;
+	int n = options.resolution;
+	if (n < 64 || n > 1024 || (n & (n - 1)) != 0) {
+		fprintf(stderr, "Invalid noise resolution %d, using 256\n", n);
+		n = m_options.resolution = 256;
+	}
+	// The octave k is read every 2^k * OCTAVE_SIZE / n texels
+	const int max_octaves = log2i(TEXELS_PER_CELL / 2) + log2i(n) - log2i(OCTAVE_SIZE) + 1;
+	if (m_options.octaves > max_octaves || m_options.octaves < 1) {
+		fprintf(stderr, "Invalid noise octave count %d at resolution %d, using %d\n", m_options.octaves, n, max_octaves);
+		m_options.octaves = max_octaves;
+	}
+
+	std::mt19937 generator(options.seed);
+	for (int i = 0; i < 256; ++i) {
+		m_permutation[i] = (unsigned char)i;
+	}
+	for (int i = 255; i > 0; --i) {
+		std::swap(m_permutation[i], m_permutation[generator() % (i + 1)]);
+	}
+	for (int i = 0; i < 256; ++i) {
+		m_permutation[256 + i] = m_permutation[i];
+	}
+
+	resize(n, options.tile_size, false);
+	const int texel_count = OCTAVE_SIZE * OCTAVE_SIZE;
+	m_octave_texels.assign(m_options.octaves * 2 * texel_count, 0.f);
+	m_octave_steps.assign(m_options.octaves, LLONG_MIN);
+	m_octave_times.assign(m_options.octaves, 0.0);
+	m_octave_blended.assign(m_options.octaves * texel_count, 0.f);
+	m_octave_delta.assign(texel_count, 0.f);
+	m_changes.assign(n * n, 0.f);
+	m_updates_to_rebuild = 0;
+	update(m_time);
+}
+
+void PerlinNoise::generateOctave(int octave, long long time_step, float *texels) {
+	// Only the step within the 256 periods of the permutation matters
+	const long long period = 256 * TIME_STEPS;
+	const int wrapped_step = (int)(((time_step % period) + period) % period);
+	const float t = (float)wrapped_step / TIME_STEPS + octave * OCTAVE_TIME_OFFSET;
+	const float t0 = floor(t);
+	const int it = (int)t0 & 255;
+	const float ft = t - t0;
+	const __m128 w = _mm_set1_ps(fade(ft));
+
+	// Within a cell the gradients are the same for all the texels, and a cell holds
+	//	TEXELS_PER_CELL texels in x: 4 texels of a row are done at once, gradients broadcast
+	__m128 fx[TEXELS_PER_CELL / 4], u[TEXELS_PER_CELL / 4];
+	for (int g = 0; g < TEXELS_PER_CELL / 4; ++g) {
+		fx[g] = _mm_mul_ps(_mm_add_ps(_mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), _mm_set1_ps(g * 4.f)), _mm_set1_ps(1.f / TEXELS_PER_CELL));
+		u[g] = fade4(fx[g]);
+	}
+	for (int iz = 0; iz < OCTAVE_SIZE; ++iz) {
+		const int cz = iz / TEXELS_PER_CELL;
+		const float fz = ((iz % TEXELS_PER_CELL) + 0.5f) / TEXELS_PER_CELL;
+		const __m128 v = _mm_set1_ps(fade(fz));
+		float *row = texels + iz * OCTAVE_SIZE;
+		for (int cx = 0; cx < OCTAVE_CELLS; ++cx) {
+			// The 8 corners (dx, dz, dt): gradient.x * fx + the part that doesn't depend on fx
+			__m128 gx[8], offset[8];
+			for (int c = 0; c < 8; ++c) {
+				const int dx = c & 1, dz = (c >> 1) & 1, dt = c >> 2;
+				const int x = (cx + dx) & (OCTAVE_CELLS - 1), z = (cz + dz) & (OCTAVE_CELLS - 1);
+				const int hash = m_permutation[m_permutation[m_permutation[x] + z] + ((it + dt) & 255)] & 15;
+				const float *gradient = GRADIENTS[hash];
+				gx[c] = _mm_set1_ps(gradient[0]);
+				offset[c] = _mm_set1_ps(-gradient[0] * dx + gradient[1] * (fz - dz) + gradient[2] * (ft - dt));
+			}
+			for (int g = 0; g < TEXELS_PER_CELL / 4; ++g) {
+				__m128 n[8];
+				for (int c = 0; c < 8; ++c) {
+					n[c] = _mm_add_ps(_mm_mul_ps(gx[c], fx[g]), offset[c]);
+				}
+				const __m128 n00 = lerp4(n[0], n[1], u[g]), n10 = lerp4(n[2], n[3], u[g]);
+				const __m128 n01 = lerp4(n[4], n[5], u[g]), n11 = lerp4(n[6], n[7], u[g]);
+				const __m128 n0 = lerp4(n00, n10, v), n1 = lerp4(n01, n11, v);
+				_mm_storeu_ps(row + cx * TEXELS_PER_CELL + g * 4, lerp4(n0, n1, w));
+			}
+		}
+	}
+}
+
+void PerlinNoise::addOctave(int octave, const float *texels, bool first) {
+	const int n = m_resolution, period = n >> octave;
+	const int size_bits = log2i(OCTAVE_SIZE), resolution_bits = log2i(n);
+	const int mask = OCTAVE_SIZE - 1;
+	// The octave is read every 2^shift texels
+	const int shift = octave + size_bits - resolution_bits;
+	for (int z = 0; z < period; ++z) {
+		float *row = &m_changes[z * n];
+		if (first) {
+			std::fill(row, row + period, 0.f);
+		}
+		if (shift >= 0) {
+			const float *src = texels + ((z << shift) & mask) * OCTAVE_SIZE;
+			for (int x = 0; x < period; ++x) {
+				row[x] += src[(x << shift) & mask];
+			}
+		} else {
+			// Magnified: 2^-shift samples per texel, bilinearly filtered
+			const int magnify = -shift;
+			const float scale = 1.f / (1 << magnify);
+			const int z0 = (z >> magnify) & mask;
+			const float fz = (z & ((1 << magnify) - 1)) * scale;
+			const float *src0 = texels + z0 * OCTAVE_SIZE;
+			const float *src1 = texels + ((z0 + 1) & mask) * OCTAVE_SIZE;
+			for (int x = 0; x < period; ++x) {
+				const int x0 = (x >> magnify) & mask, x1 = (x0 + 1) & mask;
+				const float fx = (x & ((1 << magnify) - 1)) * scale;
+				const float h0 = src0[x0] + (src0[x1] - src0[x0]) * fx;
+				const float h1 = src1[x0] + (src1[x1] - src1[x0]) * fx;
+				row[x] += h0 + (h1 - h0) * fz;
+			}
+		}
+	}
+}
+
+void PerlinNoise::tileChanges(int period, int to) {
+	const int n = m_resolution;
+	for (int size = period; size < to; size *= 2) {
+		for (int z = 0; z < size; ++z) {
+			float *row = &m_changes[z * n];
+			std::copy(row, row + size, row + size);
+		}
+		for (int z = size; z < 2 * size; ++z) {
+			const float *src = &m_changes[(z - size) * n];
+			std::copy(src, src + 2 * size, &m_changes[z * n]);
+		}
+	}
+}
+
+void PerlinNoise::update(float time) {
+	m_time = time;
+	m_octave_updates = 0;
+	const bool rebuild = m_updates_to_rebuild <= 0;
+	if (rebuild) {
+		std::fill(m_heights.begin(), m_heights.end(), 0.f);
+		std::fill(m_octave_blended.begin(), m_octave_blended.end(), 0.f);
+		m_updates_to_rebuild = REBUILD_UPDATES;
+	}
+	--m_updates_to_rebuild;
+	const int n = m_resolution, texel_count = OCTAVE_SIZE * OCTAVE_SIZE;
+	// Of the changes summed so far, 0 while none. The octave k repeats every n / 2^k samples,
+	//	from the finest octave on each one's changes go to a corner as large as its period.
+	int period = 0;
+	for (int k = m_options.octaves - 1; k >= 0; --k) {
+		const int octave_period = n >> k;
+		if (period != 0) {
+			tileChanges(period, octave_period);
+			period = octave_period;
+		}
+		const double speed = m_options.speed * pow((double)m_options.speed_ratio, k);
+		const double octave_time = time * speed * TIME_STEPS;
+		if (!rebuild && octave_time == m_octave_times[k]) {
+			continue;
+		}
+		const long long step = (long long)floor(octave_time);
+		float *texels = &m_octave_texels[k * 2 * texel_count];
+		if (step == m_octave_steps[k] + 1) {
+			// Moved on by a step, the later one is kept
+			std::copy(texels + texel_count, texels + 2 * texel_count, texels);
+			generateOctave(k, step + 1, texels + texel_count);
+			++m_octave_updates;
+		} else if (step != m_octave_steps[k]) {
+			generateOctave(k, step, texels);
+			generateOctave(k, step + 1, texels + texel_count);
+			m_octave_updates += 2;
+		}
+		m_octave_steps[k] = step;
+		m_octave_times[k] = octave_time;
+
+		const float f = (float)(octave_time - step);
+		const float amplitude = m_options.amplitude * pow(m_options.persistence, (float)k);
+		float *blended = &m_octave_blended[k * texel_count];
+		for (int i = 0; i < texel_count; ++i) {
+			const float h = texels[i] + (texels[texel_count + i] - texels[i]) * f;
+			m_octave_delta[i] = amplitude * (h - blended[i]);
+			blended[i] = h;
+		}
+		addOctave(k, &m_octave_delta[0], period == 0);
+		period = octave_period;
+	}
+	if (period == 0) {
+		return;
+	}
+	tileChanges(period, n);
+	for (int i = 0; i < n * n; ++i) {
+		m_heights[i] += m_changes[i];
+	}
+	commit();
+}
@@ -2,18 +2,31 @@
 
 #include "ProjectedGrid.h"
 
-#include "gl/glew.h"
-#include "gl/glut.h"
-
 #include "Shape.h"
 #include "Camera.h"
 #include "Transform.h"
+#include "WorkerPool.h"
+#include "HeightField.h"
+#include "../../hxlib/include/Profiler.h"
+
+#include <cfloat>
+#include <chrono>
+#include <emmintrin.h>
 
 ProjectedGrid::ProjectedGrid(const Plane &base_plane, const Camera *camera, const ProjectedGridOptions &options)
-	: m_base_plane(base_plane), m_projecting_camera(NULL), m_rendering_camera(camera) {
-	// @hack: need to calculate the real bound
-	m_upper_bound_plane = base_plane;
-	m_lower_bound_plane = base_plane;
+	: m_projecting_camera(NULL), m_range_dirty(true), m_range_visible(false), m_range_intersections(0), m_rendering_camera(camera),
+	m_base_plane(base_plane), m_upper_height(0.f), m_lower_height(0.f), m_vertex_capacity(0), m_columns(0), m_rows(0),
+	m_worker_pool(NULL), m_height_field(NULL), m_generated_vertices(0), m_stats(NULL),
+	m_temporal_valid(false), m_refresh_row(0), m_refresh_cycle(0), m_refreshed_first(0), m_refreshed_rows(0),
+	m_temporal_displaced(false), m_filling_base(false), m_regenerated_rows(0) {
+	// With a unit normal, heights above the plane are plane distances
+	const float normal_length = glm::length(base_plane.getNormal());
+	m_base_plane = Plane(base_plane.a / normal_length, base_plane.b / normal_length, base_plane.c / normal_length, base_plane.d / normal_length);
+	m_plane_type = m_base_plane.a == 0.f && m_base_plane.c == 0.f ? GRID_PLANE_Y_UP : GRID_PLANE_GENERAL;
+	// Placed around the displaced surface by each getRangeMatrix
+	m_upper_bound_plane = m_base_plane;
+	m_lower_bound_plane = m_base_plane;
+	m_projecting_camera = new Camera(*camera);
 	setOptions(options);
 }
 
@@ -22,31 +35,84 @@ ProjectedGrid::~ProjectedGrid() {
 		delete m_projecting_camera;
 		m_projecting_camera = NULL;
 	}
+	if (m_worker_pool) {
+		delete m_worker_pool;
+		m_worker_pool = NULL;
+	}
+	if (m_stats) {
+		delete m_stats;
+		m_stats = NULL;
+	}
 }
 
 void ProjectedGrid::setOptions(const ProjectedGridOptions &options) {
 	m_options = options;
-	m_vertices.resize(options.sides * options.sides);
+	m_range_dirty = true;
+	if (m_options.sides < 2) {
+		fprintf(stderr, "Invalid grid resolution %d, using 2\n", m_options.sides);
+		m_options.sides = 2;
+	}
+	if (m_options.rows == 0) {
+		m_options.rows = m_options.sides;
+	} else if (m_options.rows < 2) {
+		fprintf(stderr, "Invalid grid row count %d, using 2\n", m_options.rows);
+		m_options.rows = 2;
+	}
+	const int columns = m_options.sides, rows = m_options.rows;
+	// Everything is sized for the largest resolution once, the adaptive mode only moves below it
+	m_vertex_capacity = columns * rows;
+	if (!m_vertices.empty()) {
+		m_vertices.resize(m_vertex_capacity);
+	}
+	m_row_v.resize(rows);
+	m_row_spacing.resize(rows);
+	m_row_spans.resize(rows * 2);
+	m_row_displace_ms.resize(rows);
+	if (m_options.temporal) {
+		m_fresh_row_v.resize(rows);
+		m_fresh_row_spacing.resize(rows);
+		m_fresh_row_spans.resize(rows * 2);
+	}
+	m_temporal_valid = false;
+	// A fixed resolution builds its indices once, at their exact size
+	if (m_options.adaptive) {
+		m_topology.reserve(columns, rows, m_options.topology);
+	}
+	m_row_kernel = getGridRowKernel(m_options.kernel, m_plane_type, columns);
+	if (m_options.adaptive) {
+		const int min_sides = std::max(m_options.min_sides, 2);
+		m_resolution.reset(std::min(min_sides, columns), columns, std::min(min_sides, rows), rows, m_options.budget_ms);
+	}
+	m_columns = columns;
+	m_rows = rows;
+	m_topology.update(columns, rows, m_options.topology);
+	// Only spawn the threads again when the count really changes
+	int threads = options.threads > 0 ? options.threads : WorkerPool::getHardwareThreadCount();
+	if (m_worker_pool && m_worker_pool->getThreadCount() != threads) {
+		delete m_worker_pool;
+		m_worker_pool = NULL;
+	}
+	if (!m_worker_pool && threads > 1) {
+		m_worker_pool = new WorkerPool(threads);
+	}
+	// The frames recorded so far stay, whatever the options
+	if (m_options.stats && !m_stats) {
+		m_stats = new GridStats();
+	} else if (!m_options.stats && m_stats) {
+		delete m_stats;
+		m_stats = NULL;
+	}
 }
 
-bool ProjectedGrid::getRangeMatrix(float water_max_height, float water_min_height, float projector_height_inc) {
-	glm::mat4 rendering_vp_mat = m_rendering_camera->getViewProjectionMatrix();
-	glm::mat4 rendering_vp_mat_inv = glm::inverse(rendering_vp_mat);
-	// Get the corners of the view frustum in world-space
+namespace {
+	// The corners of the view frustum in normalized device coordinates, as SoA
 	const unsigned NUM_FRUSTUM_PTS = 8;
-	glm::vec3 frustum_pts[NUM_FRUSTUM_PTS] = {
-		transformPoint(rendering_vp_mat_inv, glm::vec3(-1.f, -1.f, 0.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(+1.f, -1.f, 0.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(-1.f, +1.f, 0.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(+1.f, +1.f, 0.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(-1.f, -1.f, 1.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(+1.f, -1.f, 1.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(-1.f, +1.f, 1.f)),
-		transformPoint(rendering_vp_mat_inv, glm::vec3(+1.f, +1.f, 1.f))
-	};
+	const float NDC_FRUSTUM_X[NUM_FRUSTUM_PTS] = {-1.f, +1.f, -1.f, +1.f, -1.f, +1.f, -1.f, +1.f};
+	const float NDC_FRUSTUM_Y[NUM_FRUSTUM_PTS] = {-1.f, -1.f, +1.f, +1.f, -1.f, -1.f, +1.f, +1.f};
+	const float NDC_FRUSTUM_Z[NUM_FRUSTUM_PTS] = {0.f, 0.f, 0.f, 0.f, 1.f, 1.f, 1.f, 1.f};
 	// The edges of the frustum
 	const unsigned NUM_EDGES = 12;
-	const int edges[NUM_EDGES * 2] = {
+	const int FRUSTUM_EDGES[NUM_EDGES * 2] = {
 		// Near
 		0, 1,
 		1, 3,
@@ -63,109 +129,305 @@ bool ProjectedGrid::getRangeMatrix(float water_max_height, float water_min_heigh
 		7, 6,
 		6, 4
 	};
-	// Get the intersections between the frustum and the two bound planes, visible parts
-	std::vector<glm::vec3> intersections;
-	for (int ei = 0; ei < NUM_EDGES; ++ei) {
-		int src = edges[ei * 2];
-		int tar = edges[ei * 2 + 1];
-		const glm::vec3 &src_v = frustum_pts[src];
-		const glm::vec3 &tar_v = frustum_pts[tar];
-		Line line(src_v, tar_v);
-		if ((m_upper_bound_plane.a*src_v.x + m_upper_bound_plane.b*src_v.y + m_upper_bound_plane.c*src_v.z + m_upper_bound_plane.d)
-			/(m_upper_bound_plane.a*tar_v.x + m_upper_bound_plane.b*tar_v.y + m_upper_bound_plane.c*tar_v.z + m_upper_bound_plane.d) < 0.f) {
-				intersections.push_back(intersection(line, m_upper_bound_plane));
-		}
-		if ((m_lower_bound_plane.a*src_v.x + m_lower_bound_plane.b*src_v.y + m_lower_bound_plane.c*src_v.z + m_lower_bound_plane.d)
-			/(m_lower_bound_plane.a*tar_v.x + m_lower_bound_plane.b*tar_v.y + m_lower_bound_plane.c*tar_v.z + m_lower_bound_plane.d) < 0.f) {
-				intersections.push_back(intersection(line, m_lower_bound_plane));
+
+	// How far outside the slab a point may be and still count as inside it, in world units
+	const float SLAB_EPSILON = 1e-5f;
+	// Most columns and rows of the vertices measured for the stats
+	const int STATS_LATTICE = 64;
+
+	inline double getMilliseconds() {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	inline __m128 planeDotCoord4(const Plane &p, __m128 x, __m128 y, __m128 z) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.a), x), _mm_mul_ps(_mm_set1_ps(p.b), y)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.c), z), _mm_set1_ps(p.d)));
+	}
+
+	// x/y span in projector space of 4 cameras, one per lane
+	struct RangeBounds4 {
+		__m128 x_min, y_min, x_max, y_max;
+		__m128 found;	// lanes which got at least one point
+	};
+
+	// Project the points onto the base plane, whose normal is a unit one, then into the
+	//	projector's projection space, and grow the bounds of the lanes in `mask'
+	inline void addPoints4(RangeBounds4 &bounds, const __m128 projector[16], const Plane &base_plane,
+		__m128 x, __m128 y, __m128 z, __m128 mask) {
+		const __m128 na = _mm_set1_ps(base_plane.a), nb = _mm_set1_ps(base_plane.b), nc = _mm_set1_ps(base_plane.c);
+		const __m128 dist = planeDotCoord4(base_plane, x, y, z);
+		x = _mm_sub_ps(x, _mm_mul_ps(na, dist));
+		y = _mm_sub_ps(y, _mm_mul_ps(nb, dist));
+		z = _mm_sub_ps(z, _mm_mul_ps(nc, dist));
+		// Column-major, as glm
+		const __m128 px = _mm_add_ps(_mm_add_ps(_mm_mul_ps(projector[0], x), _mm_mul_ps(projector[4], y)), _mm_add_ps(_mm_mul_ps(projector[8], z), projector[12]));
+		const __m128 py = _mm_add_ps(_mm_add_ps(_mm_mul_ps(projector[1], x), _mm_mul_ps(projector[5], y)), _mm_add_ps(_mm_mul_ps(projector[9], z), projector[13]));
+		const __m128 pw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(projector[3], x), _mm_mul_ps(projector[7], y)), _mm_add_ps(_mm_mul_ps(projector[11], z), projector[15]));
+		const __m128 sx = _mm_div_ps(px, pw), sy = _mm_div_ps(py, pw);
+		bounds.x_min = select4(mask, _mm_min_ps(bounds.x_min, sx), bounds.x_min);
+		bounds.y_min = select4(mask, _mm_min_ps(bounds.y_min, sy), bounds.y_min);
+		bounds.x_max = select4(mask, _mm_max_ps(bounds.x_max, sx), bounds.x_max);
+		bounds.y_max = select4(mask, _mm_max_ps(bounds.y_max, sy), bounds.y_max);
+		bounds.found = _mm_or_ps(bounds.found, mask);
+	}
+
+	// The homogeneous intersection of the projector ray through (u, v) with the plane (Appendix
+	//	B): the plane's equation is linear in homogeneous coordinates, so the points interpolated
+	//	between such corners stay on the plane
+	glm::vec4 getRangeCorner4(const glm::mat4 &range_matrix, const Plane &plane, GridPlaneType plane_type, float u, float v) {
+		glm::vec4 origin(u, v, -1.f, 1.f);
+		glm::vec4 direction(u, v, 1.f, 1.f);
+
+		origin = transformPoint(range_matrix, origin);
+		direction = transformPoint(range_matrix, direction);
+
+		direction -= origin;
+		const glm::vec4 plane4(plane.a, plane.b, plane.c, plane.d);
+		float l = -glm::dot(plane4, origin) / glm::dot(plane4, direction);
+		glm::vec4 worldPos = origin + direction * l;
+		// Exactly on a horizontal plane, its kernels take y of the whole row from the corners
+		if (plane_type == GRID_PLANE_Y_UP) {
+			worldPos.y = -plane.d / plane.b * worldPos.w;
 		}
+		return worldPos;
+	}
+}
+
+void ProjectedGrid::updateBoundPlanes(float water_max_height, float water_min_height) {
+	m_upper_height = water_max_height;
+	m_lower_height = water_min_height;
+	// The field is only scaled by the strength, so its range bounds the surface exactly
+	if (m_height_field) {
+		m_upper_height = m_height_field->getMaxHeight() * m_options.strength;
+		m_lower_height = m_height_field->getMinHeight() * m_options.strength;
 	}
-	for (int i = 0; i < 8; ++i) {
-		const glm::vec3 &p = frustum_pts[i];
-		if ((m_upper_bound_plane.a*p.x + m_upper_bound_plane.b*p.y + m_upper_bound_plane.c*p.z + m_upper_bound_plane.d)
-			/(m_lower_bound_plane.a*p.x + m_lower_bound_plane.b*p.y + m_lower_bound_plane.c*p.z + m_lower_bound_plane.d) < 0.f) {
-				intersections.push_back(p);
+	// Moving a plane by h along its unit normal moves d by -h * |n|
+	const float normal_length = glm::length(m_base_plane.getNormal());
+	m_upper_bound_plane = m_base_plane;
+	m_upper_bound_plane.d -= m_upper_height * normal_length;
+	m_lower_bound_plane = m_base_plane;
+	m_lower_bound_plane.d -= m_lower_height * normal_length;
+}
+
+bool ProjectedGrid::getRangeMatrix(float water_max_height, float water_min_height, float projector_height_inc) {
+	PROFILE_ZONE("ProjectedGrid::getRangeMatrix");
+	const double start_ms = m_stats ? getMilliseconds() : 0.0;
+	applyResolution();
+	updateBoundPlanes(water_max_height, water_min_height);
+	glm::mat4 rendering_vp_mat = m_rendering_camera->getViewProjectionMatrix();
+	// The view-projection matrix holds both the pose and the projection of the camera
+	RangeInputs inputs;
+	inputs.view_proj = rendering_vp_mat;
+	inputs.upper_height = m_upper_height;
+	inputs.lower_height = m_lower_height;
+	inputs.projector_height_inc = projector_height_inc;
+	inputs.strength = m_options.strength;
+	inputs.elevation = m_options.elevation;
+	if (!m_range_dirty && memcmp(&inputs, &m_range_inputs, sizeof(inputs)) == 0) {
+		endRange(start_ms, true, m_range_visible, m_range_intersections);
+		return m_range_visible;
+	}
+	m_range_inputs = inputs;
+	m_range_dirty = false;
+
+	getRangeMatrices4(&m_rendering_camera, 1, &m_range_matrix, &m_range_visible, &m_range_intersections);
+	endRange(start_ms, false, m_range_visible, m_range_intersections);
+	return m_range_visible;
+}
+
+int ProjectedGrid::getRangeMatrices(ProjectedGridView *views, int count, float water_max_height, float water_min_height, float projector_height_inc) {
+	PROFILE_ZONE("ProjectedGrid::getRangeMatrices");
+	const double start_ms = m_stats ? getMilliseconds() : 0.0;
+	applyResolution();
+	updateBoundPlanes(water_max_height, water_min_height);
+	int visible_num = 0, intersection_num = 0;
+	for (int first = 0; first < count; first += 4) {
+		const int batch = std::min(count - first, 4);
+		const Camera *cameras[4];
+		glm::mat4 range_matrices[4];
+		bool visible[4];
+		int intersections[4];
+		for (int i = 0; i < batch; ++i) {
+			cameras[i] = views[first + i].camera;
+		}
+		getRangeMatrices4(cameras, batch, range_matrices, visible, m_stats ? intersections : NULL);
+		for (int i = 0; i < batch; ++i) {
+			ProjectedGridView &view = views[first + i];
+			view.visible = visible[i];
+			intersection_num += m_stats ? intersections[i] : 0;
+			if (visible[i]) {
+				view.range_matrix = range_matrices[i];
+				++visible_num;
+			}
 		}
 	}
+	endRange(start_ms, false, visible_num > 0, intersection_num);
+	return visible_num;
+}
 
-	if (intersections.empty()) {
-		puts("No intersections!");
-		return false;
+void ProjectedGrid::aimProjector(const Camera &camera) {
+	const glm::vec3 plane_normal = m_base_plane.getNormal();
+	const glm::vec3 cam_pos = camera.getPosition();
+	const glm::vec3 cam_dir = camera.getDirection();
+	// Set the projector
+	glm::vec3 projector_pos = cam_pos;
+	float height_in_plane = planeDotCoord(m_base_plane, cam_pos);
+	// The projector stays above the upper bound plane
+	float height_bound = std::max(m_upper_height, 0.f) + m_options.elevation;
+	bool under_water = height_in_plane < 0.f;
+	// If the camera is too close to the upper plane or too low
+	if (height_in_plane < height_bound) {
+		if (under_water) {
+			// Reflected the position
+			projector_pos += plane_normal * (height_bound - 2 * height_in_plane);
+		} else {
+			// Move the position upwards
+			projector_pos += plane_normal * (height_bound - height_in_plane);
+		}
+	}
+	glm::vec3 aim_point0, aim_point1;
+	// If the camera is aimed away from the plane or located on the plane, simply mirror it's
+	//	view-vector against the plane
+	if (planeDotCoord(m_base_plane, cam_pos) > 0.f && planeDotNormal(m_base_plane, cam_dir) > 0.f) {
+		glm::vec3 flipped_dir = cam_dir - 2.f * plane_normal * glm::dot(plane_normal, cam_dir);
+		aim_point0 = intersection(Line(cam_pos, cam_pos + flipped_dir), m_base_plane);
 	} else {
-		const glm::vec3 plane_normal = m_base_plane.getNormal();
-		const glm::vec3 cam_pos = m_rendering_camera->getPosition();
-		const glm::vec3 cam_dir = m_rendering_camera->getDirection();
-		// Set the projector
-		glm::vec3 projector_pos = cam_pos;
-		float height_in_plane = distance(cam_pos, m_base_plane);
-		float height_bound = m_options.strength + m_options.elevation;
-		bool under_water = height_in_plane < 0.f;
-		// If the camera is too close to the upper plane or too low
-		if (height_in_plane < height_bound) {
-			if (under_water) {
-				// Reflected the position
-				projector_pos += plane_normal * (height_bound - 2 * height_in_plane);
-			} else {
-				// Move the position upwards
-				projector_pos += plane_normal * (height_bound - height_in_plane);
+		aim_point0 = intersection(Line(cam_pos, cam_pos + cam_dir), m_base_plane);
+	}
+	// If there's no intersections between the camera's view-vector and the plane,
+	//	hack the target vertices
+	if (abs(planeDotNormal(m_base_plane, cam_dir)) <= 1e-6) {
+		aim_point0 = cam_pos + cam_dir;
+	}
+	aim_point1 = cam_pos + 10.f * cam_dir;
+	aim_point1 = aim_point1 - plane_normal * planeDotCoord(m_base_plane, aim_point1);
+	float af = fabs(glm::dot(plane_normal, cam_dir));
+	// Fade between aim_point0 & aim_point1 depending on view angle
+	glm::vec3 projector_tar = aim_point0 * af + aim_point1 * (1.f - af);
+	// Inherit the projection, plain assignment copies the matrices instead of inverting them
+	*m_projecting_camera = camera;
+	m_projecting_camera->setPosition(projector_pos);
+	m_projecting_camera->setDirection(projector_tar - projector_pos);
+}
+
+void ProjectedGrid::getRangeMatrices4(const Camera *const *cameras, int count, glm::mat4 *range_matrices, bool *visible, int *intersections) {
+	// Per camera: the corners of its view frustum in world-space and its projector, laid out
+	//	one camera per SIMD lane. The unused lanes repeat the last camera.
+	float frustum_pts[NUM_FRUSTUM_PTS][3][4];
+	float projector_soa[16][4];
+	glm::mat4 projector_view_proj_mats[4], projector_view_proj_mats_inv[4];
+	for (int lane = 0; lane < 4; ++lane) {
+		const Camera &camera = *cameras[std::min(lane, count - 1)];
+		if (lane >= count) {
+			for (int k = 0; k < 16; ++k) projector_soa[k][lane] = projector_soa[k][lane - 1];
+			for (int i = 0; i < NUM_FRUSTUM_PTS; ++i) {
+				for (int c = 0; c < 3; ++c) frustum_pts[i][c][lane] = frustum_pts[i][c][lane - 1];
 			}
+			continue;
+		}
+		float corner_x[NUM_FRUSTUM_PTS], corner_y[NUM_FRUSTUM_PTS], corner_z[NUM_FRUSTUM_PTS];
+		transformPoints(camera.getInverseViewProjectionMatrix(), NDC_FRUSTUM_X, NDC_FRUSTUM_Y, NDC_FRUSTUM_Z,
+			corner_x, corner_y, corner_z, NUM_FRUSTUM_PTS);
+		for (int i = 0; i < NUM_FRUSTUM_PTS; ++i) {
+			frustum_pts[i][0][lane] = corner_x[i];
+			frustum_pts[i][1][lane] = corner_y[i];
+			frustum_pts[i][2][lane] = corner_z[i];
 		}
-		glm::vec3 aim_point0, aim_point1;
-		// If the camera is aimed away from the plane or located on the plane, simply mirror it's
-		//	view-vector against the plane
-		if (planeDotCoord(m_base_plane, cam_pos) > 0.f && planeDotNormal(m_base_plane, cam_dir) > 0.f) {
-			glm::vec3 flipped_dir = cam_dir - 2.f * plane_normal * glm::dot(plane_normal, cam_dir);
-			aim_point0 = intersection(Line(cam_pos, cam_pos + flipped_dir), m_base_plane);
-		} else {
-			aim_point0 = intersection(Line(cam_pos, cam_pos + cam_dir), m_base_plane);
-		}
-		// If there's no intersections between the camera's view-vector and the plane,
-		//	hack the target vertices
-		if (abs(planeDotNormal(m_base_plane, cam_dir)) <= 1e-6) {
-			aim_point0 = cam_pos + cam_dir;
-		}
-		aim_point1 = cam_pos + 10.f * cam_dir;
-		aim_point1 = aim_point1 - plane_normal * glm::dot(aim_point1, plane_normal);
-		float af = fabs(glm::dot(plane_normal, cam_dir));
-		// Fade between aim_point0 & aim_point1 depending on view angle
-		glm::vec3 projector_tar = aim_point0 * af + aim_point1 * (1.f - af);
-		if (m_projecting_camera) {
-			delete m_projecting_camera;
-			m_projecting_camera = NULL;
-		}
-		m_projecting_camera = new Camera(*m_rendering_camera);
-		m_projecting_camera->setPosition(projector_pos);
-		m_projecting_camera->setDirection(projector_tar - projector_pos);
-		///////////////////////////////////////////////////
 		// Compute the projector's view projection matrix
-		glm::mat4 projector_view_proj_mat = m_projecting_camera->getViewProjectionMatrix();
-		// @todo: need definition of 'infinity'
-		float x_min = 1e20, y_min = 1e20, x_max = -1e20, y_max = -1e20;
-		// Project all the intersections to the base plane
-		for (int i = 0; i < intersections.size(); ++i) {
-			intersections[i] -= plane_normal * distance(intersections[i], m_base_plane);
-		}
-		// Transform all the intersections form world-space to projector's projection-space
-		for (int i = 0; i < intersections.size(); ++i) {
-			intersections[i] = transformPoint(projector_view_proj_mat, intersections[i]);
-			const glm::vec3 &p = intersections[i];
-			x_min = std::min(x_min, p.x);
-			y_min = std::min(y_min, p.y);
-			x_max = std::max(x_max, p.x);
-			y_max = std::max(y_max, p.y);
-		}
-		//printf("x:[%f %f], y:[%f %f]\n", x_min, x_max, y_min, y_max);
-
-		glm::mat4 projector_view_proj_mat_inv = glm::inverse(projector_view_proj_mat);
-
-		glm::mat4 pack(x_max - x_min,				0,	0,	x_min,
-									0,	y_max - y_min,	0,	y_min,
+		aimProjector(camera);
+		projector_view_proj_mats[lane] = m_projecting_camera->getViewProjectionMatrix();
+		projector_view_proj_mats_inv[lane] = m_projecting_camera->getInverseViewProjectionMatrix();
+		const float *m = glm::value_ptr(projector_view_proj_mats[lane]);
+		for (int k = 0; k < 16; ++k) {
+			projector_soa[k][lane] = m[k];
+		}
+	}
+	__m128 projector[16];
+	for (int k = 0; k < 16; ++k) {
+		projector[k] = _mm_loadu_ps(projector_soa[k]);
+	}
+	__m128 px[NUM_FRUSTUM_PTS], py[NUM_FRUSTUM_PTS], pz[NUM_FRUSTUM_PTS];
+	__m128 upper[NUM_FRUSTUM_PTS], lower[NUM_FRUSTUM_PTS];
+	for (int i = 0; i < NUM_FRUSTUM_PTS; ++i) {
+		px[i] = _mm_loadu_ps(frustum_pts[i][0]);
+		py[i] = _mm_loadu_ps(frustum_pts[i][1]);
+		pz[i] = _mm_loadu_ps(frustum_pts[i][2]);
+		upper[i] = planeDotCoord4(m_upper_bound_plane, px[i], py[i], pz[i]);
+		lower[i] = planeDotCoord4(m_lower_bound_plane, px[i], py[i], pz[i]);
+	}
+
+	// V_visible, the frustum clipped by the slab between the bound planes, is convex: its
+	//	vertices are the ends of the frustum edges clipped by the slab. Each edge is clipped
+	//	as a segment p(t), t in [0, 1] (Liang-Barsky), on all the lanes at once. An edge
+	//	parallel to the planes is kept or dropped whole, and points on a plane are inside.
+	RangeBounds4 bounds;
+	bounds.x_min = bounds.y_min = _mm_set1_ps(FLT_MAX);
+	bounds.x_max = bounds.y_max = _mm_set1_ps(-FLT_MAX);
+	bounds.found = _mm_setzero_ps();
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+	const __m128 epsilon = _mm_set1_ps(SLAB_EPSILON);
+	int edge_lanes[NUM_EDGES] = {0};	// lanes in which each edge was kept, for the stats
+	for (int ei = 0; ei < NUM_EDGES; ++ei) {
+		const int src = FRUSTUM_EDGES[ei * 2];
+		const int tar = FRUSTUM_EDGES[ei * 2 + 1];
+		__m128 t0 = zero, t1 = one;
+		__m128 empty = zero;
+		// Inside is below the upper plane and above the lower one: side * distance >= -epsilon
+		const __m128 *distances[2] = {upper, lower};
+		const __m128 sides[2] = {_mm_set1_ps(-1.f), one};
+		for (int pi = 0; pi < 2; ++pi) {
+			const __m128 a = _mm_add_ps(_mm_mul_ps(sides[pi], distances[pi][src]), epsilon);
+			const __m128 b = _mm_mul_ps(sides[pi], _mm_sub_ps(distances[pi][tar], distances[pi][src]));
+			// a + b * t >= 0
+			const __m128 entering = _mm_cmpgt_ps(b, zero), leaving = _mm_cmplt_ps(b, zero);
+			const __m128 parallel = _mm_andnot_ps(_mm_or_ps(entering, leaving), _mm_cmpeq_ps(zero, zero));
+			const __m128 t = _mm_div_ps(_mm_sub_ps(zero, a), select4(parallel, one, b));
+			t0 = select4(entering, _mm_max_ps(t0, t), t0);
+			t1 = select4(leaving, _mm_min_ps(t1, t), t1);
+			empty = _mm_or_ps(empty, _mm_and_ps(parallel, _mm_cmplt_ps(a, zero)));
+		}
+		const __m128 clipped = _mm_andnot_ps(empty, _mm_cmple_ps(t0, t1));
+		const int clipped_lanes = _mm_movemask_ps(clipped);
+		if (clipped_lanes == 0) {
+			continue;
+		}
+		edge_lanes[ei] = clipped_lanes;
+		const __m128 dx = _mm_sub_ps(px[tar], px[src]), dy = _mm_sub_ps(py[tar], py[src]), dz = _mm_sub_ps(pz[tar], pz[src]);
+		addPoints4(bounds, projector, m_base_plane, _mm_add_ps(px[src], _mm_mul_ps(dx, t0)),
+			_mm_add_ps(py[src], _mm_mul_ps(dy, t0)), _mm_add_ps(pz[src], _mm_mul_ps(dz, t0)), clipped);
+		addPoints4(bounds, projector, m_base_plane, _mm_add_ps(px[src], _mm_mul_ps(dx, t1)),
+			_mm_add_ps(py[src], _mm_mul_ps(dy, t1)), _mm_add_ps(pz[src], _mm_mul_ps(dz, t1)), clipped);
+	}
+
+	float x_min[4], y_min[4], x_max[4], y_max[4];
+	_mm_storeu_ps(x_min, bounds.x_min);
+	_mm_storeu_ps(y_min, bounds.y_min);
+	_mm_storeu_ps(x_max, bounds.x_max);
+	_mm_storeu_ps(y_max, bounds.y_max);
+	const int found = _mm_movemask_ps(bounds.found);
+	if (intersections) {
+		for (int lane = 0; lane < count; ++lane) {
+			intersections[lane] = 0;
+			for (int ei = 0; ei < NUM_EDGES; ++ei) {
+				intersections[lane] += (edge_lanes[ei] >> lane) & 1 ? 2 : 0;
+			}
+		}
+	}
+	for (int lane = 0; lane < count; ++lane) {
+		visible[lane] = (found & (1 << lane)) != 0;
+		if (!visible[lane]) {
+			continue;
+		}
+		glm::mat4 pack(x_max[lane] - x_min[lane],	0,	0,	x_min[lane],
+									0,	y_max[lane] - y_min[lane],	0,	y_min[lane],
 									0,				0,	1,		0,
 									0,				0,	0,		1);
 		pack = glm::transpose(pack);
-		m_range_matrix = projector_view_proj_mat_inv * pack;
-
-		return true;
+		range_matrices[lane] = projector_view_proj_mats_inv[lane] * pack;
 	}
 }
 
@@ -176,85 +438,804 @@ glm::vec3 ProjectedGrid::getCorner(float u, float v) {
 }
 
 glm::vec4 ProjectedGrid::getCorner4(float u, float v) {
-	// this is hacky.. this does take care of the homogenous coordinates in a correct way, 
-	// but only when the plane lies at y=0
-	glm::vec4 origin(u, v, -1.f, 1.f);
-	glm::vec4 direction(u, v, 1.f, 1.f);
+	return getRangeCorner4(m_range_matrix, m_base_plane, m_plane_type, u, v);
+}
 
-	origin = transformPoint(m_range_matrix, origin);
-	direction = transformPoint(m_range_matrix, direction);
+#define INTERPOLATE_VERSION_1
 
-	direction -= origin;
-	float l = -origin.y / direction.y;	// assumes the plane is y=0
-	glm::vec4 worldPos = origin + direction * l;
-	return worldPos;
+namespace {
+	// Homogeneous grid point to pixels from the center of a width x height screen
+	inline glm::vec2 projectToScreen(const glm::vec4 &p, const glm::mat4 &view_proj, float width, float height) {
+		glm::vec4 clip = view_proj * glm::vec4(glm::vec3(p) / p.w, 1.f);
+		const float w = std::max(clip.w, 1e-6f);
+		return glm::vec2(clip.x / w * 0.5f * width, clip.y / w * 0.5f * height);
+	}
 }
 
-#define INTERPOLATE_VERSION_1
+void ProjectedGrid::parameterizeRows(const glm::vec4 *corners, const glm::mat4 &view_proj, float width, float height, float *row_v, float *row_spacing) const {
+	const int rows = m_rows;
+	// The middle column, homogeneous as the corners
+	const glm::vec4 near_mid = (corners[0] + corners[1]) * 0.5f;
+	const glm::vec4 far_mid = (corners[2] + corners[3]) * 0.5f;
+
+	if (m_options.warp_rows) {
+		// How far along the screen each v of a table is, then the v of the rows at even
+		//	distances from it. The rows stay lines in homogeneous space, only their v changes.
+		const int TABLE_SIZE = 64;
+		float distances[TABLE_SIZE + 1];
+		glm::vec2 previous = projectToScreen(near_mid, view_proj, width, height);
+		distances[0] = 0.f;
+		for (int k = 1; k <= TABLE_SIZE; ++k) {
+			const float v = (float)k / TABLE_SIZE;
+			const glm::vec2 screen = projectToScreen((1.f - v) * near_mid + v * far_mid, view_proj, width, height);
+			distances[k] = distances[k - 1] + glm::length(screen - previous);
+			previous = screen;
+		}
+		const float total = distances[TABLE_SIZE];
+		int k = 0;
+		for (int iv = 0; iv < rows; ++iv) {
+			const float target = total * (float)iv / (float)(rows - 1);
+			while (k < TABLE_SIZE - 1 && distances[k + 1] < target) {
+				++k;
+			}
+			const float span = distances[k + 1] - distances[k];
+			const float t = span > 0.f ? std::min(std::max((target - distances[k]) / span, 0.f), 1.f) : 0.f;
+			row_v[iv] = total > 0.f ? ((float)k + t) / TABLE_SIZE : (float)iv / (float)(rows - 1);
+		}
+		row_v[rows - 1] = 1.f;
+	} else {
+		for (int iv = 0; iv < rows; ++iv) {
+			row_v[iv] = (float)iv / (float)(rows - 1);
+		}
+	}
+
+	glm::vec2 previous = projectToScreen(near_mid, view_proj, width, height);
+	for (int iv = 1; iv < rows; ++iv) {
+		const float v = row_v[iv];
+		const glm::vec2 screen = projectToScreen((1.f - v) * near_mid + v * far_mid, view_proj, width, height);
+		row_spacing[iv] = glm::length(screen - previous);
+		previous = screen;
+	}
+	row_spacing[0] = row_spacing[1];
+}
+
+int ProjectedGrid::cullRows(const glm::vec4 *corners, const float *row_v, const glm::mat4 &view_proj, int *row_spans) const {
+	const int columns = m_columns, rows = m_rows;
+	if (!m_options.cull_rows) {
+		for (int iv = 0; iv < rows; ++iv) {
+			row_spans[iv * 2] = 0;
+			row_spans[iv * 2 + 1] = columns;
+		}
+		return columns * rows;
+	}
+	// How far a displaced vertex may get from its place on the base plane
+	float margin = std::max(fabs(m_upper_height), fabs(m_lower_height)) + m_options.cull_margin;
+	if (m_height_field) {
+		margin += m_height_field->getMaxHorizontalDisplacement() * m_options.strength;
+	}
+	// The frustum planes in world space, as rows of the view-projection: n . (x, y, z, 1) >= 0
+	//	inside. A grid point is homogeneous, (x, y, z, w) standing for (x, y, z) / w, so along
+	//	a row n . p is linear in the column, and so is the margin m * w once scaled by w.
+	const glm::mat4 vp = glm::transpose(view_proj);
+	glm::vec4 planes[6] = {vp[3] + vp[0], vp[3] - vp[0], vp[3] + vp[1], vp[3] - vp[1], vp[3] + vp[2], vp[3] - vp[2]};
+	float margins[6];
+	for (int k = 0; k < 6; ++k) {
+		margins[k] = glm::length(glm::vec3(planes[k])) * margin;
+	}
+	// Along the rows, a row's start and step are linear in its v, and so are the a and b of
+	//	each plane below: only their values at v = 0 and v = 1 are needed
+	const float du = 1.f / (float)(columns - 1);
+	float a0[6], a1[6], b0[6], b1[6];
+	for (int k = 0; k < 6; ++k) {
+		const glm::vec4 n(glm::vec3(planes[k]), planes[k].w + margins[k]);
+		a0[k] = glm::dot(n, corners[0]);
+		a1[k] = glm::dot(n, corners[2]);
+		b0[k] = glm::dot(n, corners[1] - corners[0]) * du;
+		b1[k] = glm::dot(n, corners[3] - corners[2]) * du;
+	}
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f), last = _mm_set1_ps((float)(columns - 1));
+	const __m128 sign_bit = _mm_set1_ps(-0.f);
+	// 4 rows at a time, one per lane
+	for (int first = 0; first < rows; first += 4) {
+		float vs[4];
+		for (int lane = 0; lane < 4; ++lane) {
+			vs[lane] = row_v[std::min(first + lane, rows - 1)];
+		}
+		const __m128 v = _mm_loadu_ps(vs), rv = _mm_sub_ps(one, v);
+		// w keeps its sign along a row of the range, flip the rows where it's negative
+		const __m128 w = _mm_add_ps(_mm_mul_ps(rv, _mm_set1_ps(corners[0].w)), _mm_mul_ps(v, _mm_set1_ps(corners[2].w)));
+		const __m128 flip = _mm_and_ps(w, sign_bit);
+		// Columns s in [s0, s1] with a + b * s >= 0 for every plane (Liang-Barsky)
+		__m128 s0 = zero, s1 = last, empty = zero;
+		for (int k = 0; k < 6; ++k) {
+			const __m128 a = _mm_xor_ps(flip, _mm_add_ps(_mm_mul_ps(rv, _mm_set1_ps(a0[k])), _mm_mul_ps(v, _mm_set1_ps(a1[k]))));
+			const __m128 b = _mm_xor_ps(flip, _mm_add_ps(_mm_mul_ps(rv, _mm_set1_ps(b0[k])), _mm_mul_ps(v, _mm_set1_ps(b1[k]))));
+			const __m128 entering = _mm_cmpgt_ps(b, zero), leaving = _mm_cmplt_ps(b, zero);
+			const __m128 parallel = _mm_andnot_ps(_mm_or_ps(entering, leaving), _mm_cmpeq_ps(zero, zero));
+			const __m128 s = _mm_div_ps(_mm_sub_ps(zero, a), select4(parallel, one, b));
+			s0 = select4(entering, _mm_max_ps(s0, s), s0);
+			s1 = select4(leaving, _mm_min_ps(s1, s), s1);
+			empty = _mm_or_ps(empty, _mm_and_ps(parallel, _mm_cmplt_ps(a, zero)));
+		}
+		// s0 and s1 are >= 0, so truncating is flooring
+		const __m128i begin = _mm_cvttps_epi32(s0);
+		const __m128i last_in = _mm_cvttps_epi32(s1);
+		// One past ceil(s1): the column after s1 is needed too unless s1 is a column itself
+		const __m128i after = _mm_sub_epi32(_mm_add_epi32(last_in, _mm_set1_epi32(1)),
+			_mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(last_in), s1)));
+		int begins[4], ends[4];
+		_mm_storeu_si128((__m128i*)begins, begin);
+		_mm_storeu_si128((__m128i*)ends, after);
+		const int empty_mask = _mm_movemask_ps(_mm_or_ps(empty, _mm_cmpgt_ps(s0, s1)));
+		for (int lane = 0; lane < 4 && first + lane < rows; ++lane) {
+			int *span = &row_spans[(first + lane) * 2];
+			if (empty_mask & (1 << lane)) {
+				span[0] = span[1] = 0;
+			} else {
+				span[0] = begins[lane];
+				span[1] = std::min(ends[lane], columns);
+			}
+		}
+	}
+	// A quad shows as soon as one of its rows does: each row also takes its neighbours' spans
+	int previous_begin = columns, previous_end = 0;
+	int vertices = 0;
+	for (int iv = 0; iv < rows; ++iv) {
+		int begin = row_spans[iv * 2], end = row_spans[iv * 2 + 1];
+		const int own_begin = begin, own_end = end;
+		if (previous_begin < previous_end) {
+			begin = begin < end ? std::min(begin, previous_begin) : previous_begin;
+			end = std::max(end, previous_end);
+		}
+		if (iv + 1 < rows && row_spans[iv * 2 + 2] < row_spans[iv * 2 + 3]) {
+			begin = begin < end ? std::min(begin, row_spans[iv * 2 + 2]) : row_spans[iv * 2 + 2];
+			end = std::max(end, row_spans[iv * 2 + 3]);
+		}
+		previous_begin = own_begin;
+		previous_end = own_end;
+		row_spans[iv * 2] = begin;
+		row_spans[iv * 2 + 1] = end;
+		vertices += end - begin;
+	}
+	return vertices;
+}
+
+int ProjectedGrid::getDrawRanges(int *firsts, int *counts, int view) const {
+	const int *spans = &m_row_spans[view * m_rows * 2];
+	int count = 0;
+	if (m_topology.getType() == GRID_TOPOLOGY_POINTS) {
+		for (int iv = 0; iv < m_rows; ++iv) {
+			if (spans[iv * 2] < spans[iv * 2 + 1]) {
+				firsts[count] = iv * m_columns + spans[iv * 2];
+				counts[count] = spans[iv * 2 + 1] - spans[iv * 2];
+				++count;
+			}
+		}
+		return count;
+	}
+	const int stripes = m_topology.getStripeCount();
+	for (int stripe = 0; stripe < stripes; ++stripe) {
+		for (int iv = 0; iv < m_rows - 1; ++iv) {
+			// The quads with both their rows generated
+			const int quad_begin = std::max(spans[iv * 2], spans[iv * 2 + 2]);
+			const int quad_end = std::min(spans[iv * 2 + 1], spans[iv * 2 + 3]) - 1;
+			if (m_topology.getQuadRange(stripe, iv, quad_begin, quad_end, firsts[count], counts[count])) {
+				++count;
+			}
+		}
+	}
+	return count;
+}
+
+void ProjectedGrid::generateRows(const glm::vec4 *corners, const float *row_v, const int *row_spans, int first_vertex, int row_begin, int row_end,
+	float *row_displace_ms) {
+	if (m_sink.hasAttributes()) {
+		generateFusedRows(corners, row_v, row_spans, first_vertex, row_begin, row_end, row_displace_ms);
+		return;
+	}
+	const int columns = m_columns;
+	float du = 1.f / (float)(columns - 1);
+	// Each row is a line in homogeneous space, so only its start point and the step
+	//	between two neighbouring vertices are needed, the row kernel does the rest
+	for (int iv = row_begin; iv < row_end; ++iv) {
+		const int begin = row_spans[iv * 2], end = row_spans[iv * 2 + 1];
+		if (row_displace_ms) {
+			row_displace_ms[iv] = 0.f;
+		}
+		if (begin >= end) {
+			continue;
+		}
+		float v = row_v[iv];
+		glm::vec4 row_start = (1.0f-v)*corners[0] + v*corners[2];
+		glm::vec4 row_end = (1.0f-v)*corners[1] + v*corners[3];
+		glm::vec4 row_step = (row_end - row_start) * du;
+		const int first = first_vertex + iv * columns + begin;
+		m_row_kernel(row_start + row_step * (float)begin, row_step, end - begin, m_sink, first);
+		if (row_displace_ms) {
+			const double start_ms = getMilliseconds();
+			displaceVertices(m_sink, first, end - begin);
+			row_displace_ms[iv] = (float)(getMilliseconds() - start_ms);
+		} else {
+			displaceVertices(m_sink, first, end - begin);
+		}
+	}
+}
+
+namespace {
+	// Unit normals of `count' vertices of a row, from the differences between their neighbours
+	//	in the row (left and right, SoA) and in the rows around (previous and next), facing `up'.
+	//	Degenerate ones get `up'. Reads and writes up to 3 values past the count.
+	void computeNormals4(const float *left_x, const float *left_y, const float *left_z,
+		const float *right_x, const float *right_y, const float *right_z,
+		const float *previous_x, const float *previous_y, const float *previous_z,
+		const float *next_x, const float *next_y, const float *next_z,
+		int count, const glm::vec3 &up, float *nx, float *ny, float *nz) {
+		const __m128 up_x = _mm_set1_ps(up.x), up_y = _mm_set1_ps(up.y), up_z = _mm_set1_ps(up.z);
+		const __m128 sign_mask = _mm_set1_ps(-0.f), half = _mm_set1_ps(0.5f), three_halves = _mm_set1_ps(1.5f);
+		for (int i = 0; i < count; i += 4) {
+			const __m128 ax = _mm_sub_ps(_mm_loadu_ps(right_x + i), _mm_loadu_ps(left_x + i));
+			const __m128 ay = _mm_sub_ps(_mm_loadu_ps(right_y + i), _mm_loadu_ps(left_y + i));
+			const __m128 az = _mm_sub_ps(_mm_loadu_ps(right_z + i), _mm_loadu_ps(left_z + i));
+			const __m128 bx = _mm_sub_ps(_mm_loadu_ps(next_x + i), _mm_loadu_ps(previous_x + i));
+			const __m128 by = _mm_sub_ps(_mm_loadu_ps(next_y + i), _mm_loadu_ps(previous_y + i));
+			const __m128 bz = _mm_sub_ps(_mm_loadu_ps(next_z + i), _mm_loadu_ps(previous_z + i));
+			// along v x along u
+			__m128 x = _mm_sub_ps(_mm_mul_ps(by, az), _mm_mul_ps(bz, ay));
+			__m128 y = _mm_sub_ps(_mm_mul_ps(bz, ax), _mm_mul_ps(bx, az));
+			__m128 z = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+			const __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+			// Flipped when facing down, and scaled by the reciprocal square root refined once
+			const __m128 facing = _mm_and_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, up_x), _mm_mul_ps(y, up_y)), _mm_mul_ps(z, up_z)), sign_mask);
+			__m128 scale = _mm_rsqrt_ps(length2);
+			scale = _mm_mul_ps(scale, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, length2), _mm_mul_ps(scale, scale))));
+			scale = _mm_xor_ps(scale, facing);
+			const __m128 valid = _mm_cmpgt_ps(length2, _mm_setzero_ps());
+			x = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(x, scale)), _mm_andnot_ps(valid, up_x));
+			y = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(y, scale)), _mm_andnot_ps(valid, up_y));
+			z = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(z, scale)), _mm_andnot_ps(valid, up_z));
+			_mm_storeu_ps(nx + i, x);
+			_mm_storeu_ps(ny + i, y);
+			_mm_storeu_ps(nz + i, z);
+		}
+	}
+}
+
+void ProjectedGrid::generateFusedRows(const glm::vec4 *corners, const float *row_v, const int *row_spans, int first_vertex, int row_begin, int row_end,
+	float *row_displace_ms) {
+	const int columns = m_columns, rows = m_rows;
+	const float du = 1.f / (float)(columns - 1);
+	const glm::vec3 up = glm::normalize(m_base_plane.getNormal());
+	// A strip and the column on each side of it for the normals, three rows of it as SoA,
+	//	with room for the last batch of 4 to read past the end
+	const int STRIP = 64, WIDTH = STRIP + 2 + 4;
+	float window_x[3][WIDTH], window_y[3][WIDTH], window_z[3][WIDTH];
+	float normal_x[STRIP + 4], normal_y[STRIP + 4], normal_z[STRIP + 4];
+	std::fill(&window_x[0][0], &window_x[0][0] + 3 * WIDTH, 0.f);
+	std::fill(&window_y[0][0], &window_y[0][0] + 3 * WIDTH, 0.f);
+	std::fill(&window_z[0][0], &window_z[0][0] + 3 * WIDTH, 0.f);
+	// The float positions of the most common sink are written in place
+	const bool direct = m_sink.layout == GRID_LAYOUT_AOS_XYZ;
+	const int stride = m_sink.getStride();
+	// The rows around the band are only generated for the normals of its first and last rows
+	const int window_begin = std::max(row_begin - 1, 0), window_end = std::min(row_end + 1, rows);
+	int strip_begin = columns, strip_end = 0;
+	for (int iv = row_begin; iv < row_end; ++iv) {
+		if (row_displace_ms) {
+			row_displace_ms[iv] = 0.f;
+		}
+		if (row_spans[iv * 2] < row_spans[iv * 2 + 1]) {
+			strip_begin = std::min(strip_begin, row_spans[iv * 2]);
+			strip_end = std::max(strip_end, row_spans[iv * 2 + 1]);
+		}
+	}
+	for (int c0 = strip_begin; c0 < strip_end; c0 += STRIP) {
+		const int c1 = std::min(c0 + STRIP, strip_end);
+		for (int ir = window_begin; ir <= window_end; ++ir) {
+			if (ir < window_end) {
+				// What the rows around need of this one: their spans, and a column more on each side
+				int begin = columns, end = 0;
+				for (int jv = std::max(ir - 1, row_begin); jv <= std::min(ir + 1, row_end - 1); ++jv) {
+					if (row_spans[jv * 2] < row_spans[jv * 2 + 1]) {
+						begin = std::min(begin, row_spans[jv * 2]);
+						end = std::max(end, row_spans[jv * 2 + 1]);
+					}
+				}
+				begin = std::max(std::max(begin - 1, c0 - 1), 0);
+				end = std::min(std::min(end + 1, c1 + 1), columns);
+				if (begin < end) {
+					// Column c is at c - c0 + 1 in the window
+					const int slot = ir % 3, first = begin - c0 + 1;
+					const float v = row_v[ir];
+					const glm::vec4 row_start = (1.0f-v)*corners[0] + v*corners[2];
+					const glm::vec4 row_step = ((1.0f-v)*corners[1] + v*corners[3] - row_start) * du;
+					const GridVertexSink scratch = GridVertexSink::SoA(window_x[slot], window_z[slot], window_y[slot]);
+					m_row_kernel(row_start + row_step * (float)begin, row_step, end - begin, scratch, first);
+					if (row_displace_ms && ir >= row_begin && ir < row_end) {
+						const double start_ms = getMilliseconds();
+						displaceVertices(scratch, first, end - begin);
+						row_displace_ms[ir] += (float)(getMilliseconds() - start_ms);
+					} else {
+						displaceVertices(scratch, first, end - begin);
+					}
+					// Out of the grid, the vertex itself: one-sided differences on the borders
+					if (begin == 0 && c0 == 0) {
+						window_x[slot][0] = window_x[slot][1], window_y[slot][0] = window_y[slot][1], window_z[slot][0] = window_z[slot][1];
+					}
+					if (end == columns && c1 == columns) {
+						const int last = columns - c0;
+						window_x[slot][last + 1] = window_x[slot][last], window_y[slot][last + 1] = window_y[slot][last], window_z[slot][last + 1] = window_z[slot][last];
+					}
+				}
+			}
+			// The row before has its neighbours now, or it is the last one
+			const int iv = ir - 1;
+			if (iv < row_begin || iv >= row_end) {
+				continue;
+			}
+			const int begin = std::max(row_spans[iv * 2], c0), end = std::min(row_spans[iv * 2 + 1], c1);
+			if (begin >= end) {
+				continue;
+			}
+			const int slot = iv % 3;
+			const int previous = iv > 0 ? (iv - 1) % 3 : slot, next = iv + 1 < rows ? (iv + 1) % 3 : slot;
+			const int i0 = begin - c0 + 1;
+			computeNormals4(&window_x[slot][i0 - 1], &window_y[slot][i0 - 1], &window_z[slot][i0 - 1],
+				&window_x[slot][i0 + 1], &window_y[slot][i0 + 1], &window_z[slot][i0 + 1],
+				&window_x[previous][i0], &window_y[previous][i0], &window_z[previous][i0],
+				&window_x[next][i0], &window_y[next][i0], &window_z[next][i0],
+				end - begin, up, normal_x, normal_y, normal_z);
+			const float *x = &window_x[slot][i0], *y = &window_y[slot][i0], *z = &window_z[slot][i0];
+			const float v = row_v[iv];
+			const int first = first_vertex + iv * columns;
+			for (int c = begin, k = 0; c < end; ++c, ++k) {
+				if (direct) {
+					float *dst = m_sink.data + (first + c) * stride;
+					dst[0] = x[k];
+					dst[1] = y[k];
+					dst[2] = z[k];
+				} else {
+					m_sink.set(first + c, glm::vec3(x[k], y[k], z[k]));
+				}
+				m_sink.setAttributes(first + c, glm::vec3(normal_x[k], normal_y[k], normal_z[k]), c * du, v);
+			}
+		}
+	}
+}
+
+void ProjectedGrid::displaceVertices(const GridVertexSink &sink, int first, int count, const glm::vec3 *source) const {
+	if (!m_height_field || !m_sink.hasY() || m_filling_base) {
+		return;
+	}
+	const float strength = m_options.strength;
+	const glm::vec3 normal = glm::normalize(m_base_plane.getNormal()) * strength;
+	const bool horizontal = m_height_field->hasHorizontalDisplacement();
+	// The field is sampled by batches, which keep the positions on the stack
+	const int BATCH = 64;
+	glm::vec3 p[BATCH];
+	float x[BATCH], z[BATCH], h[BATCH], dx[BATCH], dz[BATCH];
+	for (int begin = first; begin < first + count; begin += BATCH) {
+		const int n = std::min(BATCH, first + count - begin);
+		for (int i = 0; i < n; ++i) {
+			p[i] = source ? source[begin + i] : sink.load(begin + i);
+			x[i] = p[i].x;
+			z[i] = p[i].z;
+		}
+		if (horizontal) {
+			m_height_field->sampleDisplacements(x, z, n, dx, h, dz);
+			for (int i = 0; i < n; ++i) {
+				sink.set(begin + i, p[i] + normal * h[i] + glm::vec3(dx[i], 0.f, dz[i]) * strength);
+			}
+		} else {
+			m_height_field->sampleDisplacements(x, z, n, NULL, h, NULL);
+			for (int i = 0; i < n; ++i) {
+				sink.set(begin + i, p[i] + normal * h[i]);
+			}
+		}
+	}
+}
+
+void ProjectedGrid::generateRowsTask(void *grid, int row_begin, int row_end) {
+	// The rows of all the views follow each other, a band may span several views
+	ProjectedGrid *self = static_cast<ProjectedGrid*>(grid);
+	const int grid_rows = self->m_rows;
+	while (row_begin < row_end) {
+		const int view = row_begin / grid_rows;
+		const int iv = row_begin - view * grid_rows;
+		const int rows = std::min(grid_rows - iv, row_end - row_begin);
+		self->generateRows(&self->m_view_corners[view * 4], &self->m_row_v[view * grid_rows], &self->m_row_spans[view * grid_rows * 2],
+			self->m_view_firsts[view], iv, iv + rows, self->m_stats ? &self->m_row_displace_ms[view * grid_rows] : NULL);
+		row_begin += rows;
+	}
+}
+
+void ProjectedGrid::generateViews(int view_num) {
+	const int rows = view_num * m_rows;
+	// Rows don't depend on each other, so the result is the same whatever the band split is
+	if (m_worker_pool) {
+		m_worker_pool->parallelFor(rows, 8, generateRowsTask, this);
+	} else {
+		generateRowsTask(this, 0, rows);
+	}
+}
+
+namespace {
+	// Farthest the boundary of the grid with the corners `from' moves on a width x height
+	//	screen to that of the grid with the corners `to', from its corners and edge middles
+	float getBoundaryMotion(const glm::vec4 *from, const glm::vec4 *to, const glm::mat4 &view_proj, float width, float height) {
+		const float BOUNDARY_UV[8][2] = {{0.f, 0.f}, {0.5f, 0.f}, {1.f, 0.f}, {1.f, 0.5f}, {1.f, 1.f}, {0.5f, 1.f}, {0.f, 1.f}, {0.f, 0.5f}};
+		float motion = 0.f;
+		for (int i = 0; i < 8; ++i) {
+			const float u = BOUNDARY_UV[i][0], v = BOUNDARY_UV[i][1];
+			const glm::vec4 p = (1.f - v) * ((1.f - u) * from[0] + u * from[1]) + v * ((1.f - u) * from[2] + u * from[3]);
+			const glm::vec4 q = (1.f - v) * ((1.f - u) * to[0] + u * to[1]) + v * ((1.f - u) * to[2] + u * to[3]);
+			motion = std::max(motion, glm::length(projectToScreen(q, view_proj, width, height) - projectToScreen(p, view_proj, width, height)));
+		}
+		return motion;
+	}
+}
+
+int ProjectedGrid::getRefreshRowCount(bool sink_kept) const {
+	// The displaced vertices can't be displaced again, every row is written from the kept
+	//	undisplaced ones
+	if (m_height_field && m_temporal_sink.hasY()) {
+		return m_rows;
+	}
+	return getRegenerateRowCount(sink_kept && !m_temporal_displaced);
+}
+
+int ProjectedGrid::getRegenerateRowCount(bool rows_kept) const {
+	if (!m_options.temporal || !rows_kept || !m_temporal_valid) {
+		return m_rows;
+	}
+	const glm::vec4 corners[4] = {
+		getRangeCorner4(m_range_matrix, m_base_plane, m_plane_type, 0.f, 0.f), getRangeCorner4(m_range_matrix, m_base_plane, m_plane_type, 1.f, 0.f),
+		getRangeCorner4(m_range_matrix, m_base_plane, m_plane_type, 0.f, 1.f), getRangeCorner4(m_range_matrix, m_base_plane, m_plane_type, 1.f, 1.f)
+	};
+	const float motion = getBoundaryMotion(m_temporal_corners, corners, m_rendering_camera->getViewProjectionMatrix(),
+		m_rendering_camera->getWidth(), m_rendering_camera->getHeight());
+	if (motion >= m_options.refresh_pixels) {
+		return m_rows;
+	}
+	return motion >= m_options.reuse_pixels ? std::min(std::max(m_options.refresh_rows, 1), m_rows) : 0;
+}
+
+void ProjectedGrid::generateRefreshedRows(int refresh_num) {
+	const int rows = m_rows;
+	glm::vec4 *corners = &m_view_corners[0];
+	corners[0] = getCorner4(0.f, 0.f);
+	corners[1] = getCorner4(1.f, 0.f);
+	corners[2] = getCorner4(0.f, 1.f);
+	corners[3] = getCorner4(1.f, 1.f);
+	const glm::mat4 view_proj = m_rendering_camera->getViewProjectionMatrix();
+	const float width = m_rendering_camera->getWidth(), height = m_rendering_camera->getHeight();
+	m_refreshed_first = m_refresh_row;
+	m_refreshed_rows = refresh_num;
+	m_regenerated_rows = refresh_num;
+	if (refresh_num == 0) {
+		m_generated_vertices = 0;
+		return;
+	}
+	if (refresh_num == rows) {
+		m_refreshed_first = 0;
+		parameterizeRows(corners, view_proj, width, height, &m_row_v[0], &m_row_spacing[0]);
+		m_generated_vertices = cullRows(corners, &m_row_v[0], view_proj, &m_row_spans[0]);
+		generateViews(1);
+		std::copy(corners, corners + 4, m_temporal_corners);
+		m_refresh_row = 0;
+		m_refresh_cycle = 0;
+		return;
+	}
+	// The next rows in turn, the others keep those of the previous frames
+	parameterizeRows(corners, view_proj, width, height, &m_fresh_row_v[0], &m_fresh_row_spacing[0]);
+	cullRows(corners, &m_fresh_row_v[0], view_proj, &m_fresh_row_spans[0]);
+	m_generated_vertices = 0;
+	for (int i = 0; i < refresh_num; ++i) {
+		const int iv = (m_refresh_row + i) % rows;
+		m_row_v[iv] = m_fresh_row_v[iv];
+		m_row_spacing[iv] = m_fresh_row_spacing[iv];
+		m_row_spans[iv * 2] = m_fresh_row_spans[iv * 2];
+		m_row_spans[iv * 2 + 1] = m_fresh_row_spans[iv * 2 + 1];
+		m_generated_vertices += std::max(m_row_spans[iv * 2 + 1] - m_row_spans[iv * 2], 0);
+		generateRows(corners, &m_row_v[0], &m_row_spans[0], 0, iv, iv + 1, NULL);
+	}
+	m_refresh_row = (m_refresh_row + refresh_num) % rows;
+	m_refresh_cycle += refresh_num;
+	// Once every row went through the refresh, they all follow the current matrix
+	if (m_refresh_cycle >= rows) {
+		std::copy(corners, corners + 4, m_temporal_corners);
+		m_refresh_cycle = 0;
+	}
+}
+
+void ProjectedGrid::displaceKeptRows() {
+	m_generated_vertices = 0;
+	for (int iv = 0; iv < m_rows; ++iv) {
+		m_generated_vertices += std::max(m_row_spans[iv * 2 + 1] - m_row_spans[iv * 2], 0);
+	}
+	if (m_worker_pool) {
+		m_worker_pool->parallelFor(m_rows, 8, displaceKeptRowsTask, this);
+	} else {
+		displaceKeptRowsTask(this, 0, m_rows);
+	}
+	m_refreshed_first = 0;
+	m_refreshed_rows = m_rows;
+}
+
+void ProjectedGrid::displaceKeptRowsTask(void *grid, int row_begin, int row_end) {
+	ProjectedGrid *self = static_cast<ProjectedGrid*>(grid);
+	const glm::vec3 *base = &self->m_temporal_base[0];
+	for (int iv = row_begin; iv < row_end; ++iv) {
+		const int begin = self->m_row_spans[iv * 2], end = self->m_row_spans[iv * 2 + 1];
+		const double start_ms = self->m_stats ? getMilliseconds() : 0.0;
+		if (begin < end) {
+			self->displaceVertices(self->m_sink, iv * self->m_columns + begin, end - begin, base);
+		}
+		if (self->m_stats) {
+			self->m_row_displace_ms[iv] = (float)(getMilliseconds() - start_ms);
+		}
+	}
+}
+
+void ProjectedGrid::generateGeometry() {
+	if ((int)m_vertices.size() < m_vertex_capacity) {
+		m_vertices.resize(m_vertex_capacity);
+	}
+	// The grid's own buffer keeps what was written into it, if the last generation went there
+	const GridVertexSink sink = GridVertexSink::AoS(glm::value_ptr(m_vertices[0]));
+	generateGeometry(sink, m_temporal_sink.getMemory() == sink.getMemory());
+}
+
+void ProjectedGrid::applyResolution() {
+	if (!m_options.adaptive || (m_resolution.getColumns() == m_columns && m_resolution.getRows() == m_rows)) {
+		return;
+	}
+	m_columns = m_resolution.getColumns();
+	m_rows = m_resolution.getRows();
+	m_topology.update(m_columns, m_rows, m_options.topology);
+	m_row_kernel = getGridRowKernel(m_options.kernel, m_plane_type, m_columns);
+	m_temporal_valid = false;
+}
+
+void ProjectedGrid::endRange(double start_ms, bool cached, bool visible, int intersections) {
+	if (!m_stats) {
+		return;
+	}
+	m_stats->beginFrame();
+	GridFrameStats &frame = m_stats->getCurrentFrame();
+	frame.visible = visible;
+	frame.cached = cached;
+	frame.intersections = intersections;
+	frame.columns = m_columns;
+	frame.rows = m_rows;
+	frame.range_ms = (float)(getMilliseconds() - start_ms);
+	// Nothing else to measure
+	if (!visible) {
+		m_stats->endFrame();
+	}
+}
+
+void ProjectedGrid::endGeneration(double start_ms, int view_num, const Camera *first_camera) {
+	if (!m_options.adaptive && !m_stats) {
+		return;
+	}
+	const float generate_ms = (float)(getMilliseconds() - start_ms);
+	if (m_options.adaptive) {
+		m_resolution.update(generate_ms);
+	}
+	if (!m_stats) {
+		return;
+	}
+	GridFrameStats &frame = m_stats->getCurrentFrame();
+	frame.generated_vertices = m_generated_vertices;
+	frame.generate_ms = generate_ms;
+	frame.displace_ms = 0.f;
+	for (int i = 0; i < view_num * m_rows; ++i) {
+		frame.displace_ms += m_row_displace_ms[i];
+	}
+	if (view_num > 0) {
+		measureView(&m_view_corners[0], &m_row_v[0], &m_row_spans[0], *first_camera);
+	}
+	m_stats->endFrame();
+}
 
-void ProjectedGrid::renderGeometry() {
-	const int sides = m_options.sides;
-	int index = 0;
+namespace {
+	// A row of a grid in clip space: the view-projection is linear in homogeneous coordinates,
+	//	so a point of the row is the interpolation of the row's ends over the interpolated w
+	struct ClipRow {
+		glm::vec4 start, step;
+		float w_start, w_step;
+
+		inline glm::vec4 getPoint(int iu) const {
+			return (start + step * (float)iu) / (w_start + w_step * (float)iu);
+		}
+	};
+
+	inline ClipRow getClipRow(const glm::vec4 *clip_corners, const glm::vec4 *corners, float v, float du) {
+		ClipRow row;
+		row.start = (1.f - v) * clip_corners[0] + v * clip_corners[2];
+		row.step = ((1.f - v) * clip_corners[1] + v * clip_corners[3] - row.start) * du;
+		row.w_start = (1.f - v) * corners[0].w + v * corners[2].w;
+		row.w_step = ((1.f - v) * corners[1].w + v * corners[3].w - row.w_start) * du;
+		return row;
+	}
+
+	inline bool insideViewport(const glm::vec4 &clip) {
+		return clip.w > 0.f && fabs(clip.x) <= clip.w && fabs(clip.y) <= clip.w;
+	}
+}
+
+void ProjectedGrid::measureView(const glm::vec4 *corners, const float *row_v, const int *row_spans, const Camera &camera) {
+	GridFrameStats &frame = m_stats->getCurrentFrame();
+	const int columns = m_columns, rows = m_rows;
+	const glm::mat4 view_proj = camera.getViewProjectionMatrix();
+	glm::vec4 clip_corners[4];
+	for (int i = 0; i < 4; ++i) {
+		clip_corners[i] = view_proj * corners[i];
+	}
+	const float half_width = 0.5f * camera.getWidth(), half_height = 0.5f * camera.getHeight();
+	const float du = 1.f / (float)(columns - 1);
+	// Every step-th vertex, with the edges to its next neighbours in u and v
+	const int step_u = (columns + STATS_LATTICE - 1) / STATS_LATTICE;
+	const int step_v = (rows + STATS_LATTICE - 1) / STATS_LATTICE;
+	int samples = 0, inside = 0;
+	m_edge_lengths.clear();
+	for (int iv = 0; iv < rows; iv += step_v) {
+		const int begin = row_spans[iv * 2], end = row_spans[iv * 2 + 1];
+		const bool has_next = iv + 1 < rows;
+		const int next_begin = has_next ? row_spans[iv * 2 + 2] : 0;
+		const int next_end = has_next ? row_spans[iv * 2 + 3] : 0;
+		const ClipRow row = getClipRow(clip_corners, corners, row_v[iv], du);
+		const ClipRow next_row = getClipRow(clip_corners, corners, has_next ? row_v[iv + 1] : 1.f, du);
+		for (int iu = (begin + step_u - 1) / step_u * step_u; iu < end; iu += step_u) {
+			const glm::vec4 p = row.getPoint(iu);
+			const bool p_inside = insideViewport(p);
+			++samples;
+			inside += p_inside ? 1 : 0;
+			glm::vec4 neighbours[2];
+			int neighbour_num = 0;
+			if (iu + 1 < end) {
+				neighbours[neighbour_num++] = row.getPoint(iu + 1);
+			}
+			if (iu >= next_begin && iu < next_end) {
+				neighbours[neighbour_num++] = next_row.getPoint(iu);
+			}
+			for (int k = 0; k < neighbour_num; ++k) {
+				const glm::vec4 &q = neighbours[k];
+				if (p.w > 0.f && q.w > 0.f && (p_inside || insideViewport(q))) {
+					const float dx = (q.x / q.w - p.x / p.w) * half_width;
+					const float dy = (q.y / q.w - p.y / p.w) * half_height;
+					m_edge_lengths.push_back(sqrt(dx * dx + dy * dy));
+				}
+			}
+		}
+	}
+	frame.inside_percent = samples > 0 ? 100.f * inside / samples : 0.f;
+	if (m_edge_lengths.empty()) {
+		frame.edge_min = frame.edge_median = frame.edge_max = 0.f;
+		return;
+	}
+	std::vector<float>::iterator median = m_edge_lengths.begin() + m_edge_lengths.size() / 2;
+	std::nth_element(m_edge_lengths.begin(), median, m_edge_lengths.end());
+	frame.edge_median = *median;
+	frame.edge_min = *std::min_element(m_edge_lengths.begin(), median + 1);
+	frame.edge_max = *std::max_element(median, m_edge_lengths.end());
+}
+
+void ProjectedGrid::generateGeometry(const GridVertexSink &sink, bool sink_kept) {
+	PROFILE_ZONE("ProjectedGrid::generateGeometry");
+	// Only the adaptive resolution and the stats need the time
+	const double start_ms = m_options.adaptive || m_stats ? getMilliseconds() : 0.0;
+	m_sink = sink;
 
 #ifdef INTERPOLATE_VERSION_1
-	glm::vec4 t_corners0 = getCorner4(0.f, 0.f);
-	glm::vec4 t_corners1 = getCorner4(1.f, 0.f);
-	glm::vec4 t_corners2 = getCorner4(0.f, 1.f);
-	glm::vec4 t_corners3 = getCorner4(1.f, 1.f);
-
-	float u = 0.f, v = 0.f;
-	float du = 1.f / (float)(sides - 1);
-	float dv = 1.f / (float)(sides - 1);
+	m_view_corners.resize(4);
+	m_view_firsts.resize(1);
+	m_view_firsts[0] = 0;
+
 	//Method #1
-	glm::vec4 result;
-	for (int iv = 0; iv < sides; ++iv) {
-		u = 0.f;
-		for (int iu = 0; iu < sides; ++iu) {
-			result.x = (1.0f-v)*( (1.0f-u)*t_corners0.x + u*t_corners1.x ) + v*( (1.0f-u)*t_corners2.x + u*t_corners3.x );				
-			result.z = (1.0f-v)*( (1.0f-u)*t_corners0.z + u*t_corners1.z ) + v*( (1.0f-u)*t_corners2.z + u*t_corners3.z );				
-			result.w = (1.0f-v)*( (1.0f-u)*t_corners0.w + u*t_corners1.w ) + v*( (1.0f-u)*t_corners2.w + u*t_corners3.w );				
-		
-			float divide = 1.0f/result.w;				
-			result.x *= divide;
-			result.z *= divide;
-
-			m_vertices[index].x = result.x;
-			m_vertices[index].z = result.z;
-			m_vertices[index].y = 0.f;	// @hack: need to read the heightmap here
-			
-			++index;
-			u += du;
+	m_temporal_sink = sink;
+	if (m_options.temporal && m_height_field && sink.hasY() && !sink.hasAttributes()) {
+		// Displaced on the CPU: the rows refreshed go to the undisplaced copy, and all of
+		//	them are displaced from it into the sink
+		if ((int)m_temporal_base.size() < m_vertex_capacity) {
+			m_temporal_base.resize(m_vertex_capacity);
 		}
-		v += dv;
+		const bool base_kept = m_temporal_displaced;
+		m_sink = GridVertexSink::AoS(glm::value_ptr(m_temporal_base[0]));
+		m_filling_base = true;
+		generateRefreshedRows(getRegenerateRowCount(base_kept));
+		m_filling_base = false;
+		m_sink = sink;
+		displaceKeptRows();
+		m_temporal_displaced = true;
+	} else {
+		generateRefreshedRows(getRefreshRowCount(sink_kept));
+		m_temporal_displaced = false;
 	}
+	// Not kept, the sink got all the rows
+	m_temporal_valid = m_options.temporal;
+	endGeneration(start_ms, 1, m_rendering_camera);
 #else
 	// #2: Slower version
 	glm::vec3 t_corners0 = getCorner(0.f, 0.f);
 	glm::vec3 t_corners1 = getCorner(1.f, 0.f);
 	glm::vec3 t_corners2 = getCorner(0.f, 1.f);
 	glm::vec3 t_corners3 = getCorner(1.f, 1.f);
-	for (int iv = 0; iv < sides; ++iv) {
-		for (int iu = 0; iu < sides; ++iu) {
-			float u = (float)iu / (float)(sides - 1);
-			float v = (float)iv / (float)(sides - 1);
+	m_view_corners.resize(4);
+	glm::vec4 *corners = &m_view_corners[0];
+	corners[0] = getCorner4(0.f, 0.f);
+	corners[1] = getCorner4(1.f, 0.f);
+	corners[2] = getCorner4(0.f, 1.f);
+	corners[3] = getCorner4(1.f, 1.f);
+	parameterizeRows(corners, m_rendering_camera->getViewProjectionMatrix(),
+		m_rendering_camera->getWidth(), m_rendering_camera->getHeight(), &m_row_v[0], &m_row_spacing[0]);
+	m_generated_vertices = cullRows(corners, &m_row_v[0], m_rendering_camera->getViewProjectionMatrix(), &m_row_spans[0]);
+	for (int iv = 0; iv < m_rows; ++iv) {
+		const int begin = m_row_spans[iv * 2], end = m_row_spans[iv * 2 + 1];
+		int index = iv * m_columns + begin;
+		for (int iu = begin; iu < end; ++iu) {
+			float u = (float)iu / (float)(m_columns - 1);
+			float v = m_row_v[iv];
 			glm::vec3 p = getCorner(u, v);
-			m_vertices[index].x = p.x;
-			m_vertices[index].z = p.z;
-			m_vertices[index].y = 0.f;	// @hack
+			m_sink.store(index, p.x, p.z);
 			++index;
 		}
+		const double displace_ms = m_stats ? getMilliseconds() : 0.0;
+		displaceVertices(m_sink, iv * m_columns + begin, end - begin);
+		m_row_displace_ms[iv] = m_stats ? (float)(getMilliseconds() - displace_ms) : 0.f;
 	}
+	endGeneration(start_ms, 1, m_rendering_camera);
 #endif
+}
 
-	glPushAttrib(GL_CURRENT_COLOR);
-	glColor3f(0.f, 1.f, 0.f);
-
-	// Draw the grid
-	glBegin(GL_POINTS);
-	for (int i = 0; i < m_vertices.size(); ++i) {
-		glVertex3fv(glm::value_ptr(m_vertices[i]));
+int ProjectedGrid::generateGeometry(ProjectedGridView *views, int count, const GridVertexSink &arena) {
+	PROFILE_ZONE("ProjectedGrid::generateGeometry");
+	// Only the adaptive resolution and the stats need the time
+	const double start_ms = m_options.adaptive || m_stats ? getMilliseconds() : 0.0;
+	const int vertex_count = getVertexCount();
+	m_sink = arena;
+	// Only grows, so that the same views every frame don't allocate
+	if ((int)m_view_firsts.size() < count) {
+		m_view_corners.resize(count * 4);
+		m_view_firsts.resize(count);
+	}
+	if ((int)m_row_v.size() < count * m_options.rows) {
+		m_row_v.resize(count * m_options.rows);
+		m_row_spacing.resize(count * m_options.rows);
+		m_row_spans.resize(count * m_options.rows * 2);
+		m_row_displace_ms.resize(count * m_options.rows);
 	}
-	glEnd();
-	
-	glPopAttrib();
-}
\ No newline at end of file
+	m_generated_vertices = 0;
+	m_refreshed_first = 0;
+	m_refreshed_rows = 0;
+	m_regenerated_rows = 0;
+	// The row parameters of the single view are overwritten
+	m_temporal_valid = false;
+	int view_num = 0;
+	const Camera *first_camera = NULL;
+	for (int i = 0; i < count; ++i) {
+		ProjectedGridView &view = views[i];
+		if (!view.visible) {
+			view.first_vertex = -1;
+			continue;
+		}
+		view.first_vertex = view_num * vertex_count;
+		glm::vec4 *corners = &m_view_corners[view_num * 4];
+		corners[0] = getRangeCorner4(view.range_matrix, m_base_plane, m_plane_type, 0.f, 0.f);
+		corners[1] = getRangeCorner4(view.range_matrix, m_base_plane, m_plane_type, 1.f, 0.f);
+		corners[2] = getRangeCorner4(view.range_matrix, m_base_plane, m_plane_type, 0.f, 1.f);
+		corners[3] = getRangeCorner4(view.range_matrix, m_base_plane, m_plane_type, 1.f, 1.f);
+		m_view_firsts[view_num] = view.first_vertex;
+		first_camera = view_num == 0 ? view.camera : first_camera;
+		m_refreshed_rows += m_rows;
+		m_regenerated_rows += m_rows;
+		parameterizeRows(corners, view.camera->getViewProjectionMatrix(), view.camera->getWidth(), view.camera->getHeight(),
+			&m_row_v[view_num * m_rows], &m_row_spacing[view_num * m_rows]);
+		m_generated_vertices += cullRows(corners, &m_row_v[view_num * m_rows], view.camera->getViewProjectionMatrix(),
+			&m_row_spans[view_num * m_rows * 2]);
+		++view_num;
+	}
+	generateViews(view_num);
+	endGeneration(start_ms, view_num, first_camera);
+	return view_num * vertex_count;
+}
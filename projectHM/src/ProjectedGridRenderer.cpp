@@ -0,0 +1,396 @@
+#include "projectHM_PCH.h"
+
+#include "gl/glew.h"
+#include "gl/glut.h"
+
+#include "Camera.h"
+#include "HeightField.h"
+#include "GridTopology.h"
+#include "ProjectedGrid.h"
+#include "GridPipeline.h"
+#include "ProjectedGridRenderer.h"
+#include "../../hxlib/include/Profiler.h"
+
+namespace {
+	const char *QUANTIZED_SHADER_FILE = "../data/shaders/projected_grid_quantized.vert";
+	// Attribute indices of the quantized decoding program
+	const GLuint QUANTIZED_XZ_ATTRIB = 0;
+	const GLuint HALF_Y_ATTRIB = 1;
+
+	bool readTextFile(const char *filename, std::string &text) {
+		FILE *reader = fopen(filename, "rb");
+		if (reader == NULL) {
+			return false;
+		}
+		char buffer[4096];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), reader)) > 0) {
+			text.append(buffer, read);
+		}
+		fclose(reader);
+		return true;
+	}
+}
+
+ProjectedGridRenderer::ProjectedGridRenderer()
+	: m_format(GRID_FORMAT_FLOAT), m_vertex_buffer(0), m_buffer_vertices(0), m_buffer_format(GRID_FORMAT_FLOAT), m_buffer_kept(false),
+	m_index_buffer(0), m_uploaded_topology(NULL), m_uploaded_revision(0), m_origin(0.f), m_quantum(1.f),
+	m_decode_program(0), m_decode_origin(-1), m_decode_quantum(-1), m_decode_failed(false) {
+}
+
+ProjectedGridRenderer::~ProjectedGridRenderer() {
+	release();
+}
+
+void ProjectedGridRenderer::release() {
+	if (m_vertex_buffer) {
+		glDeleteBuffers(1, &m_vertex_buffer);
+		m_vertex_buffer = 0;
+		m_buffer_vertices = 0;
+		m_buffer_kept = false;
+	}
+	if (m_index_buffer) {
+		glDeleteBuffers(1, &m_index_buffer);
+		m_index_buffer = 0;
+		m_uploaded_topology = NULL;
+	}
+	if (m_decode_program) {
+		glDeleteProgram(m_decode_program);
+		m_decode_program = 0;
+	}
+}
+
+const char* ProjectedGridRenderer::getVertexFormatName(GridVertexFormat format) {
+	switch (format) {
+	case GRID_FORMAT_HALF:
+		return "half";
+	case GRID_FORMAT_QUANTIZED:
+		return "quantized";
+	default:
+		return "float";
+	}
+}
+
+GridVertexFormat ProjectedGridRenderer::resolveFormat() {
+	switch (m_format) {
+	case GRID_FORMAT_HALF:
+		return GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex ? GRID_FORMAT_HALF : GRID_FORMAT_FLOAT;
+	case GRID_FORMAT_QUANTIZED:
+		// The height is a half float attribute as well
+		return (GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex) && loadDecodeProgram() ? GRID_FORMAT_QUANTIZED : GRID_FORMAT_FLOAT;
+	default:
+		return GRID_FORMAT_FLOAT;
+	}
+}
+
+bool ProjectedGridRenderer::loadDecodeProgram() {
+	if (m_decode_program || m_decode_failed) {
+		return m_decode_program != 0;
+	}
+	m_decode_failed = true;
+	if (!GLEW_VERSION_2_0) {
+		fprintf(stderr, "Quantized grid vertices need GLSL, using floats\n");
+		return false;
+	}
+	std::string source;
+	if (!readTextFile(QUANTIZED_SHADER_FILE, source)) {
+		fprintf(stderr, "Cannot read shader from file '%s'\n", QUANTIZED_SHADER_FILE);
+		return false;
+	}
+	const GLchar *text = source.c_str();
+	GLuint shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(shader, 1, &text, NULL);
+	glCompileShader(shader);
+	GLchar log[1024];
+	GLint status = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Cannot compile shader '%s':\n%s\n", QUANTIZED_SHADER_FILE, log);
+		glDeleteShader(shader);
+		return false;
+	}
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glBindAttribLocation(program, QUANTIZED_XZ_ATTRIB, "quantized_xz");
+	glBindAttribLocation(program, HALF_Y_ATTRIB, "half_y");
+	glLinkProgram(program);
+	// Flagged for deletion along with the program
+	glDeleteShader(shader);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE) {
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "Cannot link shader '%s':\n%s\n", QUANTIZED_SHADER_FILE, log);
+		glDeleteProgram(program);
+		return false;
+	}
+	m_decode_program = program;
+	m_decode_origin = glGetUniformLocation(program, "origin");
+	m_decode_quantum = glGetUniformLocation(program, "quantum");
+	m_decode_failed = false;
+	return true;
+}
+
+bool ProjectedGridRenderer::updatePacking(const ProjectedGrid &grid) {
+	const Camera &camera = *grid.getRenderingCamera();
+	// The grid lies within the far distance (the corners of the frustum a bit farther), grown
+	//	by what the field moves the vertices
+	const HeightField *height_field = grid.getHeightField();
+	const float reach = camera.getFarClip() + (height_field ? height_field->getMaxHorizontalDisplacement() * grid.getOptions().strength : 0.f);
+	const float quantum = 1.25f * reach / 32767.f;
+	const float snap = camera.getFarClip() / 16.f;
+	const glm::vec3 position = camera.getPosition();
+	const glm::vec3 origin(floor(position.x / snap + 0.5f) * snap, 0.f, floor(position.z / snap + 0.5f) * snap);
+	if (origin == m_origin && quantum == m_quantum) {
+		return false;
+	}
+	m_origin = origin;
+	m_quantum = quantum;
+	return true;
+}
+
+GridVertexSink ProjectedGridRenderer::getSink(void *memory, GridVertexFormat format) const {
+	switch (format) {
+	case GRID_FORMAT_HALF:
+		return GridVertexSink::Half(memory, m_origin);
+	case GRID_FORMAT_QUANTIZED:
+		return GridVertexSink::Quantized(memory, m_origin, m_quantum);
+	default:
+		return GridVertexSink::AoS(static_cast<float*>(memory));
+	}
+}
+
+void ProjectedGridRenderer::uploadTopology(const GridTopology &topology) {
+	if (m_uploaded_topology == &topology && m_uploaded_revision == topology.getRevision()) {
+		return;
+	}
+	if (m_index_buffer == 0) {
+		glGenBuffers(1, &m_index_buffer);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, topology.getIndexCount() * topology.getIndexSize(), topology.getIndices(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	const int strip_count = topology.getStripCount();
+	m_strip_sizes.resize(strip_count);
+	m_strip_offsets.resize(strip_count);
+	for (int i = 0; i < strip_count; ++i) {
+		m_strip_sizes[i] = topology.getStripSizes()[i];
+		m_strip_offsets[i] = (const GLvoid*)((size_t)topology.getStripFirsts()[i] * topology.getIndexSize());
+	}
+	m_uploaded_topology = &topology;
+	m_uploaded_revision = topology.getRevision();
+}
+
+void ProjectedGridRenderer::render(ProjectedGrid &grid) {
+	PROFILE_ZONE("ProjectedGridRenderer::render");
+	const GridTopology &topology = grid.getTopology();
+	uploadTopology(topology);
+
+	const GridVertexFormat format = resolveFormat();
+	const int vertex_size = getVertexSize(format);
+	const int count = grid.getVertexCount();
+	const GLsizeiptr size = count * vertex_size;
+	// Sized for the largest resolution, an adaptive grid changing its own doesn't reallocate it
+	const int capacity = grid.getVertexCapacity();
+	const GLsizeiptr capacity_size = capacity * vertex_size;
+	if (m_vertex_buffer == 0) {
+		glGenBuffers(1, &m_vertex_buffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffer);
+	if (m_buffer_vertices != capacity || m_buffer_format != format) {
+		glBufferData(GL_ARRAY_BUFFER, capacity_size, NULL, GL_STREAM_DRAW);
+		m_buffer_vertices = capacity;
+		m_buffer_format = format;
+		m_buffer_kept = false;
+	}
+	// The kept vertices are relative to the last origin
+	if (format != GRID_FORMAT_FLOAT && updatePacking(grid)) {
+		m_buffer_kept = false;
+	}
+	const bool map_range = GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range;
+	const bool culling = grid.getOptions().cull_rows;
+	// A temporal grid may leave the buffer as it is, or all but a few rows of it
+	const int rows = grid.getRows();
+	const int refresh_num = grid.getRefreshRowCount(m_buffer_kept && map_range);
+	if (refresh_num == 0) {
+		drawGrid(NULL, format, topology, count, culling ? gatherDrawRanges(grid) : -1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+	// Let the driver hand out fresh storage instead of waiting on the last frame's draw,
+	//	unless the rows not refreshed must stay
+	GLvoid *mapped = NULL;
+	const bool partial = refresh_num < rows;
+	bool explicit_flush = false;
+	if (map_range) {
+		// A culling grid only writes spans of its rows, only those need to reach the buffer
+		explicit_flush = culling || partial;
+		mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | (partial ? 0 : GL_MAP_INVALIDATE_BUFFER_BIT) |
+			(explicit_flush ? GL_MAP_FLUSH_EXPLICIT_BIT : 0));
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, capacity_size, NULL, GL_STREAM_DRAW);
+		mapped = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+	}
+	if (mapped) {
+		grid.generateGeometry(getSink(mapped, format), m_buffer_kept && map_range);
+		if (explicit_flush) {
+			const int columns = grid.getColumns();
+			const int first = grid.getFirstRefreshedRow();
+			for (int i = 0; i < grid.getRefreshedRowCount(); ++i) {
+				const int iv = (first + i) % rows;
+				int begin, end;
+				grid.getRowSpan(iv, begin, end);
+				if (begin < end) {
+					glFlushMappedBufferRange(GL_ARRAY_BUFFER, (iv * columns + begin) * vertex_size, (end - begin) * vertex_size);
+				}
+			}
+		}
+		// The content may get lost on mode switches, draw from client memory then
+		if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE) {
+			m_buffer_kept = true;
+			drawGrid(NULL, format, topology, count, culling ? gatherDrawRanges(grid) : -1);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+	}
+	m_buffer_kept = false;
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	grid.generateGeometry();
+	drawGrid(grid.getVertices(), GRID_FORMAT_FLOAT, topology, count, culling ? gatherDrawRanges(grid) : -1);
+}
+
+void ProjectedGridRenderer::render(const GridPipelineFrame &frame) {
+	PROFILE_ZONE("ProjectedGridRenderer::render");
+	if (!frame.visible) {
+		return;
+	}
+	m_frame_topology.update(frame.columns, frame.rows, frame.topology);
+	uploadTopology(m_frame_topology);
+
+	// The frame's memory already holds the vertices, hand it over with fresh storage
+	const int count = frame.columns * frame.rows;
+	if (m_vertex_buffer == 0) {
+		glGenBuffers(1, &m_vertex_buffer);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec3), &frame.vertices[0], GL_STREAM_DRAW);
+	m_buffer_vertices = count;
+	m_buffer_format = GRID_FORMAT_FLOAT;
+	m_buffer_kept = false;
+	int range_count = -1;
+	if (frame.culled) {
+		range_count = frame.range_count;
+		m_range_firsts.assign(frame.range_firsts.begin(), frame.range_firsts.begin() + range_count);
+		m_range_sizes.assign(frame.range_counts.begin(), frame.range_counts.begin() + range_count);
+		updateRangeOffsets(m_frame_topology, range_count);
+	}
+	drawGrid(NULL, GRID_FORMAT_FLOAT, m_frame_topology, count, range_count);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int ProjectedGridRenderer::gatherDrawRanges(const ProjectedGrid &grid) {
+	const int max_ranges = grid.getMaxDrawRanges();
+	m_range_firsts.resize(max_ranges);
+	m_range_sizes.resize(max_ranges);
+	// GLsizei is an int
+	const int count = max_ranges > 0 ? grid.getDrawRanges(&m_range_firsts[0], &m_range_sizes[0]) : 0;
+	updateRangeOffsets(grid.getTopology(), count);
+	return count;
+}
+
+void ProjectedGridRenderer::updateRangeOffsets(const GridTopology &topology, int range_count) {
+	// Points are drawn from the vertex ranges themselves
+	if (topology.getType() == GRID_TOPOLOGY_POINTS) {
+		return;
+	}
+	m_range_offsets.resize(range_count);
+	for (int i = 0; i < range_count; ++i) {
+		m_range_offsets[i] = (const GLvoid*)((size_t)m_range_firsts[i] * topology.getIndexSize());
+	}
+}
+
+void ProjectedGridRenderer::drawGrid(const GLvoid *pointer, GridVertexFormat format, const GridTopology &topology, int count, int range_count) {
+	glPushAttrib(GL_CURRENT_BIT);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	glColor3f(0.f, 1.f, 0.f);
+
+	// Draw the grid
+	switch (format) {
+	case GRID_FORMAT_HALF:
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		glTranslatef(m_origin.x, m_origin.y, m_origin.z);
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3, GL_HALF_FLOAT, 0, pointer);
+		break;
+	case GRID_FORMAT_QUANTIZED:
+		glUseProgram(m_decode_program);
+		glUniform3f(m_decode_origin, m_origin.x, m_origin.y, m_origin.z);
+		glUniform1f(m_decode_quantum, m_quantum);
+		glEnableVertexAttribArray(QUANTIZED_XZ_ATTRIB);
+		glEnableVertexAttribArray(HALF_Y_ATTRIB);
+		glVertexAttribPointer(QUANTIZED_XZ_ATTRIB, 2, GL_SHORT, GL_FALSE, 3 * sizeof(short), pointer);
+		glVertexAttribPointer(HALF_Y_ATTRIB, 1, GL_HALF_FLOAT, GL_FALSE, 3 * sizeof(short), (const GLubyte*)pointer + 2 * sizeof(short));
+		break;
+	default:
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, pointer);
+		break;
+	}
+	const GLenum index_type = topology.isShortIndex() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	if (range_count >= 0) {
+		// Only what lies between the generated spans, the rest of the buffer is undefined
+		if (range_count > 0) {
+			switch (topology.getType()) {
+			case GRID_TOPOLOGY_TRIANGLES:
+			case GRID_TOPOLOGY_STRIPS:
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+				glMultiDrawElements(topology.getType() == GRID_TOPOLOGY_STRIPS ? GL_TRIANGLE_STRIP : GL_TRIANGLES,
+					&m_range_sizes[0], index_type, &m_range_offsets[0], range_count);
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+				break;
+			default:
+				glMultiDrawArrays(GL_POINTS, &m_range_firsts[0], &m_range_sizes[0], range_count);
+				break;
+			}
+		}
+	} else {
+		switch (topology.getType()) {
+		case GRID_TOPOLOGY_TRIANGLES:
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+			glDrawElements(GL_TRIANGLES, topology.getIndexCount(), index_type, NULL);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			break;
+		case GRID_TOPOLOGY_STRIPS:
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+			if (GLEW_VERSION_3_1) {
+				glEnable(GL_PRIMITIVE_RESTART);
+				glPrimitiveRestartIndex(topology.getRestartIndex());
+				glDrawElements(GL_TRIANGLE_STRIP, topology.getIndexCount(), index_type, NULL);
+				glDisable(GL_PRIMITIVE_RESTART);
+			} else if (!m_strip_sizes.empty()) {
+				glMultiDrawElements(GL_TRIANGLE_STRIP, &m_strip_sizes[0], index_type, &m_strip_offsets[0], (GLsizei)m_strip_sizes.size());
+			}
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+			break;
+		default:
+			glDrawArrays(GL_POINTS, 0, count);
+			break;
+		}
+	}
+
+	switch (format) {
+	case GRID_FORMAT_HALF:
+		glPopMatrix();
+		break;
+	case GRID_FORMAT_QUANTIZED:
+		glDisableVertexAttribArray(QUANTIZED_XZ_ATTRIB);
+		glDisableVertexAttribArray(HALF_Y_ATTRIB);
+		glUseProgram(0);
+		break;
+	default:
+		break;
+	}
+	glPopClientAttrib();
+	glPopAttrib();
+}
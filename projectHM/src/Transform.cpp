@@ -0,0 +1,218 @@
+#include "projectHM_PCH.h"
+
+#include "Transform.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#define TRANSFORM_TARGET_AVX
+#else
+// AVX without FMA, for the products to be rounded as the scalar reference rounds them
+#define TRANSFORM_TARGET_AVX __attribute__((target("avx")))
+#endif
+
+namespace {
+	enum TransformMode {
+		TRANSFORM_POINT,		// divided by w
+		TRANSFORM_AFFINE,		// w taken as 1
+		TRANSFORM_VECTOR		// without the translation
+	};
+
+	enum TransformAccess {
+		ACCESS_UNALIGNED,
+		ACCESS_ALIGNED,
+		ACCESS_STREAM			// aligned, stored around the caches
+	};
+
+	// From about 1 MB of output on, the points won't be in the caches when read again, and
+	//	streaming them out saves reading the lines before writing them
+	const int STREAM_MIN_POINTS = 1 << 16;
+
+	inline bool isAligned(const void *p, size_t alignment) {
+		return ((size_t)p & (alignment - 1)) == 0;
+	}
+
+	inline bool areAligned(const float *x, const float *y, const float *z, const float *out_x, const float *out_y, const float *out_z, size_t alignment) {
+		return isAligned(x, alignment) && isAligned(y, alignment) && isAligned(z, alignment)
+			&& isAligned(out_x, alignment) && isAligned(out_y, alignment) && isAligned(out_z, alignment);
+	}
+
+	// -------------------------
+	// Scalar, the reference
+	// -------------------------
+	template<int MODE>
+	void transformScalar(const float *m, const float *x, const float *y, const float *z,
+		float *out_x, float *out_y, float *out_z, int first, int count) {
+		for (int i = first; i < count; ++i) {
+			const float px = x[i], py = y[i], pz = z[i];
+			float rx = m[0] * px + m[4] * py + m[8] * pz;
+			float ry = m[1] * px + m[5] * py + m[9] * pz;
+			float rz = m[2] * px + m[6] * py + m[10] * pz;
+			if (MODE != TRANSFORM_VECTOR) {
+				rx += m[12];
+				ry += m[13];
+				rz += m[14];
+			}
+			if (MODE == TRANSFORM_POINT) {
+				const float rw = m[3] * px + m[7] * py + m[11] * pz + m[15];
+				rx /= rw;
+				ry /= rw;
+				rz /= rw;
+			}
+			out_x[i] = rx;
+			out_y[i] = ry;
+			out_z[i] = rz;
+		}
+	}
+
+	// -------------------------
+	// SSE2, 4 points at a time
+	// -------------------------
+	template<int ACCESS> inline __m128 load4(const float *p) {
+		return ACCESS == ACCESS_UNALIGNED ? _mm_loadu_ps(p) : _mm_load_ps(p);
+	}
+	template<int ACCESS> inline void store4(float *p, __m128 v) {
+		if (ACCESS == ACCESS_STREAM) {
+			_mm_stream_ps(p, v);
+		} else if (ACCESS == ACCESS_ALIGNED) {
+			_mm_store_ps(p, v);
+		} else {
+			_mm_storeu_ps(p, v);
+		}
+	}
+
+	inline __m128 dot4(const __m128 *c, int row, __m128 px, __m128 py, __m128 pz) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[row], px), _mm_mul_ps(c[row + 4], py)), _mm_mul_ps(c[row + 8], pz));
+	}
+
+	template<int MODE, int ACCESS>
+	void transformSSE2(const float *m, const float *x, const float *y, const float *z,
+		float *out_x, float *out_y, float *out_z, int count) {
+		__m128 c[16];
+		for (int k = 0; k < 16; ++k) {
+			c[k] = _mm_set1_ps(m[k]);
+		}
+		const int batched = count & ~3;
+		for (int i = 0; i < batched; i += 4) {
+			const __m128 px = load4<ACCESS>(x + i), py = load4<ACCESS>(y + i), pz = load4<ACCESS>(z + i);
+			__m128 rx = dot4(c, 0, px, py, pz), ry = dot4(c, 1, px, py, pz), rz = dot4(c, 2, px, py, pz);
+			if (MODE != TRANSFORM_VECTOR) {
+				rx = _mm_add_ps(rx, c[12]);
+				ry = _mm_add_ps(ry, c[13]);
+				rz = _mm_add_ps(rz, c[14]);
+			}
+			if (MODE == TRANSFORM_POINT) {
+				const __m128 rw = _mm_add_ps(dot4(c, 3, px, py, pz), c[15]);
+				rx = _mm_div_ps(rx, rw);
+				ry = _mm_div_ps(ry, rw);
+				rz = _mm_div_ps(rz, rw);
+			}
+			store4<ACCESS>(out_x + i, rx);
+			store4<ACCESS>(out_y + i, ry);
+			store4<ACCESS>(out_z + i, rz);
+		}
+		if (ACCESS == ACCESS_STREAM) {
+			_mm_sfence();
+		}
+		transformScalar<MODE>(m, x, y, z, out_x, out_y, out_z, batched, count);
+	}
+
+	// -------------------------
+	// AVX, 8 points at a time
+	// -------------------------
+	template<int ACCESS> TRANSFORM_TARGET_AVX inline __m256 load8(const float *p) {
+		return ACCESS == ACCESS_UNALIGNED ? _mm256_loadu_ps(p) : _mm256_load_ps(p);
+	}
+	template<int ACCESS> TRANSFORM_TARGET_AVX inline void store8(float *p, __m256 v) {
+		if (ACCESS == ACCESS_STREAM) {
+			_mm256_stream_ps(p, v);
+		} else if (ACCESS == ACCESS_ALIGNED) {
+			_mm256_store_ps(p, v);
+		} else {
+			_mm256_storeu_ps(p, v);
+		}
+	}
+
+	TRANSFORM_TARGET_AVX inline __m256 dot8(const __m256 *c, int row, __m256 px, __m256 py, __m256 pz) {
+		return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[row], px), _mm256_mul_ps(c[row + 4], py)), _mm256_mul_ps(c[row + 8], pz));
+	}
+
+	template<int MODE, int ACCESS>
+	TRANSFORM_TARGET_AVX void transformAVX(const float *m, const float *x, const float *y, const float *z,
+		float *out_x, float *out_y, float *out_z, int count) {
+		__m256 c[16];
+		for (int k = 0; k < 16; ++k) {
+			c[k] = _mm256_set1_ps(m[k]);
+		}
+		const int batched = count & ~7;
+		for (int i = 0; i < batched; i += 8) {
+			const __m256 px = load8<ACCESS>(x + i), py = load8<ACCESS>(y + i), pz = load8<ACCESS>(z + i);
+			__m256 rx = dot8(c, 0, px, py, pz), ry = dot8(c, 1, px, py, pz), rz = dot8(c, 2, px, py, pz);
+			if (MODE != TRANSFORM_VECTOR) {
+				rx = _mm256_add_ps(rx, c[12]);
+				ry = _mm256_add_ps(ry, c[13]);
+				rz = _mm256_add_ps(rz, c[14]);
+			}
+			if (MODE == TRANSFORM_POINT) {
+				const __m256 rw = _mm256_add_ps(dot8(c, 3, px, py, pz), c[15]);
+				rx = _mm256_div_ps(rx, rw);
+				ry = _mm256_div_ps(ry, rw);
+				rz = _mm256_div_ps(rz, rw);
+			}
+			store8<ACCESS>(out_x + i, rx);
+			store8<ACCESS>(out_y + i, ry);
+			store8<ACCESS>(out_z + i, rz);
+		}
+		if (ACCESS == ACCESS_STREAM) {
+			_mm_sfence();
+		}
+		_mm256_zeroupper();
+		transformScalar<MODE>(m, x, y, z, out_x, out_y, out_z, batched, count);
+	}
+
+	template<int MODE>
+	void transform(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+		float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel) {
+		const float *m = glm::value_ptr(m_transform);
+		const bool stream = count >= STREAM_MIN_POINTS;
+		switch (resolveGridKernel(kernel)) {
+		case GRID_KERNEL_AVX2:
+			if (!areAligned(x, y, z, out_x, out_y, out_z, 32)) {
+				transformAVX<MODE, ACCESS_UNALIGNED>(m, x, y, z, out_x, out_y, out_z, count);
+			} else if (stream) {
+				transformAVX<MODE, ACCESS_STREAM>(m, x, y, z, out_x, out_y, out_z, count);
+			} else {
+				transformAVX<MODE, ACCESS_ALIGNED>(m, x, y, z, out_x, out_y, out_z, count);
+			}
+			break;
+		case GRID_KERNEL_SSE2:
+			if (!areAligned(x, y, z, out_x, out_y, out_z, 16)) {
+				transformSSE2<MODE, ACCESS_UNALIGNED>(m, x, y, z, out_x, out_y, out_z, count);
+			} else if (stream) {
+				transformSSE2<MODE, ACCESS_STREAM>(m, x, y, z, out_x, out_y, out_z, count);
+			} else {
+				transformSSE2<MODE, ACCESS_ALIGNED>(m, x, y, z, out_x, out_y, out_z, count);
+			}
+			break;
+		default:
+			transformScalar<MODE>(m, x, y, z, out_x, out_y, out_z, 0, count);
+			break;
+		}
+	}
+}
+
+void transformPoints(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel) {
+	transform<TRANSFORM_POINT>(m_transform, x, y, z, out_x, out_y, out_z, count, kernel);
+}
+
+void transformAffinePoints(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel) {
+	transform<TRANSFORM_AFFINE>(m_transform, x, y, z, out_x, out_y, out_z, count, kernel);
+}
+
+void transformVectors(const glm::mat4 &m_transform, const float *x, const float *y, const float *z,
+	float *out_x, float *out_y, float *out_z, int count, GridKernelType kernel) {
+	transform<TRANSFORM_VECTOR>(m_transform, x, y, z, out_x, out_y, out_z, count, kernel);
+}
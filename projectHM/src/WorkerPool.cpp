@@ -0,0 +1,96 @@
+#include "projectHM_PCH.h"
+
+#include "WorkerPool.h"
+#include "../../hxlib/include/Profiler.h"
+
+WorkerPool::WorkerPool(int thread_count)
+	: m_generation(0), m_busy(0), m_quit(false), m_func(NULL), m_context(NULL),
+	m_count(0), m_band_size(0), m_band_num(0), m_next_band(0) {
+	if (thread_count <= 0) {
+		thread_count = getHardwareThreadCount();
+	}
+	for (int i = 1; i < thread_count; ++i) {
+		m_workers.push_back(std::thread(&WorkerPool::workerLoop, this));
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake_cond.notify_all();
+	for (size_t i = 0; i < m_workers.size(); ++i) {
+		m_workers[i].join();
+	}
+}
+
+int WorkerPool::getHardwareThreadCount() {
+	int n = (int)std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+void WorkerPool::parallelFor(int count, int grain, TaskFunc func, void *context) {
+	if (count <= 0) {
+		return;
+	}
+	const int threads = getThreadCount();
+	// A few bands per thread so that a slow band doesn't stall the others
+	int band_size = std::max(std::max(grain, 1), count / (threads * 4));
+	int band_num = (count + band_size - 1) / band_size;
+	if (threads == 1 || band_num == 1) {
+		func(context, 0, count);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = func;
+		m_context = context;
+		m_count = count;
+		m_band_size = band_size;
+		m_band_num = band_num;
+		m_next_band.store(0);
+		m_busy = (int)m_workers.size();
+		++m_generation;
+	}
+	m_wake_cond.notify_all();
+	runBands();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_busy > 0) {
+		m_done_cond.wait(lock);
+	}
+}
+
+void WorkerPool::runBands() {
+	for (;;) {
+		int band = m_next_band.fetch_add(1);
+		if (band >= m_band_num) {
+			break;
+		}
+		int begin = band * m_band_size;
+		int end = std::min(begin + m_band_size, m_count);
+		PROFILE_ZONE("WorkerPool band");
+		m_func(m_context, begin, end);
+	}
+}
+
+void WorkerPool::workerLoop() {
+	Profiler::setThreadName("worker pool");
+	unsigned seen_generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		while (!m_quit && m_generation == seen_generation) {
+			m_wake_cond.wait(lock);
+		}
+		if (m_quit) {
+			break;
+		}
+		seen_generation = m_generation;
+		lock.unlock();
+		runBands();
+		lock.lock();
+		if (--m_busy == 0) {
+			m_done_cond.notify_one();
+		}
+	}
+}
@@ -6,13 +6,19 @@
 #include <gl/glut.h>
 
 #include "../../hxlib/include/WindowsTimer.h"
+#include "../../hxlib/include/Profiler.h"
 
 #include "Scene.h"
 #include "Shape.h"
 #include "Camera.h"
+#include "OceanFFT.h"
+#include "PerlinNoise.h"
 #include "Transform.h"
 #include "ProjectedGrid.h"
+#include "GridPipeline.h"
+#include "GridTrace.h"
 #include "GLRenderControler.h"
+#include "ProjectedGridRenderer.h"
 
 // -------------------------
 // Hack parameters
@@ -32,6 +38,15 @@ int pre_x, pre_y, button_mask = 0;
 
 WindowsTimer walk_timer;
 
+// Camera path recording, replayed by gridBench
+const char *camera_path_file = "../data/scenes/camera_path.cfg";
+FILE *camera_path_writter = NULL;
+// Grid trace recording, replayed by gridBench -replay
+const char *grid_trace_file = "../data/scenes/grid_trace.bin";
+GridTraceWriter grid_trace_writer;
+// Profile of the frames, opened with chrome://tracing
+const char *profile_file = "../data/scenes/profile.json";
+
 const float walk_speed = 0.004f;
 const float mouse_speed = 0.001f;
 
@@ -60,16 +75,37 @@ ProjectedGrid proj_grid(
 	&camera,
 	ProjectedGridOptions(256, 0.1f, 0.1f)
 	);
+ProjectedGridRenderer proj_grid_renderer;
+// Builds the grid of the next frame on a worker thread while the current one is drawn, 'P'
+GridPipeline grid_pipeline(proj_grid, 0.2f, -0.1f, 0.5f);
+// Waves displacing the grid, scaled by the grid's strength, 'N' switches between them
+OceanFFT ocean(OceanFFTOptions(256, 16.f, 6.f));
+PerlinNoise noise(PerlinNoiseOptions(256, 16.f));
+HeightField *height_field = &ocean;
 
 void renderProjectedGrids() {
+	PROFILE_ZONE("renderProjectedGrids");
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+	// With the pipeline, the frame the worker built during the last one is drawn from the
+	//	camera it was built for, while the worker builds the next one
+	const GridPipelineFrame *frame = NULL;
+	const float time = glutGet(GLUT_ELAPSED_TIME) * 0.001f;
+	if (grid_pipeline.isRunning()) {
+		frame = grid_pipeline.acquire(true);
+		grid_pipeline.submit(camera, time);
+		if (frame == NULL) {
+			glutSwapBuffers();
+			return;
+		}
+	}
+
 	glViewport(0, 0, screenWidth, screenHeight);
 	glMatrixMode(GL_PROJECTION);
-	glm::mat4 projection_mat = camera.getProjectionMatrix();
+	glm::mat4 projection_mat = frame ? frame->projection_matrix : camera.getProjectionMatrix();
 	glLoadMatrixf(glm::value_ptr(projection_mat));
 	glm::mat4 model_mat(1.f);
-	glm::mat4 view_mat = camera.getViewMatrix();
+	glm::mat4 view_mat = frame ? frame->view_matrix : camera.getViewMatrix();
 	glm::mat4 model_view = view_mat * model_mat;
 	glMatrixMode(GL_MODELVIEW);
 	glLoadMatrixf(glm::value_ptr(model_view));
@@ -78,8 +114,15 @@ void renderProjectedGrids() {
 
 	// Use the projected grid
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	if (proj_grid.getRangeMatrix(0.2f, -0.1f, 0.5f)) {
-		proj_grid.renderGeometry();
+	if (frame) {
+		proj_grid_renderer.render(*frame);
+	} else {
+		height_field->update(time);
+		const bool visible = proj_grid.getRangeMatrix(0.2f, -0.1f, 0.5f);
+		grid_trace_writer.record(proj_grid, time, 0.2f, -0.1f, 0.5f, visible);
+		if (visible) {
+			proj_grid_renderer.render(proj_grid);
+		}
 	}
 
 	glFinish();
@@ -87,6 +130,9 @@ void renderProjectedGrids() {
 }
 
 void displayCallback() {
+	if (camera_path_writter) {
+		camera.writeParas(camera_path_writter);
+	}
 	renderProjectedGrids();
 }
 
@@ -135,9 +181,17 @@ void mouseCallback(int button, int state, int x, int y) {
 }
 
 void destroyWorld() {
+	grid_pipeline.stop();
+	proj_grid_renderer.release();
+	if (camera_path_writter) {
+		fclose(camera_path_writter);
+		camera_path_writter = NULL;
+	}
 }
 
 void keyboardCallback(unsigned char key, int /*x*/, int /*y*/) {
+	// The worker must be done with the grid before anything changes it
+	grid_pipeline.finish();
 	switch (key) {
 	case 27:
 		destroyWorld();
@@ -152,6 +206,99 @@ void keyboardCallback(unsigned char key, int /*x*/, int /*y*/) {
 	case 'L':
 		camera.loadParasFromFile("../data/scenes/camera.cfg");
 		break;
+	case 'N':
+		// A trace is of one height field, it ends with it
+		if (grid_trace_writer.isOpen()) {
+			grid_trace_writer.close();
+			printf("Stopped recording grid trace of %d frames into file '%s'\n", grid_trace_writer.getFrameCount(), grid_trace_file);
+		}
+		height_field = height_field == &ocean ? (HeightField*)&noise : (HeightField*)&ocean;
+		grid_pipeline.setHeightField(height_field);
+		break;
+	case 'A': {
+		// Adaptive resolution within a 4 ms budget, or back to the fixed 256 x 256
+		ProjectedGridOptions options = proj_grid.getOptions();
+		options.adaptive = !options.adaptive;
+		proj_grid.setOptions(options);
+		printf("Adaptive grid resolution %s\n", options.adaptive ? "on" : "off");
+		break;
+	}
+	case 'C': {
+		// Only generate and draw the parts of the rows inside the view
+		ProjectedGridOptions options = proj_grid.getOptions();
+		options.cull_rows = !options.cull_rows;
+		proj_grid.setOptions(options);
+		printf("Grid row culling %s\n", options.cull_rows ? "on" : "off");
+		break;
+	}
+	case 'T': {
+		// Keep the undisplaced vertices while the camera barely moves, the waves still move them
+		ProjectedGridOptions options = proj_grid.getOptions();
+		options.temporal = !options.temporal;
+		proj_grid.setOptions(options);
+		printf("Temporal grid reuse %s\n", options.temporal ? "on" : "off");
+		break;
+	}
+	case 'F': {
+		// Cycle the vertex buffer through floats, half floats and quantized positions
+		const GridVertexFormat format = (GridVertexFormat)((proj_grid_renderer.getVertexFormat() + 1) % (GRID_FORMAT_QUANTIZED + 1));
+		proj_grid_renderer.setVertexFormat(format);
+		printf("Grid vertex format %s\n", ProjectedGridRenderer::getVertexFormatName(format));
+		break;
+	}
+	case 'G': {
+		// Record the grid stats, and save the last frames as CSV when stopping
+		ProjectedGridOptions options = proj_grid.getOptions();
+		if (options.stats && proj_grid.getStats()->saveCSV("../data/scenes/grid_stats.csv")) {
+			puts("Saved grid stats into file '../data/scenes/grid_stats.csv'");
+		}
+		options.stats = !options.stats;
+		proj_grid.setOptions(options);
+		printf("Grid stats %s\n", options.stats ? "on" : "off");
+		break;
+	}
+	case 'P':
+		// Build the grid one frame ahead on a worker thread
+		if (grid_pipeline.isRunning()) {
+			grid_pipeline.stop();
+		} else {
+			grid_pipeline.start();
+		}
+		printf("Grid pipeline %s\n", grid_pipeline.isRunning() ? "on" : "off");
+		break;
+	case 'R':
+		if (camera_path_writter) {
+			fclose(camera_path_writter);
+			camera_path_writter = NULL;
+			printf("Stopped recording camera path into file '%s'\n", camera_path_file);
+		} else if ((camera_path_writter = fopen(camera_path_file, "w")) != NULL) {
+			printf("Started recording camera path into file '%s'\n", camera_path_file);
+		} else {
+			fprintf(stderr, "Cannot record camera path into file '%s'\n", camera_path_file);
+		}
+		break;
+	case 'X':
+		// Trace the frames built without the pipeline, the worker's frames aren't recorded
+		if (grid_trace_writer.isOpen()) {
+			grid_trace_writer.close();
+			printf("Stopped recording grid trace of %d frames into file '%s'\n", grid_trace_writer.getFrameCount(), grid_trace_file);
+		} else if (grid_trace_writer.open(grid_trace_file, proj_grid)) {
+			printf("Started recording grid trace into file '%s'\n", grid_trace_file);
+		}
+		break;
+	case 'Z':
+		// The zones of the last frames, the pipeline's worker's included
+		if (Profiler::isEnabled()) {
+			Profiler::setEnabled(false);
+			if (Profiler::saveChromeTrace(profile_file)) {
+				printf("Stopped profiling, written into file '%s'\n", profile_file);
+			}
+		} else {
+			Profiler::reset();
+			Profiler::setEnabled(true);
+			printf("Started profiling\n");
+		}
+		break;
 	// For hack states control
 	case 'h':
 		hack_display = (hack_display + 1) % hack_display_n;
@@ -199,6 +346,8 @@ void goIntoWorld(const char *scene_file_name, int argc, char *argv[]) {
 	camera.setNearClip(0.01f);
 	camera.setScreenWindow(screenWidth, screenHeight);
 
+	grid_pipeline.setHeightField(height_field);
+
 	glutMainLoop();
 }
 